@@ -39,6 +39,28 @@
 # define HAVE_STRDUP
 #endif
 
+/**
+ * posix_spawn_file_actions_addfchdir_np is available since glibc 2.29,
+ * the scripts are started with fork before.
+ */
+#ifdef __GLIBC__
+# if __GLIBC_PREREQ(2,29)
+#  define HAVE_SPAWN_FCHDIR
+# endif
+#endif
+#if defined(USE_POSIXSPAWN) && !defined(HAVE_SPAWN_FCHDIR)
+# undef USE_POSIXSPAWN
+#endif
+
+/**
+ * close_range is available since glibc 2.34
+ */
+#ifdef __GLIBC__
+# if __GLIBC_PREREQ(2,34)
+#  define HAVE_CLOSE_RANGE
+# endif
+#endif
+
 #ifndef NI_MAXHOST
 # define NI_MAXHOST      1025
 # define NI_MAXSERV      32
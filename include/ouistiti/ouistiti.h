@@ -29,10 +29,6 @@
 #ifndef __OUISTITI_CONFIG_H__
 #define __OUISTITI_CONFIG_H__
 
-#ifndef MAX_SERVERS
-#define MAX_SERVERS 4
-#endif
-
 typedef struct server_s server_t;
 
 typedef struct module_s module_t;
@@ -85,8 +81,12 @@ typedef struct ouistiticonfig_s
 	void *configfile;
 	char *user;
 	const char *init_d;
-	serverconfig_t *config[MAX_SERVERS];
+	serverconfig_t **config;
 	int nservers;
+	int workers;
+	const char *cpuaffinity;
+	/// only the configuration which opened the log file closes it
+	int logfd;
 } ouistiticonfig_t;
 
 ouistiticonfig_t *ouistiticonfig_create(const char *filepath);
@@ -101,6 +101,56 @@ int ouistiti_issecure(server_t *server);
 http_server_t *ouistiti_httpserver(server_t *server);
 serverconfig_t *ouistiti_serverconfig(server_t *server);
 
+/**
+ * add a connector selected on the URI.
+ * prefixes and extensions are lists separated by comas,
+ * the connector is called only if the URI starts with one of the prefixes
+ * and contains one of the extensions. NULL matches all URIs.
+ */
+int ouistiti_setroute(http_server_t *server, http_connector_t connector, void *arg, int priority, const char *name,
+		const char *prefixes, const char *extensions);
+/**
+ * add a route without connector, for the connectors of the clients.
+ * ouistiti_checkroute returns EREJECT if the URI of the request is out
+ * of the route, a NULL route matches all URIs.
+ */
+void *ouistiti_addroute(http_server_t *server, const char *prefixes, const char *extensions);
+int ouistiti_checkroute(const void *route, http_message_t *request);
+void ouistiti_freeroutes(http_server_t *server);
+
+/**
+ * check the rights on another URI than the one of the request
+ * (ex: the paths of a batch of operations). The filters are set by the
+ * modules which check the URI of the requests, ESUCCESS allows the URI.
+ */
+typedef int (*ouistiti_pathfilter_t)(void *arg, http_message_t *request, const char *method, const char *uri);
+int ouistiti_setpathfilter(http_server_t *server, ouistiti_pathfilter_t filter, void *arg);
+void ouistiti_unsetpathfilter(void *arg);
+int ouistiti_checkpath(http_server_t *server, http_message_t *request, const char *method, const char *uri);
+
+/**
+ * the modules with their own policy of cache (ex: the documents) return
+ * ESUCCESS if they answer to the URI of the request, with their policy
+ * or NULL for the policy of the server. The server module asks them
+ * in the order of the configuration, the response has only one
+ * Cache-Control header.
+ */
+typedef int (*ouistiti_cachepolicy_t)(void *arg, http_message_t *request, const char **policy);
+int ouistiti_setcachepolicy(http_server_t *server, ouistiti_cachepolicy_t policy, void *arg);
+void ouistiti_unsetcachepolicy(void *arg);
+const char *ouistiti_cachepolicy(http_server_t *server, http_message_t *request);
+
+/**
+ * the modules which need the rights of the user of the server
+ * (ex: the files read in advance) are started after the change of
+ * owner, before the connection of the server, and after the creation
+ * of the modules on a reload of the configuration.
+ */
+typedef void (*ouistiti_start_t)(void *arg);
+int ouistiti_setstart(http_server_t *server, ouistiti_start_t start, void *arg);
+void ouistiti_unsetstart(void *arg);
+void ouistiti_start(http_server_t *server);
+
 typedef struct string_s string_t;
 struct string_s
 {
@@ -130,6 +180,7 @@ extern const char str_head[5];
 
 extern const char str_put[4];
 extern const char str_delete[7];
+extern const char str_patch[6];
 extern const char str_options[8];
 
 extern const char str_authenticate[17];
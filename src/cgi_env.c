@@ -48,6 +48,7 @@ static char str_null[] = "";
 static char str_gatewayinterface[] = "CGI/1.1";
 
 #define ENV_NOTREQUIRED 0x01
+#define ENV_STATIC 0x02
 typedef size_t (*httpenv_callback_t)(const mod_cgi_config_t *config, http_message_t *request, const char *cgi_path, const char **value);
 struct httpenv_s
 {
@@ -224,6 +225,7 @@ static const httpenv_t cgi_env[] =
 		.id = -1,
 		.target = STRING_DCL("GATEWAY_INTERFACE="),
 		.length = 26,
+		.options = ENV_STATIC,
 		.cb = &env_gatewayinterface,
 	},
 	{
@@ -250,6 +252,7 @@ static const httpenv_t cgi_env[] =
 		.id = -1,
 		.target = STRING_DCL("DOCUMENT_ROOT="),
 		.length = 512,
+		.options = ENV_STATIC,
 		.cb = &env_docroot,
 	},
 	{
@@ -415,7 +418,7 @@ static const httpenv_t cgi_env[] =
 		.id = HTTPS,
 		.target = STRING_DCL("HTTPS="),
 		.length = 1,
-		.options = ENV_NOTREQUIRED,
+		.options = ENV_NOTREQUIRED | ENV_STATIC,
 	},
 	{
 		.id = -1,
@@ -433,20 +436,30 @@ static const httpenv_t cgi_env[] =
 	}
 };
 
-char **cgi_buildenv(const mod_cgi_config_t *config, http_message_t *request, const char *cgi_path, size_t cgi_pathlen, const char *path_info, size_t path_infolen)
-{
-	char **env = NULL;
-	int nbenvs = sizeof(cgi_env) / sizeof(*cgi_env);
+#define NBENVS (int)(sizeof(cgi_env) / sizeof(*cgi_env))
 
-	env = calloc(sizeof(char *), nbenvs + config->nbenvs + 1);
+typedef struct cgienv_value_s cgienv_value_t;
+struct cgienv_value_s
+{
+	const httpenv_t *entry;
+	const char *value;
+	size_t length;
+};
 
-	int i = 0;
-	int j = 0;
-	for (i = 0; i < nbenvs; i++)
+/**
+ * the values are selected with the options of the variables,
+ * the static values don't depend on the request.
+ */
+static int _cgienv_values(const mod_cgi_config_t *config, http_message_t *request, int mask, int match,
+		const char *cgi_path, size_t cgi_pathlen, const char *path_info, size_t path_infolen,
+		cgienv_value_t *values)
+{
+	int nbvalues = 0;
+	for (int i = 0; i < NBENVS; i++)
 	{
 		int options = cgi_env[i].options;
-		size_t length = cgi_env[i].target.length + cgi_env[i].length;
-		env[i] = (char *)calloc(1, length + 1);
+		if ((options & mask) != match)
+			continue;
 		const char *value = NULL;
 		int valuelength = -1;
 		switch (cgi_env[i].id)
@@ -474,17 +487,62 @@ char **cgi_buildenv(const mod_cgi_config_t *config, http_message_t *request, con
 			value = str_null;
 			valuelength = sizeof(str_null) - 1;
 		}
-		if (value != NULL)
-		{
-			snprintf(env[j], length + 1, "%s%.*s", cgi_env[i].target.data, valuelength, value);
-			j++;
-		}
+		if (value == NULL)
+			continue;
+		if (valuelength < 0)
+			valuelength = strlen(value);
+		if (valuelength > cgi_env[i].length)
+			valuelength = cgi_env[i].length;
+		values[nbvalues].entry = &cgi_env[i];
+		values[nbvalues].value = value;
+		values[nbvalues].length = valuelength;
+		nbvalues++;
 	}
-	for (i = 0; i < config->nbenvs; i++)
-	{
-		env[j + i] = strdup(config->env[i]);
+	return nbvalues;
+}
+
+/**
+ * the array and the strings are allocated in one block.
+ * The nbshared pointers after the values are set by the caller.
+ */
+static char **_cgienv_arena(const cgienv_value_t *values, int nbvalues, int nbshared)
+{
+	size_t size = (nbvalues + nbshared + 1) * sizeof(char *);
+	for (int i = 0; i < nbvalues; i++)
+		size += values[i].entry->target.length + values[i].length + 1;
+	char **env = malloc(size);
+	if (env == NULL)
+		return NULL;
+	char *data = (char *)(env + nbvalues + nbshared + 1);
+	for (int i = 0; i < nbvalues; i++)
+	{
+		const string_t *target = &values[i].entry->target;
+		env[i] = data;
+		memcpy(data, target->data, target->length);
+		data += target->length;
+		memcpy(data, values[i].value, values[i].length);
+		data += values[i].length;
+		*data++ = '\0';
 	}
-	env[j + i] = NULL;
+	env[nbvalues + nbshared] = NULL;
+	return env;
+}
+
+char **cgi_buildenv(const mod_cgi_config_t *config, http_message_t *request, const char *cgi_path, size_t cgi_pathlen, const char *path_info, size_t path_infolen)
+{
+	cgienv_value_t values[NBENVS];
+	/// the static variables are built by cgienv_config
+	int mask = (config->staticenv != NULL)? ENV_STATIC: 0;
+	int nbvalues = _cgienv_values(config, request, mask, 0, cgi_path, cgi_pathlen, path_info, path_infolen, values);
+
+	char **env = _cgienv_arena(values, nbvalues, config->nbstaticenv + config->nbenvs);
+	if (env == NULL)
+		return NULL;
+	int j = nbvalues;
+	for (int i = 0; i < config->nbstaticenv; i++)
+		env[j++] = config->staticenv[i];
+	for (int i = 0; i < config->nbenvs; i++)
+		env[j++] = (char *)config->env[i];
 	return env;
 }
 
@@ -519,6 +577,19 @@ int cgienv_config(config_setting_t *configserver, config_setting_t *config, serv
 	config_setting_lookup_float(configserver, "timeout", &timeout);
 	cgi->timeout.tv_sec = (int) timeout;
 	cgi->timeout.tv_usec = (int) ((timeout - cgi->timeout.tv_sec) * 1000000);
+#ifdef CGI_POOL
+	config_setting_lookup_string(config, "pool", &cgi->pool);
+	cgi->poolmin = DEFAULT_POOLMIN;
+	config_setting_lookup_int(config, "poolmin", &cgi->poolmin);
+	cgi->poolmax = DEFAULT_POOLMAX;
+	config_setting_lookup_int(config, "poolmax", &cgi->poolmax);
+	if (cgi->poolmax < cgi->poolmin)
+		cgi->poolmax = cgi->poolmin;
+	cgi->poolrequests = DEFAULT_POOLREQUESTS;
+	config_setting_lookup_int(config, "poolrequests", &cgi->poolrequests);
+	cgi->poolidle = DEFAULT_POOLIDLE;
+	config_setting_lookup_int(config, "poolidle", &cgi->poolidle);
+#endif
 	
 #if LIBCONFIG_VER_MINOR < 5
 	config_setting_t *envs = config_setting_get_member(config, "env");
@@ -537,6 +608,12 @@ int cgienv_config(config_setting_t *configserver, config_setting_t *config, serv
 		}
 		cgi->nbenvs = count;
 	}
+
+	cgienv_value_t values[NBENVS];
+	int nbvalues = _cgienv_values(cgi, NULL, ENV_STATIC, ENV_STATIC, NULL, 0, NULL, 0, values);
+	cgi->staticenv = _cgienv_arena(values, nbvalues, 0);
+	if (cgi->staticenv != NULL)
+		cgi->nbstaticenv = nbvalues;
 	*modconfig = cgi;
 	return ESUCCESS;
 }
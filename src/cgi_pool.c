@@ -0,0 +1,1175 @@
+/*****************************************************************************
+ * cgi_pool.c: keep the CGI scripts running as FastCGI workers
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/utils.h"
+#include "ouistiti/log.h"
+#include "mod_cgi.h"
+
+#define pool_dbg(...)
+
+/**
+ * FastCGI 1.0 records
+ */
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_RESPONDER 1
+#define FCGI_HEADERLENGTH 8
+#define FCGI_MAXCONTENT 0xFFFF
+#define FCGI_REQUESTID 1
+
+
+#define POOL_PARAMSSIZE (8 * 1024)
+#define POOL_BACKLOG 4
+#define POOL_STOPDELAY 1
+#define POOL_DIRTEMPLATE "/tmp/ouistiti-cgi.XXXXXX"
+
+/**
+ * The pool is kept by a supervisor started with the module, before
+ * the clients. The processes of the server (fork, threadpool, workers)
+ * share the UNIX socket "ctl" with it: each request sends the name of
+ * the script with one end of a new socket pair, and keeps the other
+ * end during the request. The supervisor starts the workers with
+ * posix_spawn and stops them when the server exits.
+ * The workers listen inside a directory of the supervisor (mode 0700),
+ * only the supervisor connects to them and it sends the connected
+ * socket with the answer.
+ */
+struct cgi_pool_s
+{
+	int ctl;
+	pid_t supervisor;
+	/// the process which started the supervisor has to stop it
+	pid_t owner;
+};
+
+/**
+ * the worker of a request into the process of the server
+ */
+struct cgi_worker_s
+{
+	int ctl;
+	int sock;
+	pid_t pid;
+	const char *script;
+	/// the state of the record received from the worker
+	int type;
+	size_t remaining;
+	size_t padding;
+	int done;
+};
+
+/**
+ * the answer of the supervisor to the name of the script
+ */
+#define POOL_WORKER 1
+#define POOL_NOTFASTCGI 0
+#define POOL_BUSY -1
+typedef struct pool_answer_s pool_answer_t;
+struct pool_answer_s
+{
+	int result;
+	pid_t pid;
+};
+
+/**
+ * the workers and the scripts into the supervisor
+ */
+typedef struct pool_worker_s pool_worker_t;
+typedef struct pool_script_s pool_script_t;
+struct pool_worker_s
+{
+	pid_t pid;
+	int stopping;
+	int busy;
+	int requests;
+	time_t lastused;
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	pool_script_t *script;
+};
+
+/**
+ * the workers run with the user of the processes which use them
+ * (see the "chown" of the authentication), the scripts are separated
+ * by user.
+ */
+struct pool_script_s
+{
+	char *script;
+	uid_t uid;
+	gid_t gid;
+	/// -1 before the first worker, 0 if the script doesn't speak FastCGI
+	int fastcgi;
+	/// the first worker is checked without blocking the supervisor
+	int probe;
+	time_t probestart;
+	pool_worker_t *probeworker;
+	int nworkers;
+	pool_worker_t *workers;
+	int maxworkers;
+	/// the stopping workers keep their slot until the end of the process
+	int nslots;
+	pool_script_t *next;
+};
+
+typedef struct pool_client_s pool_client_t;
+struct pool_client_s
+{
+	int sock;
+	/// the worker is NULL while the script is checked
+	pool_script_t *script;
+	pool_worker_t *worker;
+	/// the worker may die and its slot may be used again
+	pid_t pid;
+};
+
+static volatile sig_atomic_t g_poolstop = 0;
+static char g_pooldir[] = POOL_DIRTEMPLATE;
+
+static int _fcgi_write(int sock, const void *data, size_t length)
+{
+	const char *it = data;
+	while (length > 0)
+	{
+		ssize_t ret = write(sock, it, length);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return EREJECT;
+		it += ret;
+		length -= ret;
+	}
+	return ESUCCESS;
+}
+
+static int _fcgi_read(int sock, void *data, size_t length)
+{
+	char *it = data;
+	while (length > 0)
+	{
+		ssize_t ret = read(sock, it, length);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			errno = ETIMEDOUT;
+		if (ret == 0)
+			errno = ECONNRESET;
+		if (ret <= 0)
+			return EREJECT;
+		it += ret;
+		length -= ret;
+	}
+	return ESUCCESS;
+}
+
+static void _fcgi_header(unsigned char *header, int type, size_t length)
+{
+	header[0] = FCGI_VERSION_1;
+	header[1] = type;
+	header[2] = (FCGI_REQUESTID >> 8) & 0xFF;
+	header[3] = FCGI_REQUESTID & 0xFF;
+	header[4] = (length >> 8) & 0xFF;
+	header[5] = length & 0xFF;
+	header[6] = 0;
+	header[7] = 0;
+}
+
+/**
+ * the content is split into records of 64kB at most,
+ * an empty content is the end of the stream.
+ */
+static int _fcgi_record(int sock, int type, const char *data, size_t length)
+{
+	do
+	{
+		size_t size = (length < FCGI_MAXCONTENT)? length: FCGI_MAXCONTENT;
+		unsigned char header[FCGI_HEADERLENGTH];
+		_fcgi_header(header, type, size);
+		struct iovec iov[2] = {
+			{.iov_base = header, .iov_len = sizeof(header)},
+			{.iov_base = (void *)data, .iov_len = size},
+		};
+		ssize_t ret = writev(sock, iov, (size > 0)? 2: 1);
+		if (ret < 0)
+			return EREJECT;
+		if ((size_t)ret < sizeof(header) + size)
+		{
+			/// the end of the record after a partial writing
+			size_t sent = ret;
+			if (sent < sizeof(header) &&
+				_fcgi_write(sock, header + sent, sizeof(header) - sent) != ESUCCESS)
+				return EREJECT;
+			sent = (sent > sizeof(header))? sent - sizeof(header): 0;
+			if (_fcgi_write(sock, data + sent, size - sent) != ESUCCESS)
+				return EREJECT;
+		}
+		data += size;
+		length -= size;
+	} while (length > 0);
+	return ESUCCESS;
+}
+
+static size_t _fcgi_length(unsigned char *data, size_t length)
+{
+	if (length < 0x80)
+	{
+		data[0] = length;
+		return 1;
+	}
+	data[0] = ((length >> 24) & 0x7F) | 0x80;
+	data[1] = (length >> 16) & 0xFF;
+	data[2] = (length >> 8) & 0xFF;
+	data[3] = length & 0xFF;
+	return 4;
+}
+
+/**
+ * the environment of the CGI is sent as name-value pairs
+ */
+static int _fcgi_params(int sock, char **env)
+{
+	unsigned char params[POOL_PARAMSSIZE];
+	size_t length = 0;
+	for (; env != NULL && *env != NULL; env++)
+	{
+		const char *value = strchr(*env, '=');
+		if (value == NULL)
+			continue;
+		size_t namelength = value - *env;
+		value++;
+		size_t valuelength = strlen(value);
+		size_t pairlength = namelength + valuelength + 8;
+		if (pairlength > sizeof(params))
+			continue;
+		if (length + pairlength > sizeof(params))
+		{
+			if (_fcgi_record(sock, FCGI_PARAMS, (char *)params, length) != ESUCCESS)
+				return EREJECT;
+			length = 0;
+		}
+		length += _fcgi_length(params + length, namelength);
+		length += _fcgi_length(params + length, valuelength);
+		memcpy(params + length, *env, namelength);
+		length += namelength;
+		memcpy(params + length, value, valuelength);
+		length += valuelength;
+	}
+	if (length > 0 && _fcgi_record(sock, FCGI_PARAMS, (char *)params, length) != ESUCCESS)
+		return EREJECT;
+	return _fcgi_record(sock, FCGI_PARAMS, NULL, 0);
+}
+
+
+/**
+ * the sockets of the workers are reachable only with the rights
+ * of the supervisor, the real user of the server.
+ */
+static int _pool_connect(pool_worker_t *worker)
+{
+	if (seteuid(getuid()) < 0)
+		return -1;
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sock == -1)
+		return -1;
+	/// a full backlog is a busy worker, the supervisor doesn't wait
+	if (connect(sock, (struct sockaddr *)&worker->addr, worker->addrlen) == -1)
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * FCGI_GET_VALUES is answered by the FastCGI libraries,
+ * a classic CGI script exits without response.
+ * The answer is read by the loop of the supervisor.
+ */
+static int _pool_startprobe(pool_script_t *script, pool_worker_t *worker)
+{
+	int sock = _pool_connect(worker);
+	if (sock == -1)
+		return EREJECT;
+	unsigned char request[FCGI_HEADERLENGTH + 2 + sizeof("FCGI_MPXS_CONNS") - 1];
+	_fcgi_header(request, FCGI_GET_VALUES, sizeof(request) - FCGI_HEADERLENGTH);
+	request[2] = 0;
+	request[3] = 0;
+	request[FCGI_HEADERLENGTH] = sizeof("FCGI_MPXS_CONNS") - 1;
+	request[FCGI_HEADERLENGTH + 1] = 0;
+	memcpy(request + FCGI_HEADERLENGTH + 2, "FCGI_MPXS_CONNS", sizeof("FCGI_MPXS_CONNS") - 1);
+	/// the socket buffer is empty, the request is sent at once
+	if (send(sock, request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+	{
+		close(sock);
+		return EREJECT;
+	}
+	script->probe = sock;
+	script->probestart = time(NULL);
+	script->probeworker = worker;
+	return ESUCCESS;
+}
+
+static int _pool_readprobe(int sock)
+{
+	unsigned char header[FCGI_HEADERLENGTH];
+	ssize_t ret = recv(sock, header, sizeof(header), MSG_DONTWAIT);
+	if (ret >= 2 && header[0] == FCGI_VERSION_1 && header[1] == FCGI_GET_VALUES_RESULT)
+		return 1;
+	return 0;
+}
+
+/**
+ * the same change as auth_setowner, the saved set-uid gives
+ * the rights back before each change.
+ */
+static int _pool_setowner(uid_t uid, gid_t gid)
+{
+	if (geteuid() == uid && getegid() == gid)
+		return ESUCCESS;
+	if (seteuid(getuid()) < 0 || setegid(gid) < 0 || seteuid(uid) < 0)
+	{
+		err("cgi: worker user %d error %s", (int)uid, strerror(errno));
+		return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+static void _pool_unlink(pool_worker_t *worker)
+{
+	if (worker->addr.sun_path[0] != '\0' && seteuid(getuid()) == 0)
+		unlink(worker->addr.sun_path);
+	worker->addr.sun_path[0] = '\0';
+}
+
+/**
+ * the supervisor runs into the docroot, the path of the script is relative
+ */
+static int _pool_spawn(pool_script_t *script, pool_worker_t *worker, const mod_cgi_config_t *config)
+{
+	static unsigned int counter = 0;
+	memset(worker, 0, sizeof(*worker));
+	worker->script = script;
+	worker->addr.sun_family = AF_UNIX;
+	int length = snprintf(worker->addr.sun_path, sizeof(worker->addr.sun_path),
+			"%s/%u", g_pooldir, counter++);
+	worker->addrlen = offsetof(struct sockaddr_un, sun_path) + length + 1;
+
+	/// the socket belongs to the supervisor, the worker gets only the descriptor
+	if (seteuid(getuid()) < 0)
+		return EREJECT;
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock == -1)
+		return EREJECT;
+	if (bind(sock, (struct sockaddr *)&worker->addr, worker->addrlen) == -1 ||
+		listen(sock, POOL_BACKLOG) == -1)
+	{
+		err("cgi: worker socket error %s", strerror(errno));
+		close(sock);
+		unlink(worker->addr.sun_path);
+		return EREJECT;
+	}
+	if (_pool_setowner(script->uid, script->gid) != ESUCCESS)
+	{
+		close(sock);
+		unlink(worker->addr.sun_path);
+		return EREJECT;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	/// FastCGI gives the listening socket as standard input
+	posix_spawn_file_actions_adddup2(&actions, sock, STDIN_FILENO);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	char * const argv[2] = { script->script, NULL };
+	char **env = calloc(config->nbenvs + 1, sizeof(*env));
+	for (int i = 0; env != NULL && i < config->nbenvs; i++)
+		env[i] = (char *)config->env[i];
+	pid_t pid = -1;
+	int ret = ENOMEM;
+	if (env != NULL)
+		ret = posix_spawn(&pid, script->script, &actions, NULL, argv, env);
+	posix_spawn_file_actions_destroy(&actions);
+	free(env);
+	close(sock);
+	if (ret != 0)
+	{
+		err("cgi: worker %s error %s", script->script, strerror(ret));
+		_pool_unlink(worker);
+		return EREJECT;
+	}
+	worker->pid = pid;
+	worker->lastused = time(NULL);
+	script->nworkers++;
+	warn("cgi: worker %s started (%d)", script->script, pid);
+	return ESUCCESS;
+}
+
+static void _pool_stop(pool_worker_t *worker)
+{
+	if (worker->pid <= 0 || worker->stopping)
+		return;
+	kill(worker->pid, SIGTERM);
+	worker->stopping = 1;
+	worker->script->nworkers--;
+	pool_dbg("cgi: worker %d stopped", worker->pid);
+}
+
+static pool_worker_t *_pool_freeslot(pool_script_t *script)
+{
+	for (int i = 0; i < script->nslots; i++)
+	{
+		if (script->workers[i].pid <= 0)
+			return &script->workers[i];
+	}
+	return NULL;
+}
+
+/**
+ * the workers idle for too long are stopped, the pool keeps "poolmin"
+ * workers of the FastCGI scripts.
+ */
+static void _pool_reap(pool_script_t *script, const mod_cgi_config_t *config, time_t now)
+{
+	for (int i = 0; i < script->nslots; i++)
+	{
+		pool_worker_t *worker = &script->workers[i];
+		if (worker->pid > 0 && !worker->busy && !worker->stopping &&
+			script->nworkers > config->poolmin && now - worker->lastused > config->poolidle)
+			_pool_stop(worker);
+	}
+	while (script->fastcgi == 1 && script->nworkers < config->poolmin)
+	{
+		pool_worker_t *slot = _pool_freeslot(script);
+		if (slot == NULL || _pool_spawn(script, slot, config) != ESUCCESS)
+			break;
+	}
+}
+
+static void _pool_died(pool_script_t *scripts, pid_t pid)
+{
+	for (pool_script_t *script = scripts; script != NULL; script = script->next)
+	{
+		for (int i = 0; i < script->nslots; i++)
+		{
+			pool_worker_t *worker = &script->workers[i];
+			if (worker->pid != pid)
+				continue;
+			if (!worker->stopping)
+			{
+				warn("cgi: worker %s (%d) died", script->script, pid);
+				script->nworkers--;
+			}
+			_pool_unlink(worker);
+			worker->pid = 0;
+			worker->stopping = 0;
+			worker->busy = 0;
+			return;
+		}
+	}
+}
+
+static pool_script_t *_pool_get(pool_script_t **scripts, const mod_cgi_config_t *config,
+		const char *name, uid_t uid, gid_t gid)
+{
+	pool_script_t *script;
+	for (script = *scripts; script != NULL; script = script->next)
+	{
+		if (script->uid == uid && script->gid == gid && !strcmp(script->script, name))
+			return script;
+	}
+	script = calloc(1, sizeof(*script));
+	if (script == NULL)
+		return NULL;
+	script->maxworkers = (config->poolmax > 0)? config->poolmax: 1;
+	script->nslots = script->maxworkers * 2;
+	script->workers = calloc(script->nslots, sizeof(*script->workers));
+	script->script = strdup(name);
+	if (script->workers == NULL || script->script == NULL)
+	{
+		free(script->workers);
+		free(script->script);
+		free(script);
+		return NULL;
+	}
+	script->uid = uid;
+	script->gid = gid;
+	script->fastcgi = -1;
+	script->probe = -1;
+	script->next = *scripts;
+	*scripts = script;
+	return script;
+}
+
+/**
+ * the result of the check of the first worker
+ */
+static void _pool_endprobe(pool_script_t *script, int fastcgi)
+{
+	if (script->probe != -1)
+		close(script->probe);
+	script->probe = -1;
+	script->fastcgi = fastcgi;
+	pool_worker_t *worker = script->probeworker;
+	script->probeworker = NULL;
+	if (fastcgi == 0)
+		warn("cgi: %s is not a FastCGI application, it runs as CGI", script->script);
+	if (fastcgi == 0 && worker != NULL && worker->pid > 0 && !worker->stopping)
+	{
+		kill(worker->pid, SIGKILL);
+		worker->stopping = 1;
+		script->nworkers--;
+	}
+}
+
+/**
+ * a new worker is started if all are busy.
+ */
+static pool_worker_t *_pool_acquire(pool_script_t *script, const mod_cgi_config_t *config)
+{
+	if (script->fastcgi != 1)
+		return NULL;
+	while (script->nworkers < config->poolmin)
+	{
+		pool_worker_t *slot = _pool_freeslot(script);
+		if (slot == NULL || _pool_spawn(script, slot, config) != ESUCCESS)
+			break;
+	}
+	for (int i = 0; i < script->nslots; i++)
+	{
+		pool_worker_t *worker = &script->workers[i];
+		if (worker->pid > 0 && !worker->stopping && !worker->busy)
+			return worker;
+	}
+	pool_worker_t *slot = NULL;
+	if (script->nworkers < script->maxworkers)
+		slot = _pool_freeslot(script);
+	if (slot != NULL && _pool_spawn(script, slot, config) == ESUCCESS)
+		return slot;
+	return NULL;
+}
+
+/**
+ * the worker is stopped after an error or after "poolrequests" requests
+ */
+static void _pool_release(pool_worker_t *worker, int done, const mod_cgi_config_t *config)
+{
+	worker->busy = 0;
+	worker->requests++;
+	worker->lastused = time(NULL);
+	if (!done || (config->poolrequests > 0 && worker->requests >= config->poolrequests))
+		_pool_stop(worker);
+}
+
+/**
+ * the message is the name of the script with the socket of the request
+ */
+static int _pool_recvclient(int ctl, char *name, size_t size)
+{
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {.iov_base = name, .iov_len = size - 1};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer),
+	};
+	ssize_t length = recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+	if (length == 0)
+	{
+		/// all the processes of the server are gone
+		g_poolstop = 1;
+		return -1;
+	}
+	if (length < 0)
+		return -1;
+	name[length] = '\0';
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	int sock;
+	memcpy(&sock, CMSG_DATA(cmsg), sizeof(sock));
+	return sock;
+}
+
+static int _pool_sendclient(int ctl, const void *data, size_t length, int sock)
+{
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = {.iov_base = (void *)data, .iov_len = length};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer),
+	};
+	if (sock == -1)
+	{
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		return (sendmsg(ctl, &msg, MSG_NOSIGNAL) < 0)? EREJECT: ESUCCESS;
+	}
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &sock, sizeof(sock));
+	if (sendmsg(ctl, &msg, MSG_NOSIGNAL) < 0)
+		return EREJECT;
+	return ESUCCESS;
+}
+
+/**
+ * the worker is connected for the client, the socket of the connection
+ * is sent with the answer.
+ */
+static int _pool_answer(pool_client_t *client, const mod_cgi_config_t *config)
+{
+	pool_script_t *script = client->script;
+	pool_answer_t answer = { .result = POOL_BUSY };
+	pool_worker_t *worker = _pool_acquire(script, config);
+	int sock = -1;
+	if (worker != NULL)
+		sock = _pool_connect(worker);
+	/// the client waits with its own timeout
+	if (sock != -1 && fcntl(sock, F_SETFL, 0) == 0)
+	{
+		worker->busy = 1;
+		answer.result = POOL_WORKER;
+		answer.pid = worker->pid;
+	}
+	else if (script->fastcgi == 0)
+		answer.result = POOL_NOTFASTCGI;
+	else
+		warn("cgi: no worker available for %s", script->script);
+	if (answer.result != POOL_WORKER && sock != -1)
+	{
+		close(sock);
+		sock = -1;
+	}
+	int ret = _pool_sendclient(client->sock, &answer, sizeof(answer), sock);
+	if (sock != -1)
+		close(sock);
+	if (answer.result != POOL_WORKER || ret != ESUCCESS)
+	{
+		if (answer.result == POOL_WORKER)
+			_pool_release(worker, 0, config);
+		close(client->sock);
+		return EREJECT;
+	}
+	client->worker = worker;
+	client->pid = worker->pid;
+	return ESUCCESS;
+}
+
+/**
+ * the user of the request is the one who created the socket pair.
+ * The client of a script not checked yet waits the end of the check.
+ */
+static int _pool_newclient(pool_script_t **scripts, const mod_cgi_config_t *config,
+		int ctl, pool_client_t *client)
+{
+	char name[PATH_MAX];
+	int sock = _pool_recvclient(ctl, name, sizeof(name));
+	if (sock == -1)
+		return EREJECT;
+	struct ucred cred;
+	socklen_t credlength = sizeof(cred);
+	pool_script_t *script = NULL;
+	/// the scripts stay into the docroot
+	if (name[0] != '/' && strcmp(name, "..") && strncmp(name, "../", 3) &&
+		strstr(name, "/../") == NULL &&
+		utils_searchexp(name, config->pool, NULL) == ESUCCESS &&
+		getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &credlength) == 0)
+		script = _pool_get(scripts, config, name, cred.uid, cred.gid);
+	memset(client, 0, sizeof(*client));
+	client->sock = sock;
+	client->script = script;
+	if (script == NULL)
+	{
+		pool_answer_t answer = { .result = POOL_BUSY };
+		warn("cgi: no worker available for %s", name);
+		_pool_sendclient(sock, &answer, sizeof(answer), -1);
+		close(sock);
+		return EREJECT;
+	}
+	if (script->fastcgi == -1 && script->probe == -1)
+	{
+		pool_worker_t *slot = _pool_freeslot(script);
+		if (slot == NULL || _pool_spawn(script, slot, config) != ESUCCESS)
+			script->fastcgi = 0;
+		else if (_pool_startprobe(script, slot) != ESUCCESS)
+			_pool_endprobe(script, 0);
+	}
+	if (script->fastcgi == -1)
+		return ESUCCESS;
+	return _pool_answer(client, config);
+}
+
+/**
+ * the end of the request or the death of the process of the request
+ */
+static void _pool_endclient(pool_client_t *client, const mod_cgi_config_t *config)
+{
+	if (client->worker == NULL)
+	{
+		close(client->sock);
+		return;
+	}
+	int done = 0;
+	if (recv(client->sock, &done, sizeof(done), MSG_DONTWAIT) != sizeof(done))
+		done = 0;
+	if (client->worker->pid == client->pid)
+		_pool_release(client->worker, done, config);
+	close(client->sock);
+}
+
+static void _pool_signal(int UNUSED(sig))
+{
+	g_poolstop = 1;
+}
+
+static void _pool_detach(int ctl, int rootfd)
+{
+	struct sigaction action = {0};
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = _pool_signal;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGHUP, &action, NULL);
+	sigaction(SIGPIPE, &action, NULL);
+	sigaction(SIGUSR2, &action, NULL);
+	sigaction(SIGALRM, &action, NULL);
+	/// the supervisor stops with the server, even after a crash
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	/// the supervisor and the workers don't keep the sockets of the server
+	long max = sysconf(_SC_OPEN_MAX);
+	for (int fd = 3; fd < max; fd++)
+	{
+		if (fd != ctl && fd != rootfd)
+			close(fd);
+	}
+}
+
+static void _pool_stopall(pool_script_t *scripts)
+{
+	for (pool_script_t *script = scripts; script != NULL; script = script->next)
+	{
+		for (int i = 0; i < script->nslots; i++)
+			_pool_stop(&script->workers[i]);
+	}
+	time_t end = time(NULL) + POOL_STOPDELAY;
+	while (waitpid(-1, NULL, WNOHANG) >= 0 && time(NULL) <= end)
+		usleep(10000);
+	for (pool_script_t *script = scripts; script != NULL; script = script->next)
+	{
+		for (int i = 0; i < script->nslots; i++)
+		{
+			if (script->workers[i].pid > 0 && kill(script->workers[i].pid, 0) == 0)
+				kill(script->workers[i].pid, SIGKILL);
+		}
+	}
+	while (waitpid(-1, NULL, 0) > 0);
+	for (pool_script_t *script = scripts; script != NULL; script = script->next)
+	{
+		if (script->probe != -1)
+			close(script->probe);
+		for (int i = 0; i < script->nslots; i++)
+			_pool_unlink(&script->workers[i]);
+	}
+	rmdir(g_pooldir);
+}
+
+/**
+ * the clients waiting the check of the script get their answer
+ */
+static int _pool_probed(pool_script_t *script, pool_client_t *clients, int nclients,
+		const mod_cgi_config_t *config)
+{
+	for (int i = nclients - 1; i >= 0; i--)
+	{
+		if (clients[i].worker != NULL || clients[i].script != script)
+			continue;
+		if (_pool_answer(&clients[i], config) != ESUCCESS)
+			clients[i] = clients[--nclients];
+	}
+	return nclients;
+}
+
+static void _pool_supervise(int ctl, const mod_cgi_config_t *config, int rootfd)
+{
+	_pool_detach(ctl, rootfd);
+	if (fchdir(rootfd) == -1)
+	{
+		err("cgi: pool docroot error %s", strerror(errno));
+		return;
+	}
+	if (mkdtemp(g_pooldir) == NULL)
+	{
+		err("cgi: pool directory error %s", strerror(errno));
+		return;
+	}
+	pool_script_t *scripts = NULL;
+	pool_client_t *clients = NULL;
+	struct pollfd *fds = NULL;
+	int nclients = 0;
+	int maxclients = 0;
+	int maxfds = 0;
+	while (!g_poolstop)
+	{
+		if (nclients + 1 > maxclients)
+		{
+			int max = (maxclients > 0)? maxclients * 2: 16;
+			pool_client_t *newclients = realloc(clients, max * sizeof(*clients));
+			if (newclients == NULL)
+				break;
+			clients = newclients;
+			maxclients = max;
+		}
+		int nprobes = 0;
+		for (pool_script_t *script = scripts; script != NULL; script = script->next)
+			nprobes += (script->probe != -1);
+		if (nclients + nprobes + 1 > maxfds)
+		{
+			int max = maxclients + nprobes + 1;
+			struct pollfd *newfds = realloc(fds, max * sizeof(*fds));
+			if (newfds == NULL)
+				break;
+			fds = newfds;
+			maxfds = max;
+		}
+		fds[0].fd = ctl;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		int nfds = 1;
+		for (int i = 0; i < nclients; i++, nfds++)
+		{
+			fds[nfds].fd = clients[i].sock;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+		}
+		for (pool_script_t *script = scripts; script != NULL; script = script->next)
+		{
+			if (script->probe == -1)
+				continue;
+			fds[nfds].fd = script->probe;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+		int ret = poll(fds, nfds, 1000);
+		if (ret < 0 && errno != EINTR)
+			break;
+		pid_t pid;
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+			_pool_died(scripts, pid);
+		int npolled = nclients;
+		/// the last client replaces the ended one, it is already checked
+		for (int i = nclients - 1; i >= 0 && ret > 0; i--)
+		{
+			if (fds[i + 1].revents == 0)
+				continue;
+			_pool_endclient(&clients[i], config);
+			clients[i] = clients[--nclients];
+		}
+		/// the probes are polled in the order of the scripts
+		time_t now = time(NULL);
+		int probe = npolled + 1;
+		for (pool_script_t *script = scripts; script != NULL; script = script->next)
+		{
+			if (script->probe == -1)
+				continue;
+			short revents = fds[probe++].revents;
+			if (revents != 0)
+				_pool_endprobe(script, (revents & POLLIN)? _pool_readprobe(script->probe): 0);
+			else if (now - script->probestart > config->timeout.tv_sec)
+				_pool_endprobe(script, 0);
+			if (script->probe == -1)
+				nclients = _pool_probed(script, clients, nclients, config);
+		}
+		if (ret > 0 && (fds[0].revents & POLLIN) &&
+			_pool_newclient(&scripts, config, ctl, &clients[nclients]) == ESUCCESS)
+			nclients++;
+		else if (ret > 0 && (fds[0].revents & (POLLHUP | POLLERR)))
+			g_poolstop = 1;
+		for (pool_script_t *script = scripts; script != NULL; script = script->next)
+			_pool_reap(script, config, now);
+	}
+	for (int i = 0; i < nclients; i++)
+		close(clients[i].sock);
+	free(clients);
+	free(fds);
+	_pool_stopall(scripts);
+	warn("cgi: pool stopped");
+}
+
+/**
+ * the supervisor is forked while the server is small,
+ * before the clients. It starts the workers with posix_spawn.
+ */
+cgi_pool_t *cgipool_create(const mod_cgi_config_t *config, int rootfd)
+{
+	if (config->pool == NULL)
+		return NULL;
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+		return NULL;
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(pair[0]);
+		_pool_supervise(pair[1], config, rootfd);
+		_exit(0);
+	}
+	close(pair[1]);
+	if (pid == -1)
+	{
+		err("cgi: pool fork error %s", strerror(errno));
+		close(pair[0]);
+		return NULL;
+	}
+	cgi_pool_t *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+	{
+		close(pair[0]);
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return NULL;
+	}
+	pool->ctl = pair[0];
+	pool->supervisor = pid;
+	pool->owner = getpid();
+	warn("cgi: pool started (%d)", pid);
+	return pool;
+}
+
+/**
+ * the socket connected to the worker comes with the answer
+ */
+static int _pool_recvanswer(int ctl, pool_answer_t *answer)
+{
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {.iov_base = answer, .iov_len = sizeof(*answer)};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer),
+	};
+	if (recvmsg(ctl, &msg, MSG_CMSG_CLOEXEC) != sizeof(*answer))
+		return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	int sock;
+	memcpy(&sock, CMSG_DATA(cmsg), sizeof(sock));
+	if (answer->result != POOL_WORKER)
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * a worker of the supervisor is connected for the request.
+ * NULL if the script has to run as classic CGI.
+ */
+cgi_worker_t *cgipool_acquire(cgi_pool_t *pool, const mod_cgi_config_t *config, const char *script)
+{
+	if (pool == NULL || utils_searchexp(script, config->pool, NULL) != ESUCCESS)
+		return NULL;
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+		return NULL;
+	int ret = _pool_sendclient(pool->ctl, script, strlen(script), pair[1]);
+	close(pair[1]);
+	/// the first request of a script waits the check of the first worker
+	struct timeval timeout = config->timeout;
+	timeout.tv_sec *= 2;
+	setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	pool_answer_t answer = { .result = POOL_BUSY };
+	int sock = -1;
+	if (ret == ESUCCESS)
+		sock = _pool_recvanswer(pair[0], &answer);
+	if (sock == -1)
+	{
+		close(pair[0]);
+		return NULL;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &config->timeout, sizeof(config->timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &config->timeout, sizeof(config->timeout));
+	cgi_worker_t *worker = calloc(1, sizeof(*worker));
+	if (worker == NULL)
+	{
+		close(sock);
+		close(pair[0]);
+		return NULL;
+	}
+	worker->ctl = pair[0];
+	worker->sock = sock;
+	worker->pid = answer.pid;
+	worker->script = script;
+	return worker;
+}
+
+int cgipool_begin(cgi_worker_t *worker, char **env)
+{
+	unsigned char begin[FCGI_HEADERLENGTH + 8] = {0};
+	_fcgi_header(begin, FCGI_BEGIN_REQUEST, 8);
+	begin[FCGI_HEADERLENGTH + 1] = FCGI_RESPONDER;
+	if (_fcgi_write(worker->sock, begin, sizeof(begin)) != ESUCCESS)
+		return EREJECT;
+	return _fcgi_params(worker->sock, env);
+}
+
+/**
+ * the content of the request, NULL is the end of the content
+ */
+int cgipool_write(cgi_worker_t *worker, const char *data, size_t length)
+{
+	if (data != NULL && length == 0)
+		return ESUCCESS;
+	return _fcgi_record(worker->sock, FCGI_STDIN, data, length);
+}
+
+/**
+ * return the length of the output of the script,
+ * 0 at the end of the request and -1 on error
+ */
+int cgipool_read(cgi_worker_t *worker, char *data, size_t size)
+{
+	while (!worker->done)
+	{
+		if (worker->remaining == 0)
+		{
+			char padding[256];
+			unsigned char header[FCGI_HEADERLENGTH];
+			if ((worker->padding > 0 && _fcgi_read(worker->sock, padding, worker->padding) != ESUCCESS) ||
+				_fcgi_read(worker->sock, header, sizeof(header)) != ESUCCESS)
+				return (errno == ECONNRESET)? 0: -1;
+			worker->type = header[1];
+			worker->remaining = (header[4] << 8) | header[5];
+			worker->padding = header[6];
+			if (worker->remaining == 0)
+				continue;
+		}
+		if (worker->type == FCGI_STDOUT)
+		{
+			size_t length = (worker->remaining < size)? worker->remaining: size;
+			ssize_t ret = read(worker->sock, data, length);
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				errno = ETIMEDOUT;
+			if (ret == 0)
+				return 0;
+			if (ret > 0)
+				worker->remaining -= ret;
+			return ret;
+		}
+		char content[512];
+		size_t length = (worker->remaining < sizeof(content))? worker->remaining: sizeof(content) - 1;
+		if (_fcgi_read(worker->sock, content, length) != ESUCCESS)
+			return (errno == ECONNRESET)? 0: -1;
+		worker->remaining -= length;
+		if (worker->type == FCGI_STDERR)
+		{
+			content[length] = '\0';
+			err("cgi: %s %s", worker->script, content);
+		}
+		else if (worker->type == FCGI_END_REQUEST && worker->remaining == 0)
+			worker->done = 1;
+	}
+	return 0;
+}
+
+/**
+ * the supervisor stops the worker after an error
+ * or after "poolrequests" requests
+ */
+void cgipool_release(cgi_worker_t *worker)
+{
+	if (worker->sock != -1)
+		close(worker->sock);
+	if (!worker->done)
+		warn("cgi: worker %s (%d) request not complete", worker->script, worker->pid);
+	send(worker->ctl, &worker->done, sizeof(worker->done), MSG_NOSIGNAL);
+	close(worker->ctl);
+	free(worker);
+}
+
+void cgipool_destroy(cgi_pool_t *pool)
+{
+	if (pool == NULL)
+		return;
+	close(pool->ctl);
+	if (pool->owner == getpid())
+	{
+		kill(pool->supervisor, SIGTERM);
+		waitpid(pool->supervisor, NULL, 0);
+	}
+	free(pool);
+}
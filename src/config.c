@@ -129,18 +129,23 @@ static int ouistiticonfig_mergeserver(serverconfig_t *main, serverconfig_t *new)
 	return EREJECT;
 }
 
+#define SERVERS_STEP 4
 static int ouistiticonfig_appendserver(serverconfig_t *new, ouistiticonfig_t *ouistiticonfig)
 {
-	int ret = EREJECT;
 	int nservers = ouistiticonfig->nservers;
 
-	if (nservers < MAX_SERVERS)
+	if ((nservers % SERVERS_STEP) == 0)
 	{
-		ouistiticonfig->config[nservers] = new;
-		ouistiticonfig->nservers++;
-		ret = ESUCCESS;
+		/// the table is NULL terminated
+		serverconfig_t **config = realloc(ouistiticonfig->config, (nservers + SERVERS_STEP + 1) * sizeof(*config));
+		if (config == NULL)
+			return EREJECT;
+		ouistiticonfig->config = config;
 	}
-	return ret;
+	ouistiticonfig->config[nservers] = new;
+	ouistiticonfig->nservers++;
+	ouistiticonfig->config[ouistiticonfig->nservers] = NULL;
+	return ESUCCESS;
 }
 
 static int ouistiticonfig_checkserver(serverconfig_t *new, ouistiticonfig_t *ouistiticonfig)
@@ -222,19 +227,22 @@ ouistiticonfig_t *ouistiticonfig_create(const char *filepath)
 
 	config_lookup_string(configfile, str_user, (const char **)&ouistiticonfig->user);
 	config_lookup_string(configfile, "log-file", (const char **)&logfile);
-	if (logfile != NULL && logfile[0] != '\0')
+	/// on reload the log file is already open
+	if (logfile != NULL && logfile[0] != '\0' && logfd == 0)
 	{
 		logfd = open(logfile, O_WRONLY | O_CREAT | O_TRUNC, 00644);
 		if (logfd > 0)
 		{
 			dup2(logfd, 1);
 			dup2(logfd, 2);
-			close(logfd);
+			ouistiticonfig->logfd = logfd;
 		}
 		else
 			err("log file error %s", strerror(errno));
 	}
 	config_lookup_string(configfile, "init_d", (const char **)&ouistiticonfig->init_d);
+	config_lookup_int(configfile, "workers", &ouistiticonfig->workers);
+	config_lookup_string(configfile, "cpuaffinity", &ouistiticonfig->cpuaffinity);
 	const config_setting_t *configmimes = config_lookup(configfile, "mimetypes");
 	config_mimes(configmimes);
 
@@ -265,10 +273,13 @@ ouistiticonfig_t *ouistiticonfig_create(const char *filepath)
 
 void ouistiticonfig_destroy(ouistiticonfig_t *ouistiticonfig)
 {
-	if (logfd > 0)
-		close(logfd);
+	if (ouistiticonfig->logfd > 0)
+	{
+		close(ouistiticonfig->logfd);
+		logfd = 0;
+	}
 	void *lastconfig = NULL;
-	for (int i = 0; i < MAX_SERVERS; i++)
+	for (int i = 0; i < ouistiticonfig->nservers; i++)
 	{
 		if (ouistiticonfig->config[i] != NULL)
 		{
@@ -283,6 +294,7 @@ void ouistiticonfig_destroy(ouistiticonfig_t *ouistiticonfig)
 			free(ouistiticonfig->config[i]);
 		}
 	}
+	free(ouistiticonfig->config);
 	config_destroy((config_t *)ouistiticonfig->configfile);
 	free(ouistiticonfig->configfile);
 	free(ouistiticonfig);
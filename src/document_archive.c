@@ -0,0 +1,834 @@
+/*****************************************************************************
+ * document_archive.c: send a directory as a tar or zip archive
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/utils.h"
+#include "ouistiti/log.h"
+#include "mod_document.h"
+
+#define archive_dbg(...)
+
+#ifdef SENDFILE
+extern int mod_send_sendfile(document_connector_t *private, http_message_t *response);
+#endif
+
+#define ARCHIVE_TAR 1
+#define ARCHIVE_ZIP 2
+
+/**
+ * the directories are opened while the walk is inside them,
+ * the depth of the tree is limited to keep the memory constant.
+ */
+#define ARCHIVE_MAXDEPTH 16
+#define ARCHIVE_OUTPUTSIZE (32 * 1024)
+/**
+ * the trailer of the previous chunk and the size of the chunk
+ */
+#define ARCHIVE_CHUNKHEADER 12
+/**
+ * the end of the chunk, the size of the following file and the last chunk
+ */
+#define ARCHIVE_CHUNKTRAILER 32
+#define ARCHIVE_BLOCKSIZE 512
+/**
+ * the largest entry: a long name and its header with the padding
+ */
+#define ARCHIVE_ENTRYMAX (4 * ARCHIVE_BLOCKSIZE + PATH_MAX)
+#define ARCHIVE_SENDSIZE 0x7ffff000
+
+/**
+ * zip without zip64 extension
+ */
+#define ZIP_MAXENTRIES 0xFFFF
+#define ZIP_MAXOFFSET 0xFFFFFFFFULL
+#define ZIP_LOCALSIG 0x04034b50
+#define ZIP_DESCRIPTORSIG 0x08074b50
+#define ZIP_CENTRALSIG 0x02014b50
+#define ZIP_ENDSIG 0x06054b50
+#define ZIP_VERSION 20
+#define ZIP_UNIX (3 << 8)
+#define ZIP_FLAGDESCRIPTOR 0x0008
+#define ZIP_FLAGUTF8 0x0800
+
+enum
+{
+	ARCHIVE_ENTRIES,
+	ARCHIVE_CENTRAL,
+	ARCHIVE_END,
+	ARCHIVE_DONE,
+};
+
+typedef struct archive_dir_s archive_dir_t;
+struct archive_dir_s
+{
+	DIR *dir;
+	size_t pathlength;
+};
+
+/**
+ * the entry waits the end of its content to be closed:
+ * the padding of tar, the descriptor and the central record of zip.
+ */
+typedef struct archive_entry_s archive_entry_t;
+struct archive_entry_s
+{
+	int pending;
+	int flags;
+	mode_t mode;
+	unsigned long size;
+	unsigned long localoffset;
+	uint16_t dostime;
+	uint16_t dosdate;
+	size_t namelength;
+};
+
+struct document_archive_s
+{
+	int format;
+	int chunked;
+	int sendfile;
+	int step;
+	int depth;
+	archive_dir_t dirs[ARCHIVE_MAXDEPTH];
+	/// the path of the entries starts after the requested directory
+	size_t base;
+	char path[PATH_MAX];
+	archive_entry_t entry;
+	int fdbody;
+	off_t bodyoffset;
+	unsigned long long bodysize;
+	int bodycrc;
+	uint32_t crc;
+	int trailer;
+	unsigned long long offset;
+	int fdcentral;
+	unsigned long centralsize;
+	unsigned long entries;
+	char *output;
+	size_t outputlength;
+	size_t sendoffset;
+	size_t sendlength;
+};
+
+static uint32_t g_crctable[256];
+
+static void _archive_crcinit(void)
+{
+	if (g_crctable[1] != 0)
+		return;
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1)? (crc >> 1) ^ 0xEDB88320: crc >> 1;
+		g_crctable[i] = crc;
+	}
+}
+
+static uint32_t _archive_crc32(uint32_t crc, const unsigned char *data, size_t length)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = g_crctable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void _archive_le16(unsigned char *data, uint16_t value)
+{
+	data[0] = value & 0xFF;
+	data[1] = (value >> 8) & 0xFF;
+}
+
+static void _archive_le32(unsigned char *data, uint32_t value)
+{
+	_archive_le16(data, value & 0xFFFF);
+	_archive_le16(data + 2, value >> 16);
+}
+
+/**
+ * "?archive=tar" or "?archive=zip"
+ */
+static int _archive_format(http_message_t *request)
+{
+	const char *query = httpmessage_REQUEST(request, "query");
+	if (query == NULL)
+		return 0;
+	const char *value = strstr(query, "archive=");
+	if (value == NULL)
+		return 0;
+	value += sizeof("archive=") - 1;
+	if (!strncmp(value, "tar", 3) && (value[3] == '\0' || value[3] == '&'))
+		return ARCHIVE_TAR;
+	if (!strncmp(value, "zip", 3) && (value[3] == '\0' || value[3] == '&'))
+		return ARCHIVE_ZIP;
+	return 0;
+}
+
+int document_archiveaccept(const mod_document_t *config, http_message_t *request)
+{
+	if (!(config->options & DOCUMENT_ARCHIVE))
+		return EREJECT;
+	if (_archive_format(request) == 0)
+		return EREJECT;
+	return ESUCCESS;
+}
+
+void document_archiveclose(document_connector_t *private)
+{
+	document_archive_t *archive = private->archive;
+	if (archive == NULL)
+		return;
+	for (int i = 0; i < ARCHIVE_MAXDEPTH; i++)
+	{
+		if (archive->dirs[i].dir != NULL)
+			closedir(archive->dirs[i].dir);
+	}
+	if (archive->fdbody > 0 && archive->fdbody != archive->fdcentral)
+		close(archive->fdbody);
+	if (archive->fdcentral > 0)
+		close(archive->fdcentral);
+	free(archive->output);
+	free(archive);
+	private->archive = NULL;
+}
+
+static int _archive_append(document_archive_t *archive, const void *data, size_t length)
+{
+	if (archive->outputlength + length > ARCHIVE_OUTPUTSIZE - ARCHIVE_CHUNKTRAILER)
+		return EREJECT;
+	if (data != NULL)
+		memcpy(archive->output + archive->outputlength, data, length);
+	else
+		memset(archive->output + archive->outputlength, 0, length);
+	archive->outputlength += length;
+	archive->offset += length;
+	return ESUCCESS;
+}
+
+static void _archive_octal(char *field, size_t size, unsigned long long value)
+{
+	if (value < (1ULL << (3 * (size - 1))))
+	{
+		snprintf(field, size, "%0*llo", (int)(size - 1), value);
+		return;
+	}
+	/// the base-256 encoding of the large sizes
+	memset(field, 0, size);
+	field[0] = (char)0x80;
+	for (size_t i = size - 1; i > 0 && value > 0; i--)
+	{
+		field[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+static int _archive_tarblock(document_archive_t *archive, const char *name, size_t namelength,
+		const struct stat *filestat, char type, unsigned long long size)
+{
+	char header[ARCHIVE_BLOCKSIZE] = {0};
+	memcpy(header, name, (namelength < 100)? namelength: 100);
+	_archive_octal(header + 100, 8, filestat->st_mode & 07777);
+	_archive_octal(header + 108, 8, filestat->st_uid);
+	_archive_octal(header + 116, 8, filestat->st_gid);
+	_archive_octal(header + 124, 12, size);
+	_archive_octal(header + 136, 12, filestat->st_mtime);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	memset(header + 148, ' ', 8);
+	unsigned int checksum = 0;
+	for (int i = 0; i < ARCHIVE_BLOCKSIZE; i++)
+		checksum += (unsigned char)header[i];
+	snprintf(header + 148, 8, "%06o", checksum);
+	return _archive_append(archive, header, sizeof(header));
+}
+
+/**
+ * the names longer than the field of the header are sent before
+ * the entry as GNU tar does.
+ */
+static int _archive_tarheader(document_archive_t *archive, const char *name, size_t namelength,
+		const struct stat *filestat, unsigned long long size)
+{
+	char type = S_ISDIR(filestat->st_mode)? '5': '0';
+	if (namelength > 100)
+	{
+		size_t padding = (ARCHIVE_BLOCKSIZE - (namelength + 1) % ARCHIVE_BLOCKSIZE) % ARCHIVE_BLOCKSIZE;
+		if (_archive_tarblock(archive, "././@LongLink", 13, filestat, 'L', namelength + 1) != ESUCCESS ||
+			_archive_append(archive, name, namelength) != ESUCCESS ||
+			_archive_append(archive, NULL, padding + 1) != ESUCCESS)
+			return EREJECT;
+	}
+	if (_archive_tarblock(archive, name, namelength, filestat, type, size) != ESUCCESS)
+		return EREJECT;
+	archive->entry.pending = 1;
+	archive->entry.size = (unsigned long)size;
+	return ESUCCESS;
+}
+
+static void _archive_dostime(time_t mtime, uint16_t *dostime, uint16_t *dosdate)
+{
+	struct tm tm;
+	localtime_r(&mtime, &tm);
+	if (tm.tm_year < 80)
+	{
+		*dostime = 0;
+		*dosdate = (1 << 5) | 1;
+		return;
+	}
+	*dostime = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+	*dosdate = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+/**
+ * the CRC is unknown before the end of the content,
+ * the local header is followed by a data descriptor.
+ */
+static int _archive_zipheader(document_archive_t *archive, const char *name, size_t namelength,
+		const struct stat *filestat, unsigned long long size)
+{
+	archive_entry_t *entry = &archive->entry;
+	unsigned char header[30];
+	entry->flags = ZIP_FLAGUTF8;
+	if (S_ISREG(filestat->st_mode))
+		entry->flags |= ZIP_FLAGDESCRIPTOR;
+	entry->mode = filestat->st_mode;
+	entry->size = (unsigned long)size;
+	entry->localoffset = archive->offset;
+	entry->namelength = namelength;
+	_archive_dostime(filestat->st_mtime, &entry->dostime, &entry->dosdate);
+	_archive_le32(header, ZIP_LOCALSIG);
+	_archive_le16(header + 4, ZIP_VERSION);
+	_archive_le16(header + 6, entry->flags);
+	_archive_le16(header + 8, 0);
+	_archive_le16(header + 10, entry->dostime);
+	_archive_le16(header + 12, entry->dosdate);
+	_archive_le32(header + 14, 0);
+	_archive_le32(header + 18, entry->size);
+	_archive_le32(header + 22, entry->size);
+	_archive_le16(header + 26, namelength);
+	_archive_le16(header + 28, 0);
+	if (_archive_append(archive, header, sizeof(header)) != ESUCCESS ||
+		_archive_append(archive, name, namelength) != ESUCCESS)
+		return EREJECT;
+	entry->pending = 1;
+	archive->crc = 0;
+	return ESUCCESS;
+}
+
+/**
+ * the central directory grows with the tree, it is written into
+ * an unnamed file and sent as the content of the files.
+ */
+static int _archive_zipcentral(document_archive_t *archive)
+{
+	const archive_entry_t *entry = &archive->entry;
+	unsigned char record[46];
+	_archive_le32(record, ZIP_CENTRALSIG);
+	_archive_le16(record + 4, ZIP_UNIX | ZIP_VERSION);
+	_archive_le16(record + 6, ZIP_VERSION);
+	_archive_le16(record + 8, entry->flags);
+	_archive_le16(record + 10, 0);
+	_archive_le16(record + 12, entry->dostime);
+	_archive_le16(record + 14, entry->dosdate);
+	_archive_le32(record + 16, archive->crc);
+	_archive_le32(record + 20, entry->size);
+	_archive_le32(record + 24, entry->size);
+	_archive_le16(record + 28, entry->namelength);
+	_archive_le16(record + 30, 0);
+	_archive_le16(record + 32, 0);
+	_archive_le16(record + 34, 0);
+	_archive_le16(record + 36, 0);
+	_archive_le32(record + 38, (uint32_t)entry->mode << 16);
+	_archive_le32(record + 42, entry->localoffset);
+	const char *name = archive->path + archive->base;
+	if (write(archive->fdcentral, record, sizeof(record)) != sizeof(record) ||
+		write(archive->fdcentral, name, entry->namelength) != (ssize_t)entry->namelength)
+	{
+		err("archive: central directory error %s", strerror(errno));
+		return EREJECT;
+	}
+	archive->centralsize += sizeof(record) + entry->namelength;
+	archive->entries++;
+	return ESUCCESS;
+}
+
+/**
+ * the end of the current entry after its content
+ */
+static int _archive_endentry(document_archive_t *archive)
+{
+	archive_entry_t *entry = &archive->entry;
+	if (!entry->pending)
+		return ESUCCESS;
+	if (archive->format == ARCHIVE_TAR)
+	{
+		size_t padding = (ARCHIVE_BLOCKSIZE - entry->size % ARCHIVE_BLOCKSIZE) % ARCHIVE_BLOCKSIZE;
+		if (_archive_append(archive, NULL, padding) != ESUCCESS)
+			return EREJECT;
+	}
+	else
+	{
+		if (entry->flags & ZIP_FLAGDESCRIPTOR)
+		{
+			unsigned char descriptor[16];
+			_archive_le32(descriptor, ZIP_DESCRIPTORSIG);
+			_archive_le32(descriptor + 4, archive->crc);
+			_archive_le32(descriptor + 8, entry->size);
+			_archive_le32(descriptor + 12, entry->size);
+			if (_archive_append(archive, descriptor, sizeof(descriptor)) != ESUCCESS)
+				return EREJECT;
+		}
+		if (_archive_zipcentral(archive) != ESUCCESS)
+			return EREJECT;
+	}
+	entry->pending = 0;
+	return ESUCCESS;
+}
+
+/**
+ * each entry is checked as the request of the file itself
+ */
+static int _archive_allowed(document_connector_t *private, http_message_t *request, const char *path)
+{
+	char uri[PATH_MAX + 1];
+	if (snprintf(uri, sizeof(uri), "/%s", path) >= (int)sizeof(uri))
+		return EREJECT;
+	const _mod_document_mod_t *mod = private->mod;
+	if (htaccess_check(&mod->config->htaccess, uri, NULL) == EREJECT ||
+		ouistiti_checkpath(mod->server, request, str_get, uri) != ESUCCESS)
+	{
+		archive_dbg("archive: %s forbidden", uri);
+		return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+static int _archive_header(document_archive_t *archive, const struct stat *filestat, unsigned long long size)
+{
+	const char *name = archive->path + archive->base;
+	size_t namelength = strlen(name);
+	if (archive->format == ARCHIVE_TAR)
+		return _archive_tarheader(archive, name, namelength, filestat, size);
+	return _archive_zipheader(archive, name, namelength, filestat, size);
+}
+
+/**
+ * the next entry of the tree, the hidden files and the symbolic links
+ * are not part of the archive.
+ * return 1 if an entry is added, 0 at the end of the tree.
+ */
+static int _archive_next(document_connector_t *private, http_message_t *request)
+{
+	document_archive_t *archive = private->archive;
+	while (archive->depth >= 0)
+	{
+		archive_dir_t *current = &archive->dirs[archive->depth];
+		struct dirent *ent = readdir(current->dir);
+		if (ent == NULL)
+		{
+			closedir(current->dir);
+			current->dir = NULL;
+			archive->depth--;
+			continue;
+		}
+		if (ent->d_name[0] == '.')
+			continue;
+		size_t namelength = strlen(ent->d_name);
+		if (current->pathlength + namelength + 2 > sizeof(archive->path))
+			continue;
+		memcpy(archive->path + current->pathlength, ent->d_name, namelength + 1);
+
+		int fddir = dirfd(current->dir);
+		struct stat filestat;
+		if (fstatat(fddir, ent->d_name, &filestat, AT_SYMLINK_NOFOLLOW) == -1)
+			continue;
+		if (S_ISDIR(filestat.st_mode))
+		{
+			archive->path[current->pathlength + namelength] = '/';
+			archive->path[current->pathlength + namelength + 1] = '\0';
+			if (archive->depth + 1 >= ARCHIVE_MAXDEPTH)
+			{
+				warn("archive: %s too deep", archive->path);
+				continue;
+			}
+			if (_archive_allowed(private, request, archive->path) != ESUCCESS)
+				continue;
+			int fd = openat(fddir, ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+			DIR *dir = (fd != -1)? fdopendir(fd): NULL;
+			if (dir == NULL)
+			{
+				if (fd != -1)
+					close(fd);
+				continue;
+			}
+			archive->depth++;
+			archive->dirs[archive->depth].dir = dir;
+			archive->dirs[archive->depth].pathlength = current->pathlength + namelength + 1;
+			_archive_header(archive, &filestat, 0);
+			return 1;
+		}
+		if (!S_ISREG(filestat.st_mode))
+			continue;
+		if (_archive_allowed(private, request, archive->path) != ESUCCESS)
+			continue;
+		int fd = openat(fddir, ent->d_name, O_RDONLY | O_NOFOLLOW);
+		if (fd == -1 || fstat(fd, &filestat) == -1)
+		{
+			if (fd != -1)
+				close(fd);
+			continue;
+		}
+		unsigned long long size = filestat.st_size;
+		if (archive->format == ARCHIVE_ZIP &&
+			archive->offset + size + ARCHIVE_ENTRYMAX >= ZIP_MAXOFFSET)
+		{
+			warn("archive: %s too large for zip", archive->path);
+			close(fd);
+			continue;
+		}
+		_archive_header(archive, &filestat, size);
+		if (size == 0)
+		{
+			close(fd);
+			return 1;
+		}
+		archive->fdbody = fd;
+		archive->bodyoffset = 0;
+		archive->bodysize = size;
+		archive->bodycrc = (archive->format == ARCHIVE_ZIP);
+		return 1;
+	}
+	return 0;
+}
+
+static int _archive_end(document_archive_t *archive)
+{
+	if (archive->format == ARCHIVE_TAR)
+		return _archive_append(archive, NULL, 2 * ARCHIVE_BLOCKSIZE);
+	unsigned char record[22];
+	_archive_le32(record, ZIP_ENDSIG);
+	_archive_le16(record + 4, 0);
+	_archive_le16(record + 6, 0);
+	_archive_le16(record + 8, archive->entries);
+	_archive_le16(record + 10, archive->entries);
+	_archive_le32(record + 12, archive->centralsize);
+	_archive_le32(record + 16, archive->offset - archive->centralsize);
+	_archive_le16(record + 20, 0);
+	return _archive_append(archive, record, sizeof(record));
+}
+
+/**
+ * the headers are sent in one chunk, the content of the following
+ * file is sent in the next one. The size of the file is known.
+ */
+static void _archive_frame(document_archive_t *archive, unsigned long long body, int final)
+{
+	size_t length = archive->outputlength - ARCHIVE_CHUNKHEADER;
+	archive->sendoffset = ARCHIVE_CHUNKHEADER;
+	archive->sendlength = length;
+	if (!archive->chunked)
+		return;
+
+	char header[ARCHIVE_CHUNKHEADER + 1];
+	int headerlength = 0;
+	if (archive->trailer)
+		headerlength += snprintf(header, sizeof(header), "\r\n");
+	if (length > 0)
+		headerlength += snprintf(header + headerlength, sizeof(header) - headerlength, "%zx\r\n", length);
+	archive->sendoffset -= headerlength;
+	memcpy(archive->output + archive->sendoffset, header, headerlength);
+	archive->sendlength += headerlength;
+
+	char *trailer = archive->output + archive->outputlength;
+	size_t trailerlength = 0;
+	if (length > 0)
+		trailerlength += snprintf(trailer, ARCHIVE_CHUNKTRAILER, "\r\n");
+	if (body > 0)
+		trailerlength += snprintf(trailer + trailerlength, ARCHIVE_CHUNKTRAILER - trailerlength, "%llx\r\n", body);
+	if (final)
+		trailerlength += snprintf(trailer + trailerlength, ARCHIVE_CHUNKTRAILER - trailerlength, "0\r\n\r\n");
+	archive->sendlength += trailerlength;
+	archive->trailer = (body > 0);
+}
+
+/**
+ * the output buffer is filled with the headers until the next file
+ */
+static void _archive_fill(document_connector_t *private, http_message_t *request)
+{
+	document_archive_t *archive = private->archive;
+	int final = 0;
+	archive->outputlength = ARCHIVE_CHUNKHEADER;
+	_archive_endentry(archive);
+	while (archive->step == ARCHIVE_ENTRIES && archive->bodysize == 0 &&
+		archive->outputlength + ARCHIVE_ENTRYMAX < ARCHIVE_OUTPUTSIZE - ARCHIVE_CHUNKTRAILER)
+	{
+		if (archive->format == ARCHIVE_ZIP && archive->entries + 1 >= ZIP_MAXENTRIES)
+		{
+			warn("archive: too many entries for zip %s", private->url);
+			archive->step = ARCHIVE_CENTRAL;
+		}
+		else if (_archive_next(private, request) == 0)
+			archive->step = (archive->format == ARCHIVE_ZIP)? ARCHIVE_CENTRAL: ARCHIVE_END;
+		else if (archive->bodysize == 0)
+			_archive_endentry(archive);
+	}
+	if (archive->step == ARCHIVE_CENTRAL && archive->bodysize == 0)
+	{
+		if (archive->centralsize > 0)
+		{
+			archive->fdbody = archive->fdcentral;
+			archive->bodyoffset = 0;
+			archive->bodysize = archive->centralsize;
+			archive->bodycrc = 0;
+		}
+		archive->step = ARCHIVE_END;
+	}
+	if (archive->step == ARCHIVE_END && archive->bodysize == 0)
+	{
+		_archive_end(archive);
+		final = 1;
+		archive->step = ARCHIVE_DONE;
+	}
+	_archive_frame(archive, archive->bodysize, final);
+}
+
+static int _archive_flush(document_connector_t *private)
+{
+	document_archive_t *archive = private->archive;
+	if (archive->sendlength == 0)
+		return ESUCCESS;
+	int ret = httpclient_send(private->ctl, archive->output + archive->sendoffset, archive->sendlength);
+	if (ret < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK)? ECONTINUE: EREJECT;
+	archive->sendoffset += ret;
+	archive->sendlength -= ret;
+	if (archive->sendlength > 0)
+		return ECONTINUE;
+	return ESUCCESS;
+}
+
+/**
+ * the content of the tar entries is given to sendfile if the connection
+ * allows it, zip needs the CRC of the content and reads it.
+ */
+static int _archive_body(document_connector_t *private)
+{
+	document_archive_t *archive = private->archive;
+	size_t size = (archive->bodysize < ARCHIVE_SENDSIZE)? archive->bodysize: ARCHIVE_SENDSIZE;
+	ssize_t ret;
+#ifdef SENDFILE
+	if (archive->sendfile && !archive->bodycrc)
+	{
+		ret = sendfile(httpclient_socket(private->ctl), archive->fdbody, &archive->bodyoffset, size);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return ECONTINUE;
+	}
+	else
+#endif
+	{
+		if (size > ARCHIVE_OUTPUTSIZE)
+			size = ARCHIVE_OUTPUTSIZE;
+		ret = pread(archive->fdbody, archive->output, size, archive->bodyoffset);
+		if (ret > 0)
+		{
+			if (archive->bodycrc)
+				archive->crc = _archive_crc32(archive->crc, (unsigned char *)archive->output, ret);
+			archive->bodyoffset += ret;
+			archive->sendoffset = 0;
+			archive->sendlength = ret;
+		}
+	}
+	if (ret <= 0)
+	{
+		/// the size is already announced, the file must not be truncated
+		err("archive: %s content error %s", private->url, (ret == 0)? "truncated": strerror(errno));
+		return EREJECT;
+	}
+	archive->bodysize -= ret;
+	archive->offset += ret;
+	if (archive->bodysize == 0 && archive->fdbody != archive->fdcentral)
+		close(archive->fdbody);
+	if (archive->bodysize == 0)
+		archive->fdbody = -1;
+	if (archive->sendlength > 0)
+	{
+		int flush = _archive_flush(private);
+		if (flush == EREJECT)
+			return EREJECT;
+	}
+	return ECONTINUE;
+}
+
+static int _archive_central(void)
+{
+	int fd = open(P_tmpdir, O_TMPFILE | O_RDWR, 0600);
+	if (fd == -1)
+	{
+		char name[] = P_tmpdir "/ouistiti-XXXXXX";
+		fd = mkstemp(name);
+		if (fd != -1)
+			unlink(name);
+	}
+	return fd;
+}
+
+static int _archive_connectorheader(document_connector_t *private, http_message_t *request, http_message_t *response)
+{
+	document_archive_t *archive = calloc(1, sizeof(*archive));
+	if (archive == NULL)
+		goto error;
+	private->archive = archive;
+	archive->format = _archive_format(request);
+	archive->fdbody = -1;
+	archive->fdcentral = -1;
+	archive->output = malloc(ARCHIVE_OUTPUTSIZE);
+	if (archive->output == NULL)
+		goto error;
+	if (archive->format == ARCHIVE_ZIP)
+	{
+		_archive_crcinit();
+		archive->fdcentral = _archive_central();
+		if (archive->fdcentral == -1)
+			goto error;
+	}
+	/// the directory may be shared, the offset of the walk is its own
+	int fd = openat(private->fdfile, ".", O_RDONLY | O_DIRECTORY);
+	archive->dirs[0].dir = (fd != -1)? fdopendir(fd): NULL;
+	if (archive->dirs[0].dir == NULL)
+	{
+		if (fd != -1)
+			close(fd);
+		goto error;
+	}
+	size_t urllength = strlen(private->url);
+	if (urllength + 2 > sizeof(archive->path))
+		goto error;
+	memcpy(archive->path, private->url, urllength + 1);
+	if (urllength > 0 && archive->path[urllength - 1] != '/')
+		archive->path[urllength++] = '/';
+	archive->path[urllength] = '\0';
+	archive->base = urllength;
+	archive->dirs[0].pathlength = urllength;
+#ifdef SENDFILE
+	archive->sendfile = (private->transfer == mod_send_sendfile);
+#endif
+
+	/**
+	 * The length of the archive is unknown.
+	 * HTTP/1.1 sends the content by chunks and keeps the connection.
+	 */
+	const char *protocol = httpmessage_REQUEST(request, "protocol");
+	archive->chunked = (protocol != NULL && !strcmp(protocol, "HTTP/1.1"));
+	const char *extension = ".tar";
+	const char *mime = "application/x-tar";
+	if (archive->format == ARCHIVE_ZIP)
+	{
+		extension = ".zip";
+		mime = "application/zip";
+	}
+	httpmessage_addcontent(response, mime, NULL, -1);
+	if (archive->chunked)
+		httpmessage_addheader(response, "Transfer-Encoding", STRING_REF("chunked"));
+	const char *name = "archive";
+	int namelength = 7;
+	if (urllength > 1)
+	{
+		int start = urllength - 1;
+		while (start > 0 && archive->path[start - 1] != '/')
+			start--;
+		name = archive->path + start;
+		namelength = urllength - 1 - start;
+	}
+	char disposition[NAME_MAX + 32];
+	snprintf(disposition, sizeof(disposition), "attachment; filename=\"%.*s%s\"",
+			namelength, name, extension);
+	httpmessage_addheader(response, "Content-Disposition", disposition, -1);
+	return ECONTINUE;
+
+error:
+	warn("archive: directory not open %s %s", private->url, strerror(errno));
+	document_close(private, request);
+	httpmessage_result(response, RESULT_400);
+	return ESUCCESS;
+}
+
+/**
+ * this function is used by mod_document and has NOT to be static
+ */
+int archive_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	document_connector_t *private = httpmessage_private(request, NULL);
+	document_archive_t *archive = private->archive;
+
+	if (archive == NULL)
+		return _archive_connectorheader(private, request, response);
+
+	int ret = ESUCCESS;
+	if (archive->sendlength > 0)
+		ret = _archive_flush(private);
+	else if (archive->bodysize > 0)
+		ret = _archive_body(private);
+	else if (archive->step != ARCHIVE_DONE)
+	{
+		_archive_fill(private, request);
+		ret = _archive_flush(private);
+	}
+	else
+	{
+		warn("archive: send %s (%llu bytes)", private->url, archive->offset);
+		if (!archive->chunked)
+			httpclient_shutdown(httpmessage_client(request));
+		document_close(private, request);
+		return ESUCCESS;
+	}
+	if (ret == EREJECT)
+	{
+		err("archive: send %s %s", private->url, strerror(errno));
+		document_close(private, request);
+		return EREJECT;
+	}
+	return ECONTINUE;
+}
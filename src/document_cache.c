@@ -0,0 +1,522 @@
+/*****************************************************************************
+ * document_cache.c: cache of the opened files
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/utils.h"
+#include "ouistiti/log.h"
+#include "mod_document.h"
+
+#define cache_dbg(...)
+
+/**
+ * The cache keeps the file descriptors and the stat of the files
+ * opened by the GET requests.
+ * The entries are shared between the requests with a reference counter,
+ * the cache owns one reference while the entry is inside the table.
+ * The transfer functions use the offset of the request (pread, sendfile
+ * with offset), the file position of the descriptor is never used.
+ *
+ * The small files are loaded into memory with their validators,
+ * and the cache may be filled at the start from the docroot to be
+ * shared by all the forked clients.
+ */
+#define CACHE_PRELOAD_DEPTH 8
+
+struct document_cacheentry_s
+{
+	int fd;
+	struct stat filestat;
+	const char *mime;
+	char *data;
+	char *deflated;
+	size_t deflatedsize;
+	char etag[48];
+	char lastmodified[32];
+	int encodings;
+	int fdroot;
+	char *url;
+	size_t urllen;
+	unsigned int hash;
+	int refs;
+	time_t checked;
+	document_cacheentry_t *hnext;
+	document_cacheentry_t *prev;
+	document_cacheentry_t *next;
+};
+
+struct document_cache_s
+{
+	document_cacheentry_t **table;
+	int nbuckets;
+	int size;
+	int length;
+	int interval;
+	size_t filesize;
+	size_t memory;
+	size_t used;
+	document_cacheentry_t *first;
+	document_cacheentry_t *last;
+	unsigned long hits;
+	unsigned long misses;
+#ifdef USE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+};
+
+#ifdef USE_PTHREAD
+#define CACHE_LOCK(cache) pthread_mutex_lock(&(cache)->mutex)
+#define CACHE_UNLOCK(cache) pthread_mutex_unlock(&(cache)->mutex)
+#else
+#define CACHE_LOCK(cache)
+#define CACHE_UNLOCK(cache)
+#endif
+
+static time_t _cache_now(void)
+{
+	struct timespec now;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return now.tv_sec;
+}
+
+static unsigned int _cache_hash(int fdroot, const char *url, size_t urllen)
+{
+	/// FNV-1a
+	unsigned int hash = 2166136261u ^ (unsigned int)fdroot;
+	for (size_t i = 0; i < urllen; i++)
+	{
+		hash ^= (unsigned char)url[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+document_cache_t *document_cachecreate(int size, int interval, size_t filesize, size_t memory)
+{
+	if (size < 1)
+		return NULL;
+	document_cache_t *cache = calloc(1, sizeof(*cache));
+	cache->nbuckets = size;
+	cache->table = calloc(cache->nbuckets, sizeof(*cache->table));
+	cache->size = size;
+	cache->interval = interval;
+	cache->filesize = filesize;
+	cache->memory = memory;
+#ifdef USE_PTHREAD
+	pthread_mutex_init(&cache->mutex, NULL);
+#endif
+	return cache;
+}
+
+static void _cache_unref(document_cacheentry_t *entry)
+{
+	entry->refs--;
+	if (entry->refs > 0)
+		return;
+	cache_dbg("document: cache close %s", entry->url);
+	close(entry->fd);
+	free(entry->data);
+	free(entry->deflated);
+	free(entry->url);
+	free(entry);
+}
+
+static void _cache_unlink(document_cache_t *cache, document_cacheentry_t *entry)
+{
+	document_cacheentry_t **it = &cache->table[entry->hash % cache->nbuckets];
+	while (*it != NULL && *it != entry)
+		it = &(*it)->hnext;
+	if (*it != NULL)
+		*it = entry->hnext;
+
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->first = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->last = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+	entry->hnext = NULL;
+	cache->length--;
+	if (entry->data != NULL)
+		cache->used -= entry->filestat.st_size;
+	if (entry->deflated != NULL)
+		cache->used -= entry->deflatedsize;
+	_cache_unref(entry);
+}
+
+static void _cache_touch(document_cache_t *cache, document_cacheentry_t *entry)
+{
+	if (cache->first == entry)
+		return;
+	/// remove from the LRU list
+	entry->prev->next = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->last = entry->prev;
+	/// push at the beginning
+	entry->prev = NULL;
+	entry->next = cache->first;
+	cache->first->prev = entry;
+	cache->first = entry;
+}
+
+static int _cache_check(const document_cacheentry_t *entry)
+{
+	struct stat filestat;
+	if (fstatat(entry->fdroot, entry->url, &filestat, 0) == -1)
+		return EREJECT;
+	if (filestat.st_ino != entry->filestat.st_ino ||
+		filestat.st_dev != entry->filestat.st_dev ||
+		filestat.st_size != entry->filestat.st_size ||
+		filestat.st_mtim.tv_sec != entry->filestat.st_mtim.tv_sec ||
+		filestat.st_mtim.tv_nsec != entry->filestat.st_mtim.tv_nsec)
+		return EREJECT;
+	return ESUCCESS;
+}
+
+static document_cacheentry_t *_cache_find(const document_cache_t *cache, unsigned int hash,
+		int fdroot, const char *url, size_t urllen)
+{
+	document_cacheentry_t *entry = cache->table[hash % cache->nbuckets];
+	while (entry != NULL && (entry->hash != hash || entry->fdroot != fdroot ||
+			entry->urllen != urllen || memcmp(entry->url, url, urllen)))
+		entry = entry->hnext;
+	return entry;
+}
+
+document_cacheentry_t *document_cacheget(document_cache_t *cache, int fdroot, const char *url, size_t urllen)
+{
+	unsigned int hash = _cache_hash(fdroot, url, urllen);
+
+	CACHE_LOCK(cache);
+	document_cacheentry_t *entry = _cache_find(cache, hash, fdroot, url, urllen);
+	if (entry != NULL && cache->interval >= 0)
+	{
+		time_t now = _cache_now();
+		if (now - entry->checked >= cache->interval)
+		{
+			if (_cache_check(entry) != ESUCCESS)
+			{
+				cache_dbg("document: cache %s changed", entry->url);
+				_cache_unlink(cache, entry);
+				entry = NULL;
+			}
+			else
+			{
+				entry->checked = now;
+				entry->encodings = document_encodings(entry->fdroot, entry->url);
+			}
+		}
+	}
+	if (entry != NULL)
+	{
+		_cache_touch(cache, entry);
+		entry->refs++;
+		cache->hits++;
+	}
+	else
+		cache->misses++;
+	CACHE_UNLOCK(cache);
+	return entry;
+}
+
+static void _cache_load(document_cache_t *cache, document_cacheentry_t *entry)
+{
+	size_t size = entry->filestat.st_size;
+	if (size > cache->filesize || cache->used + size > cache->memory)
+		return;
+	char *data = malloc(size);
+	if (data == NULL)
+		return;
+	size_t offset = 0;
+	while (offset < size)
+	{
+		ssize_t ret = pread(entry->fd, data + offset, size - offset, offset);
+		if (ret <= 0)
+		{
+			free(data);
+			return;
+		}
+		offset += ret;
+	}
+	entry->data = data;
+	cache->used += size;
+}
+
+static void _cache_validators(document_cacheentry_t *entry)
+{
+	document_validators(&entry->filestat, NULL, entry->etag, sizeof(entry->etag),
+			entry->lastmodified, sizeof(entry->lastmodified));
+}
+
+static document_cacheentry_t *_cache_insert(document_cache_t *cache, int fdroot, const char *url, size_t urllen,
+		int fd, const struct stat *filestat, const char *mime, int refs)
+{
+	document_cacheentry_t *entry = calloc(1, sizeof(*entry));
+	entry->fd = fd;
+	memcpy(&entry->filestat, filestat, sizeof(entry->filestat));
+	entry->mime = mime;
+	entry->fdroot = fdroot;
+	entry->url = strndup(url, urllen);
+	entry->urllen = urllen;
+	entry->hash = _cache_hash(fdroot, url, urllen);
+	entry->checked = _cache_now();
+	entry->refs = refs;
+	entry->encodings = document_encodings(fdroot, entry->url);
+	_cache_validators(entry);
+
+	CACHE_LOCK(cache);
+	/**
+	 * two requests may miss the same file at the same time,
+	 * the second one keeps its descriptor out of the cache.
+	 */
+	if (_cache_find(cache, entry->hash, fdroot, url, urllen) != NULL)
+	{
+		CACHE_UNLOCK(cache);
+		cache_dbg("document: cache %s already set", entry->url);
+		free(entry->url);
+		free(entry);
+		return NULL;
+	}
+	if (cache->length >= cache->size && cache->last != NULL)
+	{
+		cache_dbg("document: cache evict %s", cache->last->url);
+		_cache_unlink(cache, cache->last);
+	}
+	_cache_load(cache, entry);
+	document_cacheentry_t **bucket = &cache->table[entry->hash % cache->nbuckets];
+	entry->hnext = *bucket;
+	*bucket = entry;
+	entry->next = cache->first;
+	if (cache->first != NULL)
+		cache->first->prev = entry;
+	cache->first = entry;
+	if (cache->last == NULL)
+		cache->last = entry;
+	cache->length++;
+	CACHE_UNLOCK(cache);
+	return entry;
+}
+
+document_cacheentry_t *document_cacheadd(document_cache_t *cache, int fdroot, const char *url, size_t urllen,
+		int fd, const struct stat *filestat, const char *mime)
+{
+	/**
+	 * the file descriptor must be the file of the url
+	 * and not the default page of a directory.
+	 */
+	struct stat urlstat;
+	if (!S_ISREG(filestat->st_mode) ||
+		fstatat(fdroot, url, &urlstat, 0) == -1 ||
+		urlstat.st_ino != filestat->st_ino || urlstat.st_dev != filestat->st_dev)
+		return NULL;
+
+	/// one reference for the cache and one for the request
+	return _cache_insert(cache, fdroot, url, urllen, fd, filestat, mime, 2);
+}
+
+static void _cache_preloaddir(document_cache_t *cache, int fdroot, int fddir,
+		const char *path, const htaccess_t *htaccess, int depth)
+{
+	DIR *dir = fdopendir(fddir);
+	if (dir == NULL)
+	{
+		close(fddir);
+		return;
+	}
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL && cache->length < cache->size)
+	{
+		if (ent->d_name[0] == '.')
+			continue;
+		char url[PATH_MAX];
+		int urllen = snprintf(url, sizeof(url), "%s%s", path, ent->d_name);
+		if (urllen >= (int)sizeof(url))
+			continue;
+		struct stat filestat;
+		if (fstatat(dirfd(dir), ent->d_name, &filestat, 0) == -1)
+			continue;
+		if (S_ISDIR(filestat.st_mode) && depth > 0)
+		{
+			int fdsub = openat(dirfd(dir), ent->d_name, O_DIRECTORY);
+			if (fdsub == -1)
+				continue;
+			url[urllen++] = '/';
+			url[urllen] = '\0';
+			_cache_preloaddir(cache, fdroot, fdsub, url, htaccess, depth - 1);
+			continue;
+		}
+		if (!S_ISREG(filestat.st_mode) || filestat.st_size == 0 ||
+			(size_t)filestat.st_size > cache->filesize ||
+			cache->used + filestat.st_size > cache->memory)
+			continue;
+		/// the URI of the request keeps the leading slash for htaccess
+		char uri[PATH_MAX + 1];
+		snprintf(uri, sizeof(uri), "/%s", url);
+		if (htaccess_check(htaccess, uri, NULL) != ESUCCESS)
+			continue;
+		int fd = openat(dirfd(dir), ent->d_name, O_RDONLY);
+		if (fd == -1)
+			continue;
+		cache_dbg("document: cache preload %s", url);
+		/// only the cache owns this entry
+		if (_cache_insert(cache, fdroot, url, urllen, fd, &filestat, utils_getmime(url), 1) == NULL)
+			close(fd);
+	}
+	closedir(dir);
+}
+
+void document_cachepreload(document_cache_t *cache, int fdroot, const htaccess_t *htaccess)
+{
+	if (cache->filesize == 0 || cache->memory == 0)
+		return;
+	int fddir = openat(fdroot, ".", O_DIRECTORY);
+	if (fddir == -1)
+		return;
+	_cache_preloaddir(cache, fdroot, fddir, "", htaccess, CACHE_PRELOAD_DEPTH);
+	warn("document: cache preload %d files (%lu bytes)", cache->length, (unsigned long)cache->used);
+}
+
+void document_cacherelease(document_cache_t *cache, document_cacheentry_t *entry)
+{
+	CACHE_LOCK(cache);
+	_cache_unref(entry);
+	CACHE_UNLOCK(cache);
+}
+
+int document_cachefd(const document_cacheentry_t *entry, const struct stat **filestat, const char **mime)
+{
+	if (filestat != NULL)
+		*filestat = &entry->filestat;
+	if (mime != NULL)
+		*mime = entry->mime;
+	return entry->fd;
+}
+
+const char *document_cachedata(const document_cacheentry_t *entry)
+{
+	return entry->data;
+}
+
+void document_cachevalidators(const document_cacheentry_t *entry, const char **etag, const char **lastmodified)
+{
+	*etag = entry->etag;
+	*lastmodified = entry->lastmodified;
+}
+
+int document_cacheencodings(const document_cacheentry_t *entry)
+{
+	return entry->encodings;
+}
+
+#ifdef DOCUMENTDEFLATE
+/**
+ * the compressed content is kept with the entry, it is checked
+ * with the original file (mtime, size) and it is compressed once.
+ */
+static void _cache_deflate(document_cache_t *cache, document_cacheentry_t *entry, int level)
+{
+	if (entry->data == NULL || entry->deflated != NULL || entry->deflatedsize == (size_t)-1)
+		return;
+	char *output = NULL;
+	size_t outputsize = 0;
+	if (document_deflatebuffer(level, entry->data, entry->filestat.st_size, &output, &outputsize) != ESUCCESS ||
+		cache->used + outputsize > cache->memory)
+	{
+		free(output);
+		/// don't try again
+		entry->deflatedsize = (size_t)-1;
+		return;
+	}
+	cache_dbg("document: cache deflate %s %lu -> %lu", entry->url,
+			(unsigned long)entry->filestat.st_size, (unsigned long)outputsize);
+	entry->deflated = output;
+	entry->deflatedsize = outputsize;
+	cache->used += outputsize;
+}
+
+const char *document_cachedeflate(document_cache_t *cache, document_cacheentry_t *entry, int level, size_t *size)
+{
+	CACHE_LOCK(cache);
+	_cache_deflate(cache, entry, level);
+	CACHE_UNLOCK(cache);
+	*size = entry->deflatedsize;
+	return entry->deflated;
+}
+
+void document_cachedeflateall(document_cache_t *cache, const char *types, int level)
+{
+	CACHE_LOCK(cache);
+	for (document_cacheentry_t *entry = cache->first; entry != NULL; entry = entry->next)
+	{
+		if (entry->mime != NULL && utils_searchexp(entry->mime, types, NULL) == ESUCCESS)
+			_cache_deflate(cache, entry, level);
+	}
+	CACHE_UNLOCK(cache);
+}
+#endif
+
+void document_cachestats(document_cache_t *cache, unsigned long *hits, unsigned long *misses)
+{
+	CACHE_LOCK(cache);
+	*hits = cache->hits;
+	*misses = cache->misses;
+	CACHE_UNLOCK(cache);
+}
+
+void document_cachedestroy(document_cache_t *cache)
+{
+	warn("document: cache %lu hits %lu misses", cache->hits, cache->misses);
+	while (cache->first != NULL)
+		_cache_unlink(cache, cache->first);
+#ifdef USE_PTHREAD
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+	free(cache->table);
+	free(cache);
+}
@@ -0,0 +1,236 @@
+/*****************************************************************************
+ * document_deflate.c: compress the content on the fly
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/utils.h"
+#include "ouistiti/log.h"
+#include "mod_document.h"
+
+#define deflate_dbg(...)
+
+/**
+ * gzip header and trailer around the deflate stream
+ */
+#define DEFLATE_WINDOWBITS (15 + 16)
+#define DEFLATE_MEMLEVEL 8
+#define DEFLATE_OUTPUTSIZE (16 * 1024)
+
+struct document_deflate_s
+{
+	z_stream stream;
+	unsigned long long cputime;
+	char output[DEFLATE_OUTPUTSIZE];
+};
+
+static unsigned long long _deflate_cputime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int document_deflateaccept(const mod_document_t *config, http_message_t *request, const char *mime)
+{
+	if (!(config->options & DOCUMENT_DEFLATE) || mime == NULL)
+		return EREJECT;
+	if (strcmp(httpmessage_REQUEST(request, "method"), str_get))
+		return EREJECT;
+	/// the ranges are on the original content
+	const char *range = httpmessage_REQUEST(request, "Range");
+	if (range != NULL && range[0] != '\0')
+		return EREJECT;
+	if (!(document_acceptencoding(request) & DOCUMENT_ENCODING_GZIP))
+		return EREJECT;
+	return utils_searchexp(mime, config->deflatetypes, NULL);
+}
+
+void document_deflateheaders(http_message_t *response)
+{
+	httpmessage_addheader(response, "Content-Encoding", STRING_REF("gzip"));
+	httpmessage_addheader(response, "Vary", STRING_REF("Accept-Encoding"));
+}
+
+int document_deflatestart(document_connector_t *private, http_message_t *response)
+{
+	const mod_document_t *config = private->mod->config;
+	document_deflate_t *ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return EREJECT;
+	if (deflateInit2(&ctx->stream, config->deflatelevel, Z_DEFLATED,
+			DEFLATE_WINDOWBITS, DEFLATE_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		err("document: deflate init error");
+		free(ctx);
+		return EREJECT;
+	}
+	private->deflate = ctx;
+	private->type |= DOCUMENT_DEFLATE;
+	document_deflateheaders(response);
+	return ESUCCESS;
+}
+
+/**
+ * the content is compressed piece by piece, each full output buffer
+ * is appended to the response.
+ */
+int document_deflatecontent(document_connector_t *private, http_message_t *response,
+		const char *data, size_t size, int finish)
+{
+	document_deflate_t *ctx = private->deflate;
+	if (ctx == NULL)
+		return httpmessage_addcontent(response, NULL, data, size);
+
+	unsigned long long start = _deflate_cputime();
+	int flush = (finish)? Z_FINISH: Z_NO_FLUSH;
+	ctx->stream.next_in = (Bytef *)data;
+	ctx->stream.avail_in = size;
+	int ret;
+	do
+	{
+		ctx->stream.next_out = (Bytef *)ctx->output;
+		ctx->stream.avail_out = sizeof(ctx->output);
+		ret = deflate(&ctx->stream, flush);
+		if (ret == Z_STREAM_ERROR)
+		{
+			err("document: deflate error");
+			return EREJECT;
+		}
+		size_t length = sizeof(ctx->output) - ctx->stream.avail_out;
+		if (length > 0)
+			httpmessage_addcontent(response, NULL, ctx->output, length);
+	} while (ctx->stream.avail_out == 0);
+	ctx->cputime += _deflate_cputime() - start;
+	return ESUCCESS;
+}
+
+void document_deflateclose(document_connector_t *private)
+{
+	document_deflate_t *ctx = private->deflate;
+	if (ctx == NULL)
+		return;
+	unsigned long in = ctx->stream.total_in;
+	unsigned long out = ctx->stream.total_out;
+	warn("document: deflate %s %lu -> %lu bytes (%lu%%) %llu us", private->url, in, out,
+			(in > 0)? (out * 100 / in): 100, ctx->cputime / 1000);
+	deflateEnd(&ctx->stream);
+	free(ctx);
+	private->deflate = NULL;
+}
+
+int document_deflatebuffer(int level, const char *data, size_t size, char **output, size_t *outputsize)
+{
+	z_stream stream = {0};
+	if (deflateInit2(&stream, level, Z_DEFLATED, DEFLATE_WINDOWBITS,
+			DEFLATE_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return EREJECT;
+	size_t length = deflateBound(&stream, size);
+	char *buffer = malloc(length);
+	if (buffer == NULL)
+	{
+		deflateEnd(&stream);
+		return EREJECT;
+	}
+	stream.next_in = (Bytef *)data;
+	stream.avail_in = size;
+	stream.next_out = (Bytef *)buffer;
+	stream.avail_out = length;
+	int ret = deflate(&stream, Z_FINISH);
+	length = stream.total_out;
+	deflateEnd(&stream);
+	if (ret != Z_STREAM_END)
+	{
+		free(buffer);
+		return EREJECT;
+	}
+	*output = buffer;
+	*outputsize = length;
+	return ESUCCESS;
+}
+
+int mod_send_deflate(document_connector_t *private, http_message_t *response)
+{
+	const mod_document_t *config = private->mod->config;
+	size_t size = (config->transfersize > TRANSFER_MINSIZE)? config->transfersize: TRANSFER_MINSIZE;
+	char *buffer = document_transferbuffer(private, size);
+	if (buffer == NULL)
+		return -1;
+	if (size > private->buffersize)
+		size = private->buffersize;
+	if (size > private->size)
+		size = private->size;
+
+	/// the file descriptor may be shared by the cache, the offset is the request's one
+	ssize_t length = pread(private->fdfile, buffer, size, private->offset);
+	if (length < 0)
+	{
+		err("document: response() read file error %s", strerror(errno));
+		return length;
+	}
+	/// a truncated file finishes the stream too
+	int finish = (length == 0 || (unsigned long long)length == private->size);
+	if (document_deflatecontent(private, response, buffer, length, finish) != ESUCCESS)
+		return -1;
+	if (length == 0)
+		private->size = 0;
+	deflate_dbg("document: deflate %ld", length);
+	return length;
+}
+
+/**
+ * the length of the compressed content is unknown,
+ * the end of the content is the end of the connection.
+ */
+int deflatefile_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	document_connector_t *private = httpmessage_private(request, NULL);
+
+	if (private->size == 0)
+	{
+		httpclient_shutdown(httpmessage_client(request));
+		document_close(private, request);
+		return ESUCCESS;
+	}
+	int ret = private->transfer(private, response);
+	if (ret < 0)
+	{
+		err("document: send %s (%d,%s)", private->url, ret, strerror(errno));
+		document_close(private, request);
+		return EREJECT;
+	}
+	private->offset += ret;
+	private->size -= ret;
+	return ECONTINUE;
+}
@@ -25,8 +25,10 @@
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *****************************************************************************/
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef FILE_CONFIG
 #include <libconfig.h>
@@ -39,6 +41,238 @@
 
 const char str_wildcard[] = "*";
 
+#define EXP_START 0x01 /// "^" the first segment starts the URI
+#define EXP_END 0x02 /// "$" the last segment ends the URI
+#define EXP_REST 0x04 /// "*" at the end, the rest of the URI is the path_info
+
+typedef struct htaccess_needle_s htaccess_needle_t;
+struct htaccess_needle_s
+{
+	int flags;
+	int nsegments;
+	string_t *segments;
+	htaccess_needle_t *next;
+};
+
+/**
+ * the ".ext" needles are stored into a trie,
+ * the URI is walked only from its dots.
+ */
+typedef struct htaccess_extnode_s htaccess_extnode_t;
+struct htaccess_extnode_s
+{
+	char c;
+	int flags;
+	htaccess_extnode_t *child;
+	htaccess_extnode_t *sibling;
+};
+
+struct htaccess_exp_s
+{
+	htaccess_extnode_t *extensions;
+	htaccess_needle_t *needles;
+	htaccess_needle_t *last;
+};
+
+static void _htaccess_extinsert(htaccess_exp_t *exp, const char *ext, size_t length, int flags)
+{
+	htaccess_extnode_t **parent = &exp->extensions;
+	htaccess_extnode_t *node = NULL;
+	for (size_t i = 0; i < length; i++)
+	{
+		node = *parent;
+		while (node != NULL && node->c != ext[i])
+			node = node->sibling;
+		if (node == NULL)
+		{
+			node = calloc(1, sizeof(*node));
+			node->c = ext[i];
+			node->sibling = *parent;
+			*parent = node;
+		}
+		parent = &node->child;
+	}
+	/// the flags are stored +1 to keep 0 for "no needle"
+	node->flags = flags + 1;
+}
+
+static void _htaccess_extfree(htaccess_extnode_t *node)
+{
+	while (node != NULL)
+	{
+		htaccess_extnode_t *sibling = node->sibling;
+		_htaccess_extfree(node->child);
+		free(node);
+		node = sibling;
+	}
+}
+
+static int _htaccess_extmatch(const htaccess_extnode_t *root, const char *uri, const char **rest)
+{
+	for (const char *dot = strchr(uri, '.'); dot != NULL; dot = strchr(dot + 1, '.'))
+	{
+		const htaccess_extnode_t *node = root;
+		for (const char *it = dot; node != NULL && *it != '\0'; it++)
+		{
+			while (node != NULL && node->c != *it)
+				node = node->sibling;
+			if (node == NULL)
+				break;
+			int flags = node->flags - 1;
+			if (flags >= 0 && (!(flags & EXP_END) || it[1] == '\0'))
+			{
+				if ((flags & EXP_REST) && rest != NULL)
+					*rest = it + 1;
+				return ESUCCESS;
+			}
+			node = node->child;
+		}
+	}
+	return EREJECT;
+}
+
+static void _htaccess_addneedle(htaccess_exp_t *exp, const char *needle, size_t length)
+{
+	int flags = 0;
+	if (length > 0 && needle[0] == '^')
+	{
+		flags |= EXP_START;
+		needle++;
+		length--;
+	}
+	if (length > 0 && needle[length - 1] == '$')
+	{
+		flags |= EXP_END;
+		length--;
+	}
+	else if (length > 0 && needle[length - 1] == '*')
+		flags |= EXP_REST;
+
+	int nsegments = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (needle[i] != '*' && (i == 0 || needle[i - 1] == '*'))
+			nsegments++;
+	}
+
+	const char *ext = needle;
+	size_t extlength = length;
+	if (extlength > 0 && ext[0] == '*')
+	{
+		ext++;
+		extlength--;
+	}
+	if ((flags & EXP_REST) && extlength > 0)
+		extlength--;
+	if (!(flags & EXP_START) && nsegments == 1 && extlength > 1 &&
+		ext[0] == '.' && memchr(ext, '*', extlength) == NULL)
+	{
+		_htaccess_extinsert(exp, ext, extlength, flags);
+		return;
+	}
+
+	htaccess_needle_t *entry = calloc(1, sizeof(*entry));
+	entry->flags = flags;
+	entry->nsegments = nsegments;
+	entry->segments = calloc(nsegments + 1, sizeof(*entry->segments));
+	int segment = -1;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (needle[i] == '*')
+			continue;
+		if (i == 0 || needle[i - 1] == '*')
+		{
+			segment++;
+			entry->segments[segment].data = needle + i;
+		}
+		entry->segments[segment].length++;
+	}
+	if (exp->last != NULL)
+		exp->last->next = entry;
+	else
+		exp->needles = entry;
+	exp->last = entry;
+}
+
+static int _htaccess_needlematch(const htaccess_needle_t *needle, const char *uri, size_t urilength, const char **rest)
+{
+	size_t offset = 0;
+	for (int i = 0; i < needle->nsegments; i++)
+	{
+		const string_t *segment = &needle->segments[i];
+		const char *found = NULL;
+		if (urilength - offset < segment->length)
+			return EREJECT;
+		if (i == 0 && (needle->flags & EXP_START))
+		{
+			if (!memcmp(uri, segment->data, segment->length))
+				found = uri;
+		}
+		else if (i == needle->nsegments - 1 && (needle->flags & EXP_END))
+		{
+			if (!memcmp(uri + urilength - segment->length, segment->data, segment->length))
+				found = uri + urilength - segment->length;
+		}
+		else
+			found = memmem(uri + offset, urilength - offset, segment->data, segment->length);
+		if (found == NULL)
+			return EREJECT;
+		offset = found - uri + segment->length;
+	}
+	if ((needle->flags & EXP_END) && offset != urilength)
+		return EREJECT;
+	if ((needle->flags & EXP_REST) && rest != NULL)
+		*rest = uri + offset;
+	return ESUCCESS;
+}
+
+static htaccess_exp_t *_htaccess_compile(const string_t *pattern)
+{
+	if (pattern->data == NULL)
+		return NULL;
+	htaccess_exp_t *exp = calloc(1, sizeof(*exp));
+	const char *needle = pattern->data;
+	while (needle != NULL)
+	{
+		const char *end = strchr(needle, ',');
+		size_t length = (end != NULL)? (size_t)(end - needle): strlen(needle);
+		if (length > 0)
+			_htaccess_addneedle(exp, needle, length);
+		needle = (end != NULL)? end + 1: NULL;
+	}
+	return exp;
+}
+
+static void _htaccess_freeexp(htaccess_exp_t *exp)
+{
+	if (exp == NULL)
+		return;
+	_htaccess_extfree(exp->extensions);
+	htaccess_needle_t *needle = exp->needles;
+	while (needle != NULL)
+	{
+		htaccess_needle_t *next = needle->next;
+		free(needle->segments);
+		free(needle);
+		needle = next;
+	}
+	free(exp);
+}
+
+static int _htaccess_match(const htaccess_exp_t *exp, const string_t *pattern, const char *uri, size_t urilength, const char **rest)
+{
+	if (exp == NULL)
+		return utils_searchexp(uri, pattern->data, rest);
+	if (exp->extensions != NULL && _htaccess_extmatch(exp->extensions, uri, rest) == ESUCCESS)
+		return ESUCCESS;
+	for (const htaccess_needle_t *needle = exp->needles; needle != NULL; needle = needle->next)
+	{
+		if (_htaccess_needlematch(needle, uri, urilength, rest) == ESUCCESS)
+			return ESUCCESS;
+	}
+	return EREJECT;
+}
+
 #ifdef FILE_CONFIG
 int htaccess_config(config_setting_t *setting, htaccess_t *htaccess)
 {
@@ -56,23 +290,106 @@ int htaccess_config(config_setting_t *setting, htaccess_t *htaccess)
 		_string_store(&htaccess->denyfirst, deny, -1);
 	else
 		_string_store(&htaccess->denylast, deny, -1);
+
+	htaccess->denyfirstexp = _htaccess_compile(&htaccess->denyfirst);
+	htaccess->allowexp = _htaccess_compile(&htaccess->allow);
+	htaccess->denylastexp = _htaccess_compile(&htaccess->denylast);
 	return ESUCCESS;
 }
 #endif
 
+void htaccess_free(htaccess_t *htaccess)
+{
+	_htaccess_freeexp(htaccess->denyfirstexp);
+	htaccess->denyfirstexp = NULL;
+	_htaccess_freeexp(htaccess->allowexp);
+	htaccess->allowexp = NULL;
+	_htaccess_freeexp(htaccess->denylastexp);
+	htaccess->denylastexp = NULL;
+}
+
 int htaccess_check(const htaccess_t *htaccess, const char *uri, const char **path_info)
 {
-	if (htaccess->denyfirst.data != NULL && utils_searchexp(uri, htaccess->denyfirst.data, NULL) == ESUCCESS)
+	size_t urilength = strlen(uri);
+	if (htaccess->denyfirst.data != NULL &&
+		_htaccess_match(htaccess->denyfirstexp, &htaccess->denyfirst, uri, urilength, NULL) == ESUCCESS)
 	{
 		return  EREJECT;
 	}
-	if (htaccess->allow.data != NULL && utils_searchexp(uri, htaccess->allow.data, path_info) == ESUCCESS)
+	if (htaccess->allow.data != NULL &&
+		_htaccess_match(htaccess->allowexp, &htaccess->allow, uri, urilength, path_info) == ESUCCESS)
 	{
 		return  ESUCCESS;
 	}
-	if (htaccess->denylast.data != NULL && utils_searchexp(uri, htaccess->denylast.data, NULL) == ESUCCESS)
+	if (htaccess->denylast.data != NULL &&
+		_htaccess_match(htaccess->denylastexp, &htaccess->denylast, uri, urilength, NULL) == ESUCCESS)
 	{
 		return  EREJECT;
 	}
 	return ESUCCESS;
 }
+
+/**
+ * build the lists of URI prefixes and extensions for the router.
+ * The routing is possible only if all other URIs are denied, and
+ * the allowed patterns are all "^/prefix*" or all "*.ext*".
+ */
+int htaccess_route(const htaccess_t *htaccess, char **prefixes, char **extensions)
+{
+	*prefixes = NULL;
+	*extensions = NULL;
+	if (htaccess->allow.data == NULL || htaccess->denylast.data == NULL ||
+		strcmp(htaccess->denylast.data, str_wildcard))
+		return EREJECT;
+
+	size_t length = htaccess->allow.length + 1;
+	char *prefix = calloc(1, length);
+	char *extension = calloc(1, length);
+	size_t prefixlen = 0;
+	size_t extensionlen = 0;
+	const char *it = htaccess->allow.data;
+	while (it != NULL && *it != '\0')
+	{
+		const char *end = strchr(it, ',');
+		if (end == NULL)
+			end = it + strlen(it);
+		const char *literal = NULL;
+		char *list = NULL;
+		size_t *listlen = NULL;
+		if (it[0] == '^')
+		{
+			literal = it + 1;
+			list = prefix;
+			listlen = &prefixlen;
+		}
+		else if (it[0] == '.' || (it[0] == '*' && it[1] == '.'))
+		{
+			literal = strchr(it, '.') + 1;
+			list = extension;
+			listlen = &extensionlen;
+		}
+		size_t literallen = 0;
+		if (literal != NULL)
+			literallen = strcspn(literal, "*$,");
+		if (literallen == 0)
+		{
+			/// this pattern may match any URI
+			free(prefix);
+			free(extension);
+			return EREJECT;
+		}
+		*listlen += snprintf(list + *listlen, length - *listlen, "%s%.*s",
+						(*listlen > 0)?",":"", (int)literallen, literal);
+		it = (*end == ',')? end + 1: NULL;
+	}
+	if (prefixlen > 0 && extensionlen > 0)
+	{
+		/// the router checks prefix AND extension, not OR
+		free(prefix);
+		free(extension);
+		return EREJECT;
+	}
+	*prefixes = prefix;
+	*extensions = extension;
+	return ESUCCESS;
+}
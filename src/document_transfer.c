@@ -0,0 +1,308 @@
+/*****************************************************************************
+ * document_transfer.c: send the files with a large buffer
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/sockios.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/log.h"
+#include "mod_document.h"
+
+#define transfer_dbg(...)
+
+/**
+ * The buffers are kept into a pool for the next requests.
+ * With the fork model each worker or client process has its own pool.
+ */
+#define POOL_MAXBUFFERS 8
+
+typedef struct transfer_buffer_s transfer_buffer_t;
+struct transfer_buffer_s
+{
+	size_t size;
+	transfer_buffer_t *next;
+};
+
+static transfer_buffer_t *g_pool = NULL;
+static int g_poollength = 0;
+#ifdef USE_PTHREAD
+static pthread_mutex_t g_poolmutex = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK() pthread_mutex_lock(&g_poolmutex)
+#define POOL_UNLOCK() pthread_mutex_unlock(&g_poolmutex)
+#else
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#endif
+
+static char *_transfer_bufferget(size_t size)
+{
+	transfer_buffer_t *buffer = NULL;
+	POOL_LOCK();
+	transfer_buffer_t **it = &g_pool;
+	while (*it != NULL && (*it)->size < size)
+		it = &(*it)->next;
+	if (*it != NULL)
+	{
+		buffer = *it;
+		*it = buffer->next;
+		g_poollength--;
+	}
+	POOL_UNLOCK();
+	if (buffer == NULL)
+	{
+		buffer = malloc(sizeof(*buffer) + size);
+		if (buffer == NULL)
+			return NULL;
+		buffer->size = size;
+	}
+	buffer->next = NULL;
+	return (char *)(buffer + 1);
+}
+
+static void _transfer_bufferrelease(char *data)
+{
+	if (data == NULL)
+		return;
+	transfer_buffer_t *buffer = ((transfer_buffer_t *)data) - 1;
+	POOL_LOCK();
+	if (g_poollength < POOL_MAXBUFFERS)
+	{
+		buffer->next = g_pool;
+		g_pool = buffer;
+		g_poollength++;
+		buffer = NULL;
+	}
+	POOL_UNLOCK();
+	free(buffer);
+}
+
+char *document_transferbuffer(document_connector_t *private, size_t max)
+{
+	if (private->buffer == NULL)
+	{
+		/// a small file doesn't need a large buffer
+		size_t buffersize = (private->size < max)? private->size: max;
+		if (buffersize == 0)
+			buffersize = 1;
+		private->buffer = _transfer_bufferget(buffersize);
+		if (private->buffer == NULL)
+			return NULL;
+		private->buffersize = buffersize;
+	}
+	return private->buffer;
+}
+
+/**
+ * the size of the next piece depends on the rest of the file and
+ * on the free space of the socket send buffer.
+ */
+static size_t _transfer_size(document_connector_t *private, size_t max)
+{
+	size_t size = (private->size < max)? private->size : max;
+#ifdef SIOCOUTQ
+	int sock = httpclient_socket(private->ctl);
+	int queued = 0;
+	if (sock > 0 && private->sndbuf > 0 && ioctl(sock, SIOCOUTQ, &queued) == 0)
+	{
+		size_t space = (private->sndbuf > queued)? private->sndbuf - queued : 0;
+		if (space < TRANSFER_MINSIZE)
+			space = TRANSFER_MINSIZE;
+		if (size > space)
+			size = space;
+	}
+#endif
+	return size;
+}
+
+static size_t _transfer_maxsize(const mod_document_t *config)
+{
+	size_t max = DEFAULT_TRANSFERSIZE;
+	if (config->transfersize > 0)
+		max = (config->transfersize > TRANSFER_MINSIZE)? config->transfersize: TRANSFER_MINSIZE;
+	return max;
+}
+
+static void _transfer_sndbuf(document_connector_t *private)
+{
+	int sock = httpclient_socket(private->ctl);
+	socklen_t length = sizeof(private->sndbuf);
+	if (sock <= 0 || getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &private->sndbuf, &length) != 0)
+		private->sndbuf = 0;
+}
+
+int mod_send_read(document_connector_t *private, http_message_t *response)
+{
+	const mod_document_t *config = private->mod->config;
+
+	if (!(private->type & DOCUMENT_TRANSFER))
+	{
+		/**
+		 * the first loop must not send content
+		 * it should send the header first.
+		 */
+		private->type |= DOCUMENT_TRANSFER;
+		_transfer_sndbuf(private);
+		errno = EAGAIN;
+		return ECONTINUE;
+	}
+
+	size_t max = _transfer_maxsize(config);
+	if (document_transferbuffer(private, max) == NULL)
+		return -1;
+	if (max > private->buffersize)
+		max = private->buffersize;
+
+	size_t size = _transfer_size(private, max);
+	/// the file descriptor may be shared by the cache, the offset is the request's one
+	ssize_t length = pread(private->fdfile, private->buffer, size, private->offset);
+	if (length <= 0)
+	{
+		if (length == -1)
+			err("document: response() read file error %s", strerror(errno));
+		return length;
+	}
+	int ret = httpclient_send(private->ctl, private->buffer, length);
+	if (ret < 0 && errno == EWOULDBLOCK)
+		errno = EAGAIN;
+	transfer_dbg("document: send %d/%ld", ret, length);
+	return ret;
+}
+
+/**
+ * the file is mapped by windows of MMAP_WINDOWSIZE bytes, the pieces of
+ * the window are given to the sender of the client, the TLS layer
+ * encrypts them without intermediate copy.
+ * The size of the file is checked before each window, a file truncated
+ * during the transfer is not mapped after its end (SIGBUS).
+ */
+#define MMAP_WINDOWSIZE (4 * 1024 * 1024)
+
+/**
+ * return 0 when the window is mapped, -1 on error, 1 if the file
+ * may not be mapped and must be read
+ */
+static int _transfer_mapwindow(document_connector_t *private)
+{
+	if (private->map != NULL)
+		munmap(private->map, private->mapsize);
+	private->map = NULL;
+	private->mapsize = 0;
+
+	struct stat filestat;
+	if (fstat(private->fdfile, &filestat) != 0)
+		return -1;
+	unsigned long long end = private->offset + private->size;
+	if ((unsigned long long)filestat.st_size < end)
+	{
+		err("document: %s truncated during the transfer", private->url);
+		return -1;
+	}
+	long pagesize = sysconf(_SC_PAGESIZE);
+	off_t start = private->offset - (private->offset % pagesize);
+	unsigned long long mapsize = end - start;
+	if (mapsize > MMAP_WINDOWSIZE)
+		mapsize = MMAP_WINDOWSIZE;
+	void *map = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, private->fdfile, start);
+	if (map == MAP_FAILED)
+	{
+		warn("document: mmap %s error %s, read the file", private->url, strerror(errno));
+		return 1;
+	}
+	madvise(map, mapsize, MADV_SEQUENTIAL);
+	private->map = map;
+	private->mapsize = mapsize;
+	private->mapoffset = start;
+	return 0;
+}
+
+int mod_send_mmap(document_connector_t *private, http_message_t *response)
+{
+	const mod_document_t *config = private->mod->config;
+
+	/// the mapping failed, the rest of the file is read
+	if (private->type & DOCUMENT_TRANSFER)
+		return mod_send_read(private, response);
+
+	if (!(private->type & DOCUMENT_MMAP))
+	{
+		/**
+		 * the first loop must not send content
+		 * it should send the header first.
+		 */
+		private->type |= DOCUMENT_MMAP;
+		_transfer_sndbuf(private);
+		errno = EAGAIN;
+		return ECONTINUE;
+	}
+	if (private->size == 0)
+		return 0;
+
+	if (private->map == NULL || private->offset < (unsigned long long)private->mapoffset ||
+		private->offset >= private->mapoffset + private->mapsize)
+	{
+		int ret = _transfer_mapwindow(private);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+		{
+			private->type |= DOCUMENT_TRANSFER;
+			return mod_send_read(private, response);
+		}
+	}
+
+	size_t size = _transfer_size(private, _transfer_maxsize(config));
+	size_t rest = private->mapoffset + private->mapsize - private->offset;
+	if (size > rest)
+		size = rest;
+	const char *data = (const char *)private->map + (private->offset - private->mapoffset);
+	int ret = httpclient_send(private->ctl, data, size);
+	if (ret < 0 && errno == EWOULDBLOCK)
+		errno = EAGAIN;
+	transfer_dbg("document: send %d/%lu", ret, size);
+	return ret;
+}
+
+void document_transferclose(document_connector_t *private)
+{
+	_transfer_bufferrelease(private->buffer);
+	private->buffer = NULL;
+	if (private->map != NULL)
+		munmap(private->map, private->mapsize);
+	private->map = NULL;
+}
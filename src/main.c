@@ -36,6 +36,10 @@
 #include <libgen.h>
 #include <sched.h>
 #include <dirent.h>
+#include <time.h>
+#ifdef USE_POSIXSPAWN
+#include <spawn.h>
+#endif
 #ifdef BACKTRACE
 #include <execinfo.h> // for backtrace
 #endif
@@ -43,6 +47,7 @@
 #ifndef WIN32
 # include <sys/socket.h>
 # include <sys/types.h>
+# include <sys/wait.h>
 # include <unistd.h>
 # include <fcntl.h>
 # include <pwd.h>
@@ -111,6 +116,161 @@ size_t auth_info2(http_message_t *request, const char *key, const char **value)
 	return httpmessage_SESSION2(request, key, (void **)value);
 }
 
+typedef struct pathfilter_s pathfilter_t;
+struct pathfilter_s
+{
+	http_server_t *server;
+	ouistiti_pathfilter_t filter;
+	void *arg;
+	pathfilter_t *next;
+};
+static pathfilter_t *g_pathfilters = NULL;
+
+int ouistiti_setpathfilter(http_server_t *server, ouistiti_pathfilter_t filter, void *arg)
+{
+	pathfilter_t *pathfilter = calloc(1, sizeof(*pathfilter));
+	if (pathfilter == NULL)
+		return EREJECT;
+	pathfilter->server = server;
+	pathfilter->filter = filter;
+	pathfilter->arg = arg;
+	pathfilter->next = g_pathfilters;
+	g_pathfilters = pathfilter;
+	return ESUCCESS;
+}
+
+void ouistiti_unsetpathfilter(void *arg)
+{
+	pathfilter_t **it = &g_pathfilters;
+	while (*it != NULL)
+	{
+		pathfilter_t *pathfilter = *it;
+		if (pathfilter->arg == arg)
+		{
+			*it = pathfilter->next;
+			free(pathfilter);
+		}
+		else
+			it = &pathfilter->next;
+	}
+}
+
+int ouistiti_checkpath(http_server_t *server, http_message_t *request, const char *method, const char *uri)
+{
+	for (const pathfilter_t *pathfilter = g_pathfilters; pathfilter != NULL; pathfilter = pathfilter->next)
+	{
+		if (pathfilter->server == server &&
+			pathfilter->filter(pathfilter->arg, request, method, uri) != ESUCCESS)
+			return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+typedef struct cachepolicy_s cachepolicy_t;
+struct cachepolicy_s
+{
+	http_server_t *server;
+	ouistiti_cachepolicy_t policy;
+	void *arg;
+	cachepolicy_t *next;
+};
+static cachepolicy_t *g_cachepolicies = NULL;
+
+int ouistiti_setcachepolicy(http_server_t *server, ouistiti_cachepolicy_t policy, void *arg)
+{
+	cachepolicy_t *cachepolicy = calloc(1, sizeof(*cachepolicy));
+	if (cachepolicy == NULL)
+		return EREJECT;
+	cachepolicy->server = server;
+	cachepolicy->policy = policy;
+	cachepolicy->arg = arg;
+	/// the modules are created in the order of the configuration
+	cachepolicy_t **it = &g_cachepolicies;
+	while (*it != NULL)
+		it = &(*it)->next;
+	*it = cachepolicy;
+	return ESUCCESS;
+}
+
+void ouistiti_unsetcachepolicy(void *arg)
+{
+	cachepolicy_t **it = &g_cachepolicies;
+	while (*it != NULL)
+	{
+		cachepolicy_t *cachepolicy = *it;
+		if (cachepolicy->arg == arg)
+		{
+			*it = cachepolicy->next;
+			free(cachepolicy);
+		}
+		else
+			it = &cachepolicy->next;
+	}
+}
+
+const char *ouistiti_cachepolicy(http_server_t *server, http_message_t *request)
+{
+	for (const cachepolicy_t *cachepolicy = g_cachepolicies; cachepolicy != NULL; cachepolicy = cachepolicy->next)
+	{
+		const char *policy = NULL;
+		if (cachepolicy->server == server &&
+			cachepolicy->policy(cachepolicy->arg, request, &policy) == ESUCCESS)
+			return policy;
+	}
+	return NULL;
+}
+
+typedef struct start_s start_t;
+struct start_s
+{
+	http_server_t *server;
+	ouistiti_start_t start;
+	void *arg;
+	start_t *next;
+};
+static start_t *g_starts = NULL;
+
+int ouistiti_setstart(http_server_t *server, ouistiti_start_t start, void *arg)
+{
+	start_t *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL)
+		return EREJECT;
+	entry->server = server;
+	entry->start = start;
+	entry->arg = arg;
+	/// the modules are started in the order of the configuration
+	start_t **it = &g_starts;
+	while (*it != NULL)
+		it = &(*it)->next;
+	*it = entry;
+	return ESUCCESS;
+}
+
+void ouistiti_unsetstart(void *arg)
+{
+	start_t **it = &g_starts;
+	while (*it != NULL)
+	{
+		start_t *entry = *it;
+		if (entry->arg == arg)
+		{
+			*it = entry->next;
+			free(entry);
+		}
+		else
+			it = &entry->next;
+	}
+}
+
+void ouistiti_start(http_server_t *server)
+{
+	for (const start_t *entry = g_starts; entry != NULL; entry = entry->next)
+	{
+		if (entry->server == server)
+			entry->start(entry->arg);
+	}
+}
+
 int auth_setowner(const char *user)
 {
 	int ret = EREJECT;
@@ -141,12 +301,30 @@ int auth_setowner(const char *user)
 
 static module_list_t *g_modules = NULL;
 
-#define MAX_MODULES 16
+typedef struct reload_config_s reload_config_t;
+typedef struct server_reload_s server_reload_t;
+struct server_reload_s
+{
+	server_t *server;
+	http_server_t *vserver;
+	mod_t *modules;
+	/// the clients may be counted by several threads
+	unsigned int nclients;
+	reload_config_t *config;
+
+	server_reload_t *next;
+};
+
 struct server_s
 {
 	serverconfig_t *config;
 	http_server_t *server;
 	mod_t *modules;
+	/**
+	 * module chains loaded on SIGHUP, the first one receives
+	 * the new connections
+	 */
+	server_reload_t *reload;
 
 	struct server_s *next;
 	unsigned int id;
@@ -156,6 +334,22 @@ const char *actions[] = {
 	"start",
 	"stop"
 };
+#ifdef USE_POSIXSPAWN
+static int main_exec(int rootfd,  const char *scriptpath, int stop)
+{
+	char * const argv[3] = { (char *)scriptpath, (char *)actions[stop], NULL };
+	char * const env[1] = { NULL };
+	posix_spawn_file_actions_t fileactions;
+	posix_spawn_file_actions_init(&fileactions);
+	posix_spawn_file_actions_addfchdir_np(&fileactions, rootfd);
+	pid_t pid = -1;
+	int ret = posix_spawn(&pid, scriptpath, &fileactions, NULL, argv, env);
+	posix_spawn_file_actions_destroy(&fileactions);
+	if (ret != 0)
+		err("cgi error: %s", strerror(ret));
+	return pid;
+}
+#else
 static int main_exec(int rootfd,  const char *scriptpath, int stop)
 {
         pid_t pid = fork();
@@ -182,6 +376,7 @@ static int main_exec(int rootfd,  const char *scriptpath, int stop)
 	}
 	return pid;
 }
+#endif
 
 static int main_initat(int rootfd, const char *path, int action)
 {
@@ -260,6 +455,8 @@ void display_help(char * const *argv)
 #undef BACKTRACE
 static server_t *g_first = NULL;
 static char run = 0;
+static char reload = 0;
+static const char *g_configfile = NULL;
 static int g_default_port = 80;
 #ifdef HAVE_SIGACTION
 static void handler(int sig, siginfo_t *UNUSED(si), void *UNUSED(arg))
@@ -268,6 +465,11 @@ static void handler(int sig)
 #endif
 {
 	err("main: signal %d", sig);
+	if (sig == SIGHUP)
+	{
+		reload = 1;
+		return;
+	}
 	if (sig == SIGSEGV)
 	{
 #ifdef BACKTRACE
@@ -306,19 +508,15 @@ int ouistiti_issecure(server_t *server)
 	return !strcmp(secure, "true");
 }
 
-static int ouistiti_loadmodule(server_t *server, const module_t *module, configure_t configure, void *parser)
+static int ouistiti_loadmodule(server_t *server, http_server_t *httpserver, mod_t **modules, const module_t *module, configure_t configure, void *parser)
 {
-	int i = 0;
-	mod_t *mod = server->modules;
+	mod_t *mod = *modules;
 	warn("module %s regitering...", module->name);
-	for (;i < MAX_MODULES && mod != NULL; i++)
+	for (; mod != NULL; mod = mod->next)
 	{
 		if (! strcmp(mod->ops->name, module->name))
 			warn(" already set");
-		mod = mod->next;
 	}
-	if (i == MAX_MODULES)
-		return EREJECT;
 
 	if (module->version & MODULE_VERSION_DEPRECATED)
 	{
@@ -330,7 +528,7 @@ static int ouistiti_loadmodule(server_t *server, const module_t *module, configu
 		warn(" old. Please check");
 	}
 	int ret = ECONTINUE;
-	i = 0;
+	int i = 0;
 	while (ret == ECONTINUE)
 	{
 		void *config = NULL;
@@ -349,7 +547,7 @@ static int ouistiti_loadmodule(server_t *server, const module_t *module, configu
 		// check to case if the configure is deprecated and returns handle
 		if (ret == ECONTINUE || ret == ESUCCESS)
 		{
-			obj = module->create(server->server, config);
+			obj = module->create(httpserver, config);
 		}
 		if (obj)
 		{
@@ -357,18 +555,24 @@ static int ouistiti_loadmodule(server_t *server, const module_t *module, configu
 			dbg("main: %s configurated", module->name);
 			mod->obj = obj;
 			mod->ops = module;
-			mod->next = server->modules;
-			server->modules = mod;
+			mod->next = *modules;
+			*modules = mod;
 		}
 	}
 	return ret;
 }
 
-static int ouistiti_setmodules(server_t *server, configure_t configure, void *parser)
+static int ouistiti_setmodules(server_t *server, http_server_t *httpserver, mod_t **modules, configure_t configure, void *parser)
 {
 	for (const module_list_t *iterator = g_modules; iterator != NULL; iterator = iterator->next)
 	{
-		if (ouistiti_loadmodule(server, iterator->module, configure, parser) == ESUCCESS)
+		/**
+		 * the protocol of the listening socket is set once,
+		 * a module chain loaded on reload must not change it.
+		 */
+		if (httpserver != server->server && !strcmp(iterator->module->name, "tls"))
+			continue;
+		if (ouistiti_loadmodule(server, httpserver, modules, iterator->module, configure, parser) == ESUCCESS)
 		{
 			warn(" done");
 		}
@@ -409,14 +613,29 @@ static void __ouistiti_freemodule()
 	}
 }
 
+static void ouistiti_loadmodules(server_t *server, http_server_t *httpserver, mod_t **modules, serverconfig_t *config)
+{
+	char *cwd = NULL;
+	if (config->root != NULL && config->root[0] != '\0' )
+	{
+		cwd = getcwd(NULL, 0);
+		if (chdir(config->root))
+			err("main: change directory error !");
+	}
+	ouistiti_setmodules(server, httpserver, modules, NULL, config->modulesconfig);
+	if (cwd != NULL)
+	{
+		if (chdir(cwd))
+			err("main: change directory error !");
+		free(cwd);
+	}
+}
+
 static server_t *ouistiti_loadserver(serverconfig_t *config, int id)
 {
 	if (g_first == NULL && id == -1)
 		id = 0;
 
-	if (g_first != NULL && g_first->id == MAX_SERVERS)
-		return NULL;
-
 	if (config->server->port == 0)
 		config->server->port = g_default_port;
 	http_server_t *httpserver = httpserver_create(config->server);
@@ -429,20 +648,7 @@ static server_t *ouistiti_loadserver(serverconfig_t *config, int id)
 	server->server = httpserver;
 	server->config = config;
 	server->id = id;
-	char *cwd = NULL;
-	if (config->root != NULL && config->root[0] != '\0' )
-	{
-		cwd = getcwd(NULL, 0);
-		if (chdir(config->root))
-			err("main: change directory error !");
-	}
-	ouistiti_setmodules(server, NULL, config->modulesconfig);
-	if (cwd != NULL)
-	{
-		if (chdir(cwd))
-			err("main: change directory error !");
-		free(cwd);
-	}
+	ouistiti_loadmodules(server, server->server, &server->modules, config);
 
 	return server;
 }
@@ -452,7 +658,7 @@ static ouistiticonfig_t g_ouistiti_config =
 {
 	.user = "www-data",
 	.init_d = SYSCONFDIR"/init.d",
-	.config = {
+	.config = (serverconfig_t *[]){
 		&(serverconfig_t){
 			.server = &(http_server_config_t){
 				.port = 0,
@@ -463,6 +669,7 @@ static ouistiticonfig_t g_ouistiti_config =
 		},
 		NULL
 	},
+	.nservers = 1,
 };
 
 static void *_config_modules(void *data, const char *name, server_t *server)
@@ -479,22 +686,27 @@ void ouistiticonfig_destroy(ouistiticonfig_t *ouistiticonfig)
 }
 #endif
 
-static int main_run(server_t *first)
+static void ouistiti_freemodules(mod_t *mod)
 {
-	/**
-	 * connection must be after the owner change
-	 */
-	for (const server_t *server = first; server != NULL; server = server->next)
+	while (mod)
 	{
-		httpserver_connect(server->server);
+		mod_t *next = mod->next;
+		dbg("main: destroy %s", mod->ops->name);
+		if (mod->ops->destroy)
+			mod->ops->destroy(mod->obj);
+		free(mod);
+		mod = next;
 	}
+}
 
-	while(run != 'q')
-	{
-		if (first == NULL || first->server == NULL || httpserver_run(first->server) == ESUCCESS)
-			break;
-	}
-	return 0;
+static void main_releaseconfig(reload_config_t *config);
+static void main_freereload(server_reload_t *reload)
+{
+	ouistiti_freemodules(reload->modules);
+	httpserver_destroy(reload->vserver);
+	ouistiti_freeroutes(reload->vserver);
+	main_releaseconfig(reload->config);
+	free(reload);
 }
 
 void main_destroy(server_t *first)
@@ -504,28 +716,355 @@ void main_destroy(server_t *first)
 	for (server_t *server = first; server != NULL; server = next)
 	{
 		next = server->next;
-		mod_t *mod = server->modules;
-		while (mod)
+		server_reload_t *reloadnext = NULL;
+		for (server_reload_t *reload = server->reload; reload != NULL; reload = reloadnext)
 		{
-			mod_t *next = mod->next;
-			dbg("main: destroy %s", mod->ops->name);
-			if (mod->ops->destroy)
-				mod->ops->destroy(mod->obj);
-			free(mod);
-			mod = next;
+			reloadnext = reload->next;
+			main_freereload(reload);
 		}
+		ouistiti_freemodules(server->modules);
 		httpserver_disconnect(server->server);
 		httpserver_destroy(server->server);
+		ouistiti_freeroutes(server->server);
 		free(server);
 	}
 	__ouistiti_freemodule();
 }
 
+/**
+ * The configuration is reloaded on SIGHUP.
+ * The listening sockets are kept, a virtual server is created for each
+ * server with the new module chain. The new connections are moved on it,
+ * the previous chain is freed when all its connections are closed.
+ */
+static const char str_reload[] = "reload";
+
+struct reload_config_s
+{
+	ouistiticonfig_t *config;
+	/// number of module chains loaded with this configuration
+	unsigned int nreloads;
+	reload_config_t *next;
+};
+static reload_config_t *g_reloadconfigs = NULL;
+
+/**
+ * a configuration is freed with the last module chain using it
+ */
+static void main_releaseconfig(reload_config_t *config)
+{
+	if (config == NULL)
+		return;
+	if (config->nreloads > 0 && --config->nreloads > 0)
+		return;
+	for (reload_config_t **it = &g_reloadconfigs; *it != NULL; it = &(*it)->next)
+	{
+		if (*it == config)
+		{
+			*it = config->next;
+			break;
+		}
+	}
+	ouistiticonfig_destroy(config->config);
+	free(config);
+}
+
+static void *_reload_getctx(void *arg, http_client_t *UNUSED(clt), struct sockaddr *UNUSED(addr), int UNUSED(addrsize))
+{
+	server_reload_t *reload = (server_reload_t *)arg;
+	__atomic_add_fetch(&reload->nclients, 1, __ATOMIC_RELAXED);
+	return reload;
+}
+
+static void _reload_freectx(void *arg)
+{
+	server_reload_t *reload = (server_reload_t *)arg;
+	__atomic_sub_fetch(&reload->nclients, 1, __ATOMIC_RELAXED);
+}
+
+static int _reload_connector(void *arg, http_message_t *request, http_message_t *UNUSED(response))
+{
+	server_t *server = (server_t *)arg;
+
+	if (server->reload == NULL)
+		return EREJECT;
+	return httpserver_reloadclient(server->reload->vserver, httpmessage_client(request));
+}
+
+static int main_reloadserver(server_t *server, serverconfig_t *config, reload_config_t *entry)
+{
+	http_server_t *vserver = httpserver_dup(server->server, config->server);
+	if (vserver == NULL)
+		return EREJECT;
+
+	server_reload_t *reload = calloc(1, sizeof(*reload));
+	reload->server = server;
+	reload->vserver = vserver;
+	reload->config = entry;
+	entry->nreloads++;
+	httpserver_addmod(vserver, _reload_getctx, _reload_freectx, reload, str_reload);
+	if (server->reload == NULL)
+		httpserver_addconnector(server->server, _reload_connector, server, CONNECTOR_SERVER, str_reload);
+
+	server->config = config;
+	ouistiti_loadmodules(server, vserver, &reload->modules, config);
+	ouistiti_start(vserver);
+	reload->next = server->reload;
+	server->reload = reload;
+	return ESUCCESS;
+}
+
+static void main_reload(server_t *first)
+{
+	struct timespec start;
+	struct timespec stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ouistiticonfig_t *ouistiticonfig = ouistiticonfig_create(g_configfile);
+	if (ouistiticonfig == NULL)
+	{
+		err("main: configuration reload error, keep the current one");
+		return;
+	}
+	reload_config_t *entry = calloc(1, sizeof(*entry));
+	entry->config = ouistiticonfig;
+	entry->next = g_reloadconfigs;
+	g_reloadconfigs = entry;
+	for (server_t *server = first; server != NULL; server = server->next)
+	{
+		serverconfig_t *config = NULL;
+		for (int i = 0; i < ouistiticonfig->nservers && config == NULL; i++)
+		{
+			serverconfig_t *it = ouistiticonfig->config[i];
+			if (it == NULL)
+				continue;
+			if (it->server->port == 0)
+				it->server->port = g_default_port;
+			if (it->server->port == server->config->server->port)
+				config = it;
+		}
+		if (config == NULL)
+		{
+			warn("main: server %d not found into the new configuration", server->id);
+			warn("main: listening sockets change needs to restart");
+			continue;
+		}
+		if (main_reloadserver(server, config, entry) != ESUCCESS)
+			err("main: server %d reload error", server->id);
+	}
+	/// the configuration is not used by any server
+	if (entry->nreloads == 0)
+		main_releaseconfig(entry);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	long duration = (stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_nsec - start.tv_nsec) / 1000000;
+	warn("main: configuration reloaded in %ld ms", duration);
+}
+
+/**
+ * free the previous module chains without connection
+ */
+static void main_reapreload(server_t *first)
+{
+	for (server_t *server = first; server != NULL; server = server->next)
+	{
+		if (server->reload == NULL)
+			continue;
+		server_reload_t *previous = server->reload;
+		server_reload_t *reload = previous->next;
+		while (reload != NULL)
+		{
+			server_reload_t *next = reload->next;
+			if (__atomic_load_n(&reload->nclients, __ATOMIC_RELAXED) == 0)
+			{
+				dbg("main: server %d previous configuration freed", server->id);
+				previous->next = next;
+				main_freereload(reload);
+			}
+			else
+				previous = reload;
+			reload = next;
+		}
+	}
+}
+
+static void main_freereloadconfigs(void)
+{
+	reload_config_t *next = NULL;
+	for (reload_config_t *entry = g_reloadconfigs; entry != NULL; entry = next)
+	{
+		next = entry->next;
+		ouistiticonfig_destroy(entry->config);
+		free(entry);
+	}
+	g_reloadconfigs = NULL;
+}
+
+static void main_setaffinity(const char *cpuaffinity, int id)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu = -1;
+
+	if (ncpus < 1)
+		return;
+	if (!strcmp(cpuaffinity, "auto"))
+		cpu = id % ncpus;
+	else
+	{
+		/**
+		 * cpuaffinity is a list of cpu numbers separated by comas.
+		 * The workers are distributed on the list.
+		 */
+		int ncpulist = 0;
+		const char *it = cpuaffinity;
+		while (it != NULL && *it != '\0')
+		{
+			ncpulist++;
+			it = strchr(it, ',');
+			if (it != NULL)
+				it++;
+		}
+		if (ncpulist == 0)
+			return;
+		it = cpuaffinity;
+		for (int i = 0; i < (id % ncpulist); i++)
+			it = strchr(it, ',') + 1;
+		cpu = strtol(it, NULL, 10);
+	}
+	if (cpu < 0 || cpu >= ncpus)
+	{
+		warn("main: worker %d cpu %d not available", id, cpu);
+		return;
+	}
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0)
+		warn("main: worker %d affinity error %s", id, strerror(errno));
+	else
+		dbg("main: worker %d runs on cpu %d", id, cpu);
+}
+
+static void main_loop(server_t *first)
+{
+	while(run != 'q')
+	{
+		if (reload)
+		{
+			reload = 0;
+			main_reload(first);
+		}
+		main_reapreload(first);
+		if (first == NULL || first->server == NULL || httpserver_run(first->server) == ESUCCESS)
+			break;
+	}
+}
+
+static pid_t main_worker(server_t *first, const ouistiticonfig_t *config, int id)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		if (config->cpuaffinity != NULL)
+			main_setaffinity(config->cpuaffinity, id);
+		main_loop(first);
+		main_destroy(first);
+		exit(0);
+	}
+	else if (pid == -1)
+		err("main: worker %d fork error %s", id, strerror(errno));
+	else
+		warn("main: worker %d started (%d)", id, pid);
+	return pid;
+}
+
+/**
+ * The workers share the listening sockets of the servers.
+ * The master process only supervises them: a worker which crashes
+ * is restarted, the termination signal is forwarded to all of them.
+ */
+static void main_workers(server_t *first, const ouistiticonfig_t *config)
+{
+	int nworkers = config->workers;
+	pid_t *workers = calloc(nworkers, sizeof(*workers));
+
+	for (int i = 0; i < nworkers; i++)
+		workers[i] = main_worker(first, config, i);
+
+	while (run != 'q')
+	{
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid == -1 && errno == EINTR && reload)
+		{
+			reload = 0;
+			for (int i = 0; i < nworkers; i++)
+			{
+				if (workers[i] > 0)
+					kill(workers[i], SIGHUP);
+			}
+			continue;
+		}
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (int i = 0; i < nworkers; i++)
+		{
+			if (workers[i] != pid)
+				continue;
+			workers[i] = 0;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			{
+				warn("main: worker %d exited", i);
+			}
+			else if (run != 'q')
+			{
+				err("main: worker %d died, restart it", i);
+				workers[i] = main_worker(first, config, i);
+			}
+		}
+	}
+
+	for (int i = 0; i < nworkers; i++)
+	{
+		if (workers[i] > 0)
+			kill(workers[i], SIGTERM);
+	}
+	for (int i = 0; i < nworkers; i++)
+	{
+		if (workers[i] > 0)
+			waitpid(workers[i], NULL, 0);
+	}
+	free(workers);
+}
+
+static int main_run(server_t *first, const ouistiticonfig_t *config)
+{
+	/**
+	 * connection must be after the owner change
+	 */
+	for (const server_t *server = first; server != NULL; server = server->next)
+	{
+		ouistiti_start(server->server);
+		httpserver_connect(server->server);
+	}
+
+	if (config->workers > 1)
+		main_workers(first, config);
+	else
+		main_loop(first);
+	return 0;
+}
+
 static server_t *ouistiti_loadservers(ouistiticonfig_t *ouistiticonfig, int serverid)
 {
 	server_t *first = NULL;
 	int id = 0;
-	for (int i = 0; i < MAX_SERVERS; i++)
+	for (int i = 0; i < ouistiticonfig->nservers; i++)
 	{
 		if (serverid != -1 && i != serverid)
 			continue;
@@ -665,6 +1204,7 @@ int main(int argc, char * const *argv)
 		return -1;
 	}
 
+	g_configfile = configfile;
 	g_first = ouistiti_loadservers(ouistiticonfig, serverid);
 
 #ifdef HAVE_SIGACTION
@@ -674,18 +1214,24 @@ int main(int argc, char * const *argv)
 	action.sa_sigaction = handler;
 	sigaction(SIGTERM, &action, NULL);
 	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGHUP, &action, NULL);
 #ifdef BACKTRACE
 	sigaction(SIGSEGV, &action, NULL);
 #endif
 
-#if 0
+	/**
+	 * a closed connection must not stop the server,
+	 * the writings return EPIPE
+	 */
 	struct sigaction unaction;
+	unaction.sa_flags = 0;
+	sigemptyset(&unaction.sa_mask);
 	unaction.sa_handler = SIG_IGN;
-#endif
-	sigaction(SIGPIPE, &action, NULL);
+	sigaction(SIGPIPE, &unaction, NULL);
 #else
 	signal(SIGTERM, handler);
 	signal(SIGINT, handler);
+	signal(SIGHUP, handler);
 #ifdef BACKTRACE
 	signal(SIGSEGV, handler);
 #endif
@@ -698,10 +1244,11 @@ int main(int argc, char * const *argv)
 	else
 		warn("%s run as %s", argv[0], ouistiticonfig->user);
 
-	main_run(g_first);
+	main_run(g_first, ouistiticonfig);
 
 	killdaemon(pidfile);
 	main_destroy(g_first);
+	main_freereloadconfigs();
 	if (ouistiticonfig->init_d != NULL)
 	{
 		int rootfd = AT_FDCWD;
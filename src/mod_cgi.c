@@ -42,6 +42,10 @@
 #include <libgen.h>
 #include <netinet/in.h>
 #include <sched.h>
+#include "../compliant.h"
+#ifdef USE_POSIXSPAWN
+#include <spawn.h>
+#endif
 
 #ifdef FILE_CONFIG
 #include <libconfig.h>
@@ -90,6 +94,9 @@ struct mod_cgi_ctx_s
 	pid_t pid;
 	int tocgi[2];
 	int fromcgi[2];
+#ifdef CGI_POOL
+	cgi_worker_t *worker;
+#endif
 
 	char *chunk;
 };
@@ -99,6 +106,9 @@ struct _mod_cgi_s
 	http_server_t *server;
 	mod_cgi_config_t *config;
 	int rootfd;
+#ifdef CGI_POOL
+	cgi_pool_t *pool;
+#endif
 };
 
 #ifdef FILE_CONFIG
@@ -150,8 +160,16 @@ static void *mod_cgi_create(http_server_t *server, mod_cgi_config_t *modconfig)
 	mod->rootfd = rootfd;
 	mod->config = modconfig;
 	mod->server = server;
+#ifdef CGI_POOL
+	mod->pool = cgipool_create(modconfig, rootfd);
+#endif
 
-	httpserver_addconnector(server, _cgi_connector, mod, CONNECTOR_DOCUMENT, str_cgi);
+	char *prefixes = NULL;
+	char *extensions = NULL;
+	htaccess_route(&modconfig->htaccess, &prefixes, &extensions);
+	ouistiti_setroute(server, _cgi_connector, mod, CONNECTOR_DOCUMENT, str_cgi, prefixes, extensions);
+	free(prefixes);
+	free(extensions);
 
 	return mod;
 }
@@ -159,16 +177,25 @@ static void *mod_cgi_create(http_server_t *server, mod_cgi_config_t *modconfig)
 static void mod_cgi_destroy(void *arg)
 {
 	_mod_cgi_t *mod = (_mod_cgi_t *)arg;
-	// nothing to do
+#ifdef CGI_POOL
+	cgipool_destroy(mod->pool);
+#endif
 	close(mod->rootfd);
 	if (mod->config->env)
 		free(mod->config->env);
+	if (mod->config->staticenv)
+		free(mod->config->staticenv);
+	htaccess_free(&mod->config->htaccess);
 	free(mod->config);
 	free(mod);
 }
 
 static void _cgi_freectx(mod_cgi_ctx_t *ctx)
 {
+#ifdef CGI_POOL
+	if (ctx->worker)
+		cgipool_release(ctx->worker);
+#endif
 	if (ctx->chunk)
 		free(ctx->chunk);
 	if (ctx->fromcgi[0])
@@ -178,6 +205,61 @@ static void _cgi_freectx(mod_cgi_ctx_t *ctx)
 	free(ctx);
 }
 
+#ifdef USE_POSIXSPAWN
+/**
+ * posix_spawn runs the script with vfork or clone(CLONE_VM), the
+ * memory of the server is not copied and the time to start the
+ * script doesn't grow with the size of the server.
+ * The environment is built before inside the server.
+ */
+static int _mod_cgi_fork(mod_cgi_ctx_t *ctx, http_message_t *request)
+{
+	_mod_cgi_t *mod = ctx->mod;
+	const mod_cgi_config_t *config = mod->config;
+
+	/* the pipes are not shared with the other children */
+	if (pipe2(ctx->tocgi, O_CLOEXEC) < 0)
+		return EREJECT;
+	if (pipe2(ctx->fromcgi, O_CLOEXEC) < 0)
+	{
+		close(ctx->tocgi[0]);
+		close(ctx->tocgi[1]);
+		ctx->tocgi[1] = -1;
+		return EREJECT;
+	}
+
+	char * const argv[2] = { (char *)ctx->cgi_path.data, NULL };
+	char **env = NULL;
+	env = cgi_buildenv(config, request, ctx->cgi_path.data, ctx->cgi_path.length, ctx->path_info.data, ctx->path_info.length);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addclose(&actions, httpclient_socket(httpmessage_client(request)));
+	/* dup2 removes the CLOEXEC flag on stdin and stdout */
+	posix_spawn_file_actions_adddup2(&actions, ctx->tocgi[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, ctx->fromcgi[1], STDOUT_FILENO);
+	/**
+	 * cgipath is relative to docroot, the script runs inside docroot
+	 */
+	posix_spawn_file_actions_addfchdir_np(&actions, mod->rootfd);
+
+	pid_t pid = -1;
+	int ret = posix_spawn(&pid, ctx->cgi_path.data, &actions, NULL, argv, env);
+	posix_spawn_file_actions_destroy(&actions);
+	free(env);
+
+	/* keep only input of the pipe */
+	close(ctx->tocgi[0]);
+	/* keep only output of the pipe */
+	close(ctx->fromcgi[1]);
+	if (ret != 0)
+	{
+		err("cgi error: %s", strerror(ret));
+		return EREJECT;
+	}
+	return pid;
+}
+#else
 static int _mod_cgi_fork(mod_cgi_ctx_t *ctx, http_message_t *request)
 {
 	_mod_cgi_t *mod = ctx->mod;
@@ -185,8 +267,13 @@ static int _mod_cgi_fork(mod_cgi_ctx_t *ctx, http_message_t *request)
 
 	if (pipe(ctx->tocgi) < 0)
 		return EREJECT;
-	if (pipe(ctx->fromcgi))
+	if (pipe(ctx->fromcgi) < 0)
+	{
+		close(ctx->tocgi[0]);
+		close(ctx->tocgi[1]);
+		ctx->tocgi[1] = -1;
 		return EREJECT;
+	}
 	pid_t pid = fork();
 	if (pid)
 	{
@@ -194,16 +281,6 @@ static int _mod_cgi_fork(mod_cgi_ctx_t *ctx, http_message_t *request)
 		close(ctx->tocgi[0]);
 		/* keep only output of the pipe */
 		close(ctx->fromcgi[1]);
-#ifdef DEBUG
-		char **envs = NULL;
-		envs = cgi_buildenv(config, request, ctx->cgi_path.data, ctx->cgi_path.length, ctx->path_info.data, ctx->path_info.length);
-		char *env = *envs++;
-		while (env != NULL)
-		{
-			free(env);
-			env = *envs++;
-		}
-#endif
 	}
 	else /* into child */
 	{
@@ -249,6 +326,33 @@ static int _mod_cgi_fork(mod_cgi_ctx_t *ctx, http_message_t *request)
 	}
 	return pid;
 }
+#endif
+
+#ifdef CGI_POOL
+
+/**
+ * the environment is sent to the worker, the script is already running
+ */
+static cgi_worker_t *_mod_cgi_pool(mod_cgi_ctx_t *ctx, http_message_t *request)
+{
+	_mod_cgi_t *mod = ctx->mod;
+	const mod_cgi_config_t *config = mod->config;
+
+	cgi_worker_t *worker = cgipool_acquire(mod->pool, config, ctx->cgi_path.data);
+	if (worker == NULL)
+		return NULL;
+	char **envs = cgi_buildenv(config, request, ctx->cgi_path.data, ctx->cgi_path.length, ctx->path_info.data, ctx->path_info.length);
+	int ret = cgipool_begin(worker, envs);
+	free(envs);
+	if (ret != ESUCCESS)
+	{
+		err("cgi: worker %s error %s", ctx->cgi_path.data, strerror(errno));
+		cgipool_release(worker);
+		return NULL;
+	}
+	return worker;
+}
+#endif
 
 static int _cgi_changestate(mod_cgi_ctx_t *ctx, int state)
 {
@@ -337,6 +441,10 @@ static int _cgi_start(_mod_cgi_t *mod, http_message_t *request, http_message_t *
 
 		dbg("cgi: run %s", uri);
 		ctx->mod = mod;
+#ifdef CGI_POOL
+		ctx->worker = _mod_cgi_pool(ctx, request);
+		if (ctx->worker == NULL)
+#endif
 		ctx->pid = _mod_cgi_fork(ctx, request);
 		ctx->state = STATE_INSTART;
 		ctx->chunk = malloc(config->chunksize + 1);
@@ -364,15 +472,22 @@ static int _cgi_request(mod_cgi_ctx_t *ctx, http_message_t *request)
 		length += inputlen;
 		cgi_dbg("cgi: %lu/%lu input %s", length, rest, input);
 #endif
-		fd_set wfds;
-		FD_ZERO(&wfds);
-		FD_SET(ctx->tocgi[1], &wfds);
-
-		ret = select(ctx->tocgi[1] + 1, NULL, &wfds, NULL, &mod->config->timeout);
-		if (ret == 1)
-			len = write(ctx->tocgi[1], input, inputlen);
+#ifdef CGI_POOL
+		if (ctx->worker != NULL)
+			len = (cgipool_write(ctx->worker, input, inputlen) == ESUCCESS)? inputlen: 0;
 		else
-			len = 0;
+#endif
+		{
+			fd_set wfds;
+			FD_ZERO(&wfds);
+			FD_SET(ctx->tocgi[1], &wfds);
+
+			ret = select(ctx->tocgi[1] + 1, NULL, &wfds, NULL, &mod->config->timeout);
+			if (ret == 1)
+				len = write(ctx->tocgi[1], input, inputlen);
+			else
+				len = 0;
+		}
 		cgi_dbg("cgi: wrote %d %d", len, inputlen);
 		if (inputlen != len)
 		{
@@ -411,55 +526,67 @@ static int _cgi_parseresponse(mod_cgi_ctx_t *ctx, http_message_t *response, char
 	return ret;
 }
 
+/**
+ * return the length of the output of the CGI,
+ * -1 with ETIMEDOUT if nothing is available.
+ */
+static int _cgi_read(mod_cgi_ctx_t *ctx, char *data, int size)
+{
+#ifdef CGI_POOL
+	if (ctx->worker != NULL)
+		return cgipool_read(ctx->worker, data, size);
+#endif
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(ctx->fromcgi[0], &rfds);
+	int sret = select(ctx->fromcgi[0] + 1, &rfds, NULL, NULL, &ctx->mod->config->timeout);
+	if (sret > 0 && FD_ISSET(ctx->fromcgi[0], &rfds))
+		return read(ctx->fromcgi[0], data, size);
+	errno = ETIMEDOUT;
+	return -1;
+}
+
 static int _cgi_response(mod_cgi_ctx_t *ctx, http_message_t *response)
 {
 	_mod_cgi_t *mod = ctx->mod;
 	const mod_cgi_config_t *config = mod->config;
 	int ret = ECONTINUE;
-	int sret;
-	fd_set rfds;
 
-	FD_ZERO(&rfds);
-	FD_SET(ctx->fromcgi[0], &rfds);
-	sret = select(ctx->fromcgi[0] + 1, &rfds, NULL, NULL, &mod->config->timeout);
-	if (sret > 0 && FD_ISSET(ctx->fromcgi[0], &rfds))
-	{
-		int size = config->chunksize;
-		size = read(ctx->fromcgi[0], ctx->chunk, size);
-		if (size < 0)
-		{
-			err("cgi: read %s", strerror(errno));
-			_cgi_changestate(ctx, STATE_OUTFINISH);
-		}
-		else if (size < 1)
-		{
-			dbg("cgi: died");
-			_cgi_changestate(ctx, STATE_OUTFINISH);
-		}
-		else
-		{
-			ctx->chunk[size] = 0;
-			cgi_dbg("cgi: receive (%d)\n%s", size, ctx->chunk);
-			/**
-			 * if content_length is not null, parcgi is able to
-			 * create the content.
-			 * But the cgi know the length at the end, is too late
-			 * to set the header.
-			 */
-			int rest = size;
-			if (rest > 0)
-			{
-				ret = _cgi_parseresponse(ctx, response, ctx->chunk, rest);
-			}
-		}
-	}
-	else
+	int size = _cgi_read(ctx, ctx->chunk, config->chunksize);
+	if (size < 0 && errno == ETIMEDOUT)
 	{
 		_cgi_changestate(ctx, STATE_OUTFINISH);
-		kill(ctx->pid, SIGTERM);
+		if (ctx->pid > 0)
+			kill(ctx->pid, SIGTERM);
 		dbg("cgi: complete");
 		ret = ECONTINUE;
 	}
+	else if (size < 0)
+	{
+		err("cgi: read %s", strerror(errno));
+		_cgi_changestate(ctx, STATE_OUTFINISH);
+	}
+	else if (size < 1)
+	{
+		dbg("cgi: died");
+		_cgi_changestate(ctx, STATE_OUTFINISH);
+	}
+	else
+	{
+		ctx->chunk[size] = 0;
+		cgi_dbg("cgi: receive (%d)\n%s", size, ctx->chunk);
+		/**
+		 * if content_length is not null, parcgi is able to
+		 * create the content.
+		 * But the cgi know the length at the end, is too late
+		 * to set the header.
+		 */
+		int rest = size;
+		if (rest > 0)
+		{
+			ret = _cgi_parseresponse(ctx, response, ctx->chunk, rest);
+		}
+	}
 	return ret;
 }
 static int _cgi_connector(void *arg, http_message_t *request, http_message_t *response)
@@ -481,7 +608,11 @@ static int _cgi_connector(void *arg, http_message_t *request, http_message_t *re
 	{
 
 		int instate = (ctx->state & STATE_INMASK);
-		if (ctx->tocgi[1] > 0 && instate >= STATE_INSTART && instate < STATE_INFINISH)
+		int input = (ctx->tocgi[1] > 0);
+#ifdef CGI_POOL
+		input = input || (ctx->worker != NULL);
+#endif
+		if (input && instate >= STATE_INSTART && instate < STATE_INFINISH)
 		{
 			_cgi_request(ctx, request);
 			/**
@@ -490,6 +621,10 @@ static int _cgi_connector(void *arg, http_message_t *request, http_message_t *re
 		}
 		else if (instate == STATE_INFINISH)
 		{
+#ifdef CGI_POOL
+			if (ctx->worker != NULL)
+				cgipool_write(ctx->worker, NULL, 0);
+#endif
 			if (ctx->tocgi[1] > 0)
 				close(ctx->tocgi[1]);
 			ctx->tocgi[1] = -1;
@@ -500,7 +635,13 @@ static int _cgi_connector(void *arg, http_message_t *request, http_message_t *re
 		 * otherwise the client will wait more data from request
 		 */
 		int outstate = (ctx->state & STATE_OUTMASK);
-		if (outstate >= STATE_OUTSTART && outstate < STATE_CONTENTCOMPLETE)
+		int output = 1;
+#ifdef CGI_POOL
+		/// the FastCGI application answers after the end of the content
+		if (ctx->worker != NULL && (ctx->state & STATE_INMASK) != STATE_INMASK)
+			output = 0;
+#endif
+		if (output && outstate >= STATE_OUTSTART && outstate < STATE_CONTENTCOMPLETE)
 		{
 			do
 			{
@@ -520,7 +661,9 @@ static int _cgi_connector(void *arg, http_message_t *request, http_message_t *re
 		}
 		else if (outstate == STATE_OUTFINISH)
 		{
-			close(ctx->fromcgi[0]);
+			if (ctx->fromcgi[0] > 0)
+				close(ctx->fromcgi[0]);
+			ctx->fromcgi[0] = 0;
 			if (instate == STATE_INMASK)
 				ctx->state = STATE_END;
 			ret = ECONTINUE;
@@ -53,14 +53,39 @@ typedef struct mod_cgi_config_s
 	mod_cgi_config_script_t *scripts;
 	const char **env;
 	int nbenvs;
+	char **staticenv;
+	int nbstaticenv;
 	int chunksize;
 	struct timeval timeout;
 	int options;
+	const char *pool;
+	int poolmin;
+	int poolmax;
+	int poolrequests;
+	int poolidle;
 } mod_cgi_config_t;
 
 extern const module_t mod_cgi;
 
+/**
+ * the environment is allocated in one block, it is freed with free()
+ */
 char **cgi_buildenv(const mod_cgi_config_t *config, http_message_t *request, const char *cgi_path, size_t cgi_pathlen, const char *path_info, size_t path_infolen);
+#ifdef CGI_POOL
+#define DEFAULT_POOLMIN 1
+#define DEFAULT_POOLMAX 4
+#define DEFAULT_POOLREQUESTS 1000
+#define DEFAULT_POOLIDLE 60
+typedef struct cgi_pool_s cgi_pool_t;
+typedef struct cgi_worker_s cgi_worker_t;
+cgi_pool_t *cgipool_create(const mod_cgi_config_t *config, int rootfd);
+cgi_worker_t *cgipool_acquire(cgi_pool_t *pool, const mod_cgi_config_t *config, const char *script);
+int cgipool_begin(cgi_worker_t *worker, char **env);
+int cgipool_write(cgi_worker_t *worker, const char *data, size_t length);
+int cgipool_read(cgi_worker_t *worker, char *data, size_t size);
+void cgipool_release(cgi_worker_t *worker);
+void cgipool_destroy(cgi_pool_t *pool);
+#endif
 #ifdef FILE_CONFIG
 typedef int (*cgi_configscript_t)(config_setting_t *setting, mod_cgi_config_t *python);
 int cgienv_config(config_setting_t *configserver, config_setting_t *config, server_t *server, mod_cgi_config_t **modconfig, cgi_configscript_t configscript);
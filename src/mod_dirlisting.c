@@ -36,6 +36,11 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/syscall.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "ouistiti/httpserver.h"
 #include "ouistiti/utils.h"
@@ -69,6 +74,29 @@ typedef struct _document_connector_s document_connector_t;
 \"result\":\"%s\"\
 }\n"
 
+/**
+ * the entries are read block by block and serialized into the
+ * output buffer, the buffer is sent when it is full.
+ */
+#define DIRLISTING_DENTSSIZE (32 * 1024)
+#define DIRLISTING_OUTPUTSIZE (32 * 1024)
+#define DIRLISTING_LINEMAX (MAX_NAMELENGTH + 256)
+/**
+ * the room for the size of the chunk before the data
+ */
+#define DIRLISTING_CHUNKHEADER 10
+#define DIRLISTING_CHUNKTRAILER (sizeof("\r\n0\r\n\r\n") - 1)
+
+/**
+ * the listings are kept while the modification time of the directory
+ * doesn't change. The sizes of the files are not part of the
+ * modification of the directory, the listing is rebuilt after
+ * DIRLISTING_CACHETIME seconds.
+ */
+#define DIRLISTING_CACHEENTRIES 8
+#define DIRLISTING_CACHEMAXSIZE (4 * 1024 * 1024)
+#define DIRLISTING_CACHETIME 2
+
 #ifdef DIRLISTING_MOD
 static const char str_dirlisting[] = "dirlisting";
 #endif
@@ -81,154 +109,522 @@ static const char *_sizeunit[] = {
 	"TB",
 };
 
-static int _dirlisting_connectorheader(document_connector_t *private, http_message_t *request, http_message_t *response)
+struct dirlisting_dirent64
 {
-	int ret = EREJECT;
-	const char *url = private->url;
-	int fdroot = private->fdroot;
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
 
-	if (url[0] == '\0')
-		url = ".";
-	dbg("dirlisting: open /%s", private->url);
-	ret = scandirat(fdroot, url, &private->ents, NULL, alphasort);
-	if (ret >= 0)
+/**
+ * The listings are kept by the process. With VTHREAD_TYPE=pthread
+ * (threadpool) or without VTHREAD, all the clients share them. With
+ * VTHREAD_TYPE=fork, each client process has its own cache, only the
+ * pages requested on the same connection (keep-alive) use it.
+ */
+typedef struct dirlisting_cache_s dirlisting_cache_t;
+struct dirlisting_cache_s
+{
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	time_t created;
+	char *data;
+	size_t length;
+	size_t size;
+	/// the offset of each entry into data
+	size_t *lines;
+	unsigned long nblines;
+	unsigned long maxlines;
+	int refs;
+	dirlisting_cache_t *next;
+};
+
+struct document_listing_s
+{
+	int fddir;
+	int chunked;
+	int finish;
+	int end;
+	unsigned long offset;
+	unsigned long limit;
+	unsigned long index;
+	dirlisting_cache_t *cache;
+	dirlisting_cache_t *build;
+	char *dents;
+	int dentslength;
+	int dentsoffset;
+	char *output;
+	size_t outputlength;
+	size_t sendoffset;
+	size_t sendlength;
+};
+
+static dirlisting_cache_t *g_listingcache = NULL;
+#ifdef USE_PTHREAD
+static pthread_mutex_t g_listingmutex = PTHREAD_MUTEX_INITIALIZER;
+#define LISTING_LOCK() pthread_mutex_lock(&g_listingmutex)
+#define LISTING_UNLOCK() pthread_mutex_unlock(&g_listingmutex)
+#else
+#define LISTING_LOCK()
+#define LISTING_UNLOCK()
+#endif
+
+static void _listingcache_free(dirlisting_cache_t *cache)
+{
+	free(cache->data);
+	free(cache->lines);
+	free(cache);
+}
+
+static void _listingcache_release(dirlisting_cache_t *cache)
+{
+	if (cache == NULL)
+		return;
+	LISTING_LOCK();
+	cache->refs--;
+	int refs = cache->refs;
+	LISTING_UNLOCK();
+	if (refs == 0)
+		_listingcache_free(cache);
+}
+
+static dirlisting_cache_t *_listingcache_get(const struct stat *dirstat)
+{
+	dirlisting_cache_t *cache = NULL;
+	time_t now = time(NULL);
+	LISTING_LOCK();
+	for (cache = g_listingcache; cache != NULL; cache = cache->next)
 	{
-		private->nbents = ret;
+		if (cache->dev == dirstat->st_dev && cache->ino == dirstat->st_ino)
+			break;
+	}
+	if (cache != NULL &&
+		(cache->mtime.tv_sec != dirstat->st_mtim.tv_sec ||
+		cache->mtime.tv_nsec != dirstat->st_mtim.tv_nsec ||
+		now - cache->created >= DIRLISTING_CACHETIME))
+		cache = NULL;
+	if (cache != NULL)
+		cache->refs++;
+	LISTING_UNLOCK();
+	return cache;
+}
 
-		/**
-		 * The content-length of dirlisting is unknown.
-		 * Set the content-type first without content-length.
-		 */
-		httpmessage_addcontent(response, utils_getmime(".json"), NULL, -1);
-		if (!strcmp(httpmessage_REQUEST(request, "method"), "HEAD"))
+/**
+ * the new listing replaces the previous one of the same directory,
+ * the oldest listing is removed if the cache is full.
+ */
+static void _listingcache_insert(dirlisting_cache_t *cache)
+{
+	dirlisting_cache_t *removed = NULL;
+	int length = 0;
+	cache->created = time(NULL);
+	LISTING_LOCK();
+	/// one reference for the cache, one for the current request
+	cache->refs = 2;
+	cache->next = g_listingcache;
+	g_listingcache = cache;
+	for (dirlisting_cache_t **it = &cache->next; *it != NULL;)
+	{
+		dirlisting_cache_t *entry = *it;
+		length++;
+		if ((entry->dev == cache->dev && entry->ino == cache->ino) ||
+			length >= DIRLISTING_CACHEENTRIES)
 		{
-			for (int i = 0; i < ret; i++)
-				free(private->ents[i]);
-			free(private->ents);
-			private->ents = NULL;
-			private->nbents = 0;
-			document_close(private, request);
-			ret = ESUCCESS;
+			*it = entry->next;
+			entry->refs--;
+			if (entry->refs == 0)
+			{
+				entry->next = removed;
+				removed = entry;
+			}
+			continue;
 		}
-		else
+		it = &entry->next;
+	}
+	LISTING_UNLOCK();
+	while (removed != NULL)
+	{
+		dirlisting_cache_t *next = removed->next;
+		_listingcache_free(removed);
+		removed = next;
+	}
+}
+
+static int _listingcache_append(dirlisting_cache_t *cache, const char *line, size_t length)
+{
+	if (cache->length + length > DIRLISTING_CACHEMAXSIZE)
+		return EREJECT;
+	if (cache->nblines == cache->maxlines)
+	{
+		unsigned long maxlines = (cache->maxlines > 0)? cache->maxlines * 2: 256;
+		size_t *lines = realloc(cache->lines, maxlines * sizeof(*lines));
+		if (lines == NULL)
+			return EREJECT;
+		cache->lines = lines;
+		cache->maxlines = maxlines;
+	}
+	if (cache->length + length > cache->size)
+	{
+		size_t size = (cache->length + length) * 2;
+		if (size < DIRLISTING_OUTPUTSIZE)
+			size = DIRLISTING_OUTPUTSIZE;
+		char *data = realloc(cache->data, size);
+		if (data == NULL)
+			return EREJECT;
+		cache->data = data;
+		cache->size = size;
+	}
+	cache->lines[cache->nblines++] = cache->length;
+	memcpy(cache->data + cache->length, line, length);
+	cache->length += length;
+	return ESUCCESS;
+}
+
+void document_listingclose(document_connector_t *private)
+{
+	document_listing_t *listing = private->listing;
+	if (listing == NULL)
+		return;
+	if (listing->fddir > 0)
+		close(listing->fddir);
+	_listingcache_release(listing->cache);
+	if (listing->build != NULL)
+		_listingcache_free(listing->build);
+	free(listing->dents);
+	free(listing->output);
+	free(listing);
+	private->listing = NULL;
+}
+
+static void _dirlisting_addcontent(document_connector_t *private, http_message_t *response,
+		const char *data, size_t length, int finish)
+{
+#ifdef DOCUMENTDEFLATE
+	if (private->deflate != NULL)
+	{
+		document_deflatecontent(private, response, data, length, finish);
+		return;
+	}
+#endif
+	httpmessage_addcontent(response, NULL, data, length);
+}
+
+/**
+ * "?offset=100&limit=50" returns the entries 100 to 149
+ */
+static void _dirlisting_pagination(document_listing_t *listing, http_message_t *request)
+{
+	const char *query = httpmessage_REQUEST(request, "query");
+	listing->limit = (unsigned long)-1;
+	if (query == NULL)
+		return;
+	const char *value = strstr(query, "offset=");
+	if (value != NULL)
+		listing->offset = strtoul(value + 7, NULL, 10);
+	value = strstr(query, "limit=");
+	if (value != NULL)
+		listing->limit = strtoul(value + 6, NULL, 10);
+}
+
+static int _dirlisting_connectorheader(document_connector_t *private, http_message_t *request, http_message_t *response)
+{
+	dbg("dirlisting: open /%s", private->url);
+	document_listing_t *listing = calloc(1, sizeof(*listing));
+	if (listing == NULL)
+		goto error;
+	private->listing = listing;
+	/// the directory may be shared by the cache, the offset of the listing is its own
+	listing->fddir = openat(private->fdfile, ".", O_RDONLY | O_DIRECTORY);
+	struct stat dirstat;
+	if (listing->fddir == -1 || fstat(listing->fddir, &dirstat) == -1)
+		goto error;
+
+	/**
+	 * The content-length of dirlisting is unknown.
+	 * Set the content-type first without content-length.
+	 * HTTP/1.1 sends the content by chunks and keeps the connection.
+	 */
+	httpmessage_addcontent(response, utils_getmime(".json"), NULL, -1);
+	if (!strcmp(httpmessage_REQUEST(request, "method"), "HEAD"))
+	{
+		document_close(private, request);
+		return ESUCCESS;
+	}
+#ifdef DOCUMENTDEFLATE
+	if (document_deflateaccept(private->mod->config, request, utils_getmime(".json")) == ESUCCESS)
+		document_deflatestart(private, response);
+	if (private->deflate == NULL)
+#endif
+	{
+		const char *protocol = httpmessage_REQUEST(request, "protocol");
+		listing->chunked = (protocol != NULL && !strcmp(protocol, "HTTP/1.1"));
+	}
+	if (listing->chunked)
+		httpmessage_addheader(response, "Transfer-Encoding", STRING_REF("chunked"));
+	_dirlisting_pagination(listing, request);
+
+	listing->output = malloc(DIRLISTING_OUTPUTSIZE);
+	if (listing->output == NULL)
+		goto error;
+	listing->cache = _listingcache_get(&dirstat);
+	if (listing->cache == NULL)
+	{
+		listing->dents = malloc(DIRLISTING_DENTSSIZE);
+		listing->build = calloc(1, sizeof(*listing->build));
+		if (listing->dents == NULL)
+			goto error;
+		if (listing->build != NULL)
 		{
-			const char *uri = NULL;
-			size_t urilen = httpmessage_REQUEST2(request,"uri", &uri);
-			char *data = calloc(1, DIRLISTING_HEADER_LENGTH + urilen + 1);
-			urilen = snprintf(data, DIRLISTING_HEADER_LENGTH + urilen, DIRLISTING_HEADER, uri);
-			httpmessage_appendcontent(response, data, urilen);
-			free(data);
-			ret = ECONTINUE;
+			listing->build->dev = dirstat.st_dev;
+			listing->build->ino = dirstat.st_ino;
+			listing->build->mtime = dirstat.st_mtim;
 		}
 	}
-	else
+	const char *uri = NULL;
+	httpmessage_REQUEST2(request,"uri", &uri);
+	listing->outputlength = DIRLISTING_CHUNKHEADER;
+	listing->outputlength += snprintf(listing->output + listing->outputlength,
+			DIRLISTING_OUTPUTSIZE - listing->outputlength - DIRLISTING_CHUNKTRAILER,
+			DIRLISTING_HEADER, uri);
+	return ECONTINUE;
+
+error:
+	warn("dirlisting: directory not open %s %s", private->url, strerror(errno));
+	document_close(private, request);
+	httpmessage_result(response, RESULT_400);
+	return ESUCCESS;
+}
+
+static size_t _dirlisting_line(document_listing_t *listing, const char *name, char *data, size_t length)
+{
+	if (strlen(name) > MAX_NAMELENGTH)
 	{
-		private->ents = NULL;
-		private->nbents = 0;
-		warn("dirlisting: directory not open %s %s", private->url, strerror(errno));
-		document_close(private, request);
-		httpmessage_result(response, RESULT_400);
+		warn("dirlisting: %s file name length too long", name);
+	}
+	unsigned long size = 0;
+	unsigned int mode = 0;
+#ifdef STATX_TYPE
+	struct statx filestat;
+	if (statx(listing->fddir, name, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &filestat) == -1)
+	{
+		err("dirlisting: %s stat error %s", name, strerror(errno));
+		return 0;
+	}
+	size = filestat.stx_size;
+	mode = filestat.stx_mode;
+#else
+	struct stat filestat;
+	if (fstatat(listing->fddir, name, &filestat, 0) == -1)
+	{
+		err("dirlisting: %s stat error %s", name, strerror(errno));
+		return 0;
+	}
+	size = filestat.st_size;
+	mode = filestat.st_mode;
+#endif
+	int unit = 0;
+	while (size > 2000)
+	{
+		size /= 1024;
+		unit++;
 	}
+	const char *mime = "inode/directory";
 
+	if (S_ISREG(mode) || S_ISLNK(mode))
+	{
+		utils_getmime2(name, &mime);
+	}
+	int ret = snprintf(data, length, DIRLISTING_LINE, MAX_NAMELENGTH, name, size, _sizeunit[unit],
+			((mode & S_IFMT) >> 12), mime);
+	if (ret < 0 || (size_t)ret >= length)
+		return 0;
 	return ret;
 }
 
-static int _dirlisting_getentity(document_connector_t *private, struct dirent *ent, http_message_t *response)
+/**
+ * the next entry of the directory, the hidden files are not listed.
+ * return the length of the entry into data, 0 at the end of the directory.
+ */
+static int _dirlisting_next(document_listing_t *listing, char *data, size_t length)
 {
-	int ret = EREJECT;
-	if (ent == NULL)
-		return EREJECT;
-	document_dbg("dirlisting: dirlisting contains %s", ent->d_name);
-	if (ent->d_name[0] != '.')
+	while (1)
 	{
-		unsigned int length = strlen(ent->d_name);
-		if (length > MAX_NAMELENGTH)
+		if (listing->dentsoffset >= listing->dentslength)
 		{
-			warn("dirlisting: %s file name length too long", ent->d_name);
+			listing->dentslength = syscall(SYS_getdents64, listing->fddir, listing->dents, DIRLISTING_DENTSSIZE);
+			listing->dentsoffset = 0;
+			if (listing->dentslength < 0)
+				err("dirlisting: read directory error %s", strerror(errno));
+			if (listing->dentslength <= 0)
+				return 0;
 		}
-		struct stat filestat;
-		fstatat(private->fdfile, ent->d_name, &filestat, 0);
-		size_t size = filestat.st_size;
-		if (size == -1)
+		struct dirlisting_dirent64 *ent = (struct dirlisting_dirent64 *)(listing->dents + listing->dentsoffset);
+		listing->dentsoffset += ent->d_reclen;
+		document_dbg("dirlisting: dirlisting contains %s", ent->d_name);
+		if (ent->d_name[0] == '.')
+			continue;
+		size_t ret = _dirlisting_line(listing, ent->d_name, data, length);
+		if (ret > 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * the entries of the page are copied from the cache into the output buffer
+ */
+static void _dirlisting_fillcache(document_listing_t *listing, size_t room)
+{
+	dirlisting_cache_t *cache = listing->cache;
+	unsigned long last = cache->nblines;
+	if (listing->offset < last && listing->limit < last - listing->offset)
+		last = listing->offset + listing->limit;
+	if (listing->index < listing->offset)
+		listing->index = listing->offset;
+
+	/// the lines are copied entirely
+	unsigned long index = listing->index;
+	if (index < last)
+	{
+		size_t start = cache->lines[index];
+		size_t end = start;
+		while (index < last)
 		{
-			err("dirlisting: %s stat error %s", ent->d_name, strerror(errno));
-			return EREJECT;
+			size_t next = (index + 1 < cache->nblines)? cache->lines[index + 1]: cache->length;
+			if (next - start > room)
+				break;
+			end = next;
+			index++;
+		}
+		memcpy(listing->output + listing->outputlength, cache->data + start, end - start);
+		listing->outputlength += end - start;
+		listing->index = index;
+	}
+	if (index >= last)
+		listing->finish = 1;
+}
+
+static void _dirlisting_filldir(document_listing_t *listing, size_t room)
+{
+	while (room >= DIRLISTING_LINEMAX)
+	{
+		char *data = listing->output + listing->outputlength;
+		int length = _dirlisting_next(listing, data, room);
+		if (length == 0)
+		{
+			listing->finish = 1;
+			if (listing->build != NULL)
+			{
+				_listingcache_insert(listing->build);
+				listing->cache = listing->build;
+				listing->build = NULL;
+			}
+			break;
 		}
-		int unit = 0;
-		while (size > 2000)
+		if (listing->build != NULL && _listingcache_append(listing->build, data, length) != ESUCCESS)
 		{
-			size /= 1024;
-			unit++;
+			_listingcache_free(listing->build);
+			listing->build = NULL;
 		}
-		const char *mime = "inode/directory";
-		size_t mimelen = 15;
-
-		if (S_ISREG(filestat.st_mode) || S_ISLNK(filestat.st_mode))
+		if (listing->index >= listing->offset && listing->index - listing->offset < listing->limit)
+		{
+			listing->outputlength += length;
+			room -= length;
+		}
+		else if (listing->index >= listing->offset && listing->build == NULL)
 		{
-			mimelen = utils_getmime2(ent->d_name, &mime);
+			/// the end of the page without the building of the cache
+			listing->finish = 1;
+			break;
 		}
-		length += mimelen;
-		length += 4 + 2 + 4;
-		char *data = calloc(1, DIRLISTING_LINE_LENGTH + length + 1);
-		length = snprintf(data, DIRLISTING_LINE_LENGTH + length + 1, DIRLISTING_LINE, MAX_NAMELENGTH, ent->d_name, size, _sizeunit[unit], ((filestat.st_mode & S_IFMT) >> 12), mime);
-		document_dbg("dirlisting: %s", data);
-		httpmessage_addcontent(response, NULL, data, length);
-		document_dbg("dirlisting: next");
-		free(data);
-		ret = ECONTINUE;
+		listing->index++;
 	}
-	free(ent);
-	return ret;
 }
 
-static int _dirlisting_connectorcontent(document_connector_t *private, http_message_t *request, http_message_t *response)
+/**
+ * the output buffer is sent by chunk or given to the response
+ */
+static int _dirlisting_flush(document_connector_t *private, http_message_t *response)
 {
-	int ret = EREJECT;
-	struct dirent *ent;
-
-	errno = 0;
-	while (ret == EREJECT)
+	document_listing_t *listing = private->listing;
+	if (listing->sendlength == 0)
 	{
-		document_dbg("dirlisting: entry %d", private->nbents);
-		/**
-		 * private->ents != NULL checked inside _dirlisting_connector
-		 */
-		if (private->nbents > 0)
+		size_t length = listing->outputlength - DIRLISTING_CHUNKHEADER;
+		if (listing->finish)
 		{
-			ent = private->ents[private->nbents - 1];
-			private->nbents--;
+			length += snprintf(listing->output + listing->outputlength,
+					DIRLISTING_OUTPUTSIZE - listing->outputlength, DIRLISTING_FOOTER, "OK");
 		}
-		else
-			ent = NULL;
-		if (ent)
+		if (!listing->chunked)
 		{
-			ret = _dirlisting_getentity(private, ent, response);
+			_dirlisting_addcontent(private, response, listing->output + DIRLISTING_CHUNKHEADER,
+					length, listing->finish);
+			listing->outputlength = DIRLISTING_CHUNKHEADER;
+			return ESUCCESS;
 		}
-		else
+		char header[DIRLISTING_CHUNKHEADER + 1];
+		int headerlength = snprintf(header, sizeof(header), "%zx\r\n", length);
+		listing->sendoffset = DIRLISTING_CHUNKHEADER - headerlength;
+		memcpy(listing->output + listing->sendoffset, header, headerlength);
+		listing->sendlength = headerlength + length;
+		memcpy(listing->output + listing->sendoffset + listing->sendlength, "\r\n", 2);
+		listing->sendlength += 2;
+		if (listing->finish)
 		{
-			int length = sizeof(DIRLISTING_FOOTER);
-			char *data = calloc(1, length);
-			length = snprintf(data, length, DIRLISTING_FOOTER, "OK");
-			httpmessage_addcontent(response, NULL, data, length);
-			free(data);
-			close(private->fdfile);
-			private->fdfile = 0;
-			ret = ECONTINUE;
+			memcpy(listing->output + listing->sendoffset + listing->sendlength, "0\r\n\r\n", 5);
+			listing->sendlength += 5;
 		}
 	}
-	return ret;
+	int ret = httpclient_send(private->ctl, listing->output + listing->sendoffset, listing->sendlength);
+	if (ret < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK)? ECONTINUE: EREJECT;
+	listing->sendoffset += ret;
+	listing->sendlength -= ret;
+	if (listing->sendlength > 0)
+		return ECONTINUE;
+	listing->outputlength = DIRLISTING_CHUNKHEADER;
+	return ESUCCESS;
+}
+
+static int _dirlisting_connectorcontent(document_connector_t *private, http_message_t *request, http_message_t *response)
+{
+	document_listing_t *listing = private->listing;
+
+	if (listing->sendlength == 0 && !listing->finish)
+	{
+		/// the footer and the chunk trailer are kept at the end of the buffer
+		size_t room = DIRLISTING_OUTPUTSIZE - listing->outputlength - sizeof(DIRLISTING_FOOTER) - 4 - DIRLISTING_CHUNKTRAILER;
+		if (listing->cache != NULL)
+			_dirlisting_fillcache(listing, room);
+		else
+			_dirlisting_filldir(listing, room);
+	}
+	int ret = _dirlisting_flush(private, response);
+	if (ret == EREJECT)
+	{
+		err("dirlisting: send %s %s", private->url, strerror(errno));
+		document_close(private, request);
+		return EREJECT;
+	}
+	if (ret == ESUCCESS && listing->finish)
+		listing->end = 1;
+	return ECONTINUE;
 }
 
 static int _dirlisting_connectorender(document_connector_t *private, http_message_t *request, http_message_t *response)
 {
-	/**
-	 * the content length is unknown before the sending.
-	 * We must close the socket to advertise the client.
-	 */
-	document_dbg("dirlisting: socket shutdown");
-	httpclient_shutdown(httpmessage_client(request));
-	free(private->ents);
-	private->ents = NULL;
+	if (!private->listing->chunked)
+	{
+		/**
+		 * the content length is unknown before the sending.
+		 * We must close the socket to advertise the client.
+		 */
+		document_dbg("dirlisting: socket shutdown");
+		httpclient_shutdown(httpmessage_client(request));
+	}
 	document_close(private, request);
 	return ESUCCESS;
 }
@@ -241,11 +637,11 @@ int dirlisting_connector(void *arg, http_message_t *request, http_message_t *res
 	int ret = EREJECT;
 	document_connector_t *private = httpmessage_private(request, NULL);
 
-	if (private->ents == NULL)
+	if (private->listing == NULL)
 	{
 		ret = _dirlisting_connectorheader(private, request, response);
 	}
-	else if (private->fdfile > 0)
+	else if (!private->listing->end)
 	{
 		ret = _dirlisting_connectorcontent(private, request, response);
 	}
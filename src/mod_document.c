@@ -26,9 +26,11 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *****************************************************************************/
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -58,9 +60,9 @@
 /**
  * transfer function for getfile_connector
  */
-static int mod_send_read(document_connector_t *private, http_message_t *response);
 #ifdef SENDFILE
 extern int mod_send_sendfile(document_connector_t *private, http_message_t *response);
+extern int mod_sendfile_ktls(http_client_t *ctl);
 #endif
 static int _mime_connector(void *arg, http_message_t *request, http_message_t *response);
 
@@ -76,12 +78,35 @@ int mod_send(document_connector_t *private, http_message_t *response);
 
 void document_close(document_connector_t *private, http_message_t *request)
 {
+#ifdef DOCUMENTREST
+	/// the incomplete upload is removed from the directory
+	document_uploadclose(private);
+	document_batchclose(private);
+#endif
+#ifdef DOCUMENTCACHE
+	if (private->cacheentry != NULL)
+		document_cacherelease(private->mod->cache, private->cacheentry);
+	else
+#endif
 	if (private->fdfile > 0)
 		close(private->fdfile);
 	private->fdfile = 0;
 	if (private->fdroot > 0)
 		close(private->fdroot);
 	private->fdroot = 0;
+	document_transferclose(private);
+#ifdef DOCUMENTDEFLATE
+	document_deflateclose(private);
+#endif
+#ifdef RANGEREQUEST
+	document_rangeclose(private);
+#endif
+#ifdef DIRLISTING
+	document_listingclose(private);
+#endif
+#ifdef DOCUMENTARCHIVE
+	document_archiveclose(private);
+#endif
 	private->func = NULL;
 	httpmessage_private(request, NULL);
 	free(private);
@@ -147,6 +172,161 @@ static int _document_getdefaultpage(_mod_document_mod_t *mod, int fdroot, const
 	return fdfile;
 }
 
+/**
+ * the precompressed files are stored beside the original file,
+ * the first one accepted by the client is sent.
+ */
+typedef struct document_encoding_s
+{
+	int flag;
+	const char *extension;
+	const char *name;
+} document_encoding_t;
+
+static const document_encoding_t g_encodings[] =
+{
+	{ DOCUMENT_ENCODING_BR, ".br", "br"},
+	{ DOCUMENT_ENCODING_GZIP, ".gz", "gzip"},
+	{ 0, NULL, NULL},
+};
+
+int document_encodings(int fdroot, const char *url)
+{
+	int encodings = 0;
+	for (const document_encoding_t *encoding = g_encodings; encoding->flag != 0; encoding++)
+	{
+		char path[PATH_MAX];
+		struct stat filestat;
+		if (snprintf(path, sizeof(path), "%s%s", url, encoding->extension) < (int)sizeof(path) &&
+			fstatat(fdroot, path, &filestat, 0) == 0 && S_ISREG(filestat.st_mode))
+			encodings |= encoding->flag;
+	}
+	return encodings;
+}
+
+int document_acceptencoding(http_message_t *request)
+{
+	int encodings = 0;
+	const char *accept = httpmessage_REQUEST(request, "Accept-Encoding");
+	while (accept != NULL && accept[0] != '\0')
+	{
+		while (accept[0] == ' ' || accept[0] == ',') accept++;
+		size_t length = strcspn(accept, ",; ");
+		const char *end = accept + strcspn(accept, ",");
+		/// "q=0" refuses the encoding
+		const char *quality = strstr(accept, "q=");
+		int refused = (quality != NULL && quality < end && strtod(quality + 2, NULL) == 0);
+		for (const document_encoding_t *encoding = g_encodings; encoding->flag != 0; encoding++)
+		{
+			if (!refused && strlen(encoding->name) == length && !strncmp(accept, encoding->name, length))
+				encodings |= encoding->flag;
+		}
+		accept = end;
+	}
+	return encodings;
+}
+
+static const document_encoding_t *_document_encoding(http_message_t *request, http_message_t *response,
+		int encodings)
+{
+	if (encodings == 0)
+		return NULL;
+	httpmessage_addheader(response, "Vary", STRING_REF("Accept-Encoding"));
+	encodings &= document_acceptencoding(request);
+	for (const document_encoding_t *encoding = g_encodings; encoding->flag != 0; encoding++)
+	{
+		if (encodings & encoding->flag)
+			return encoding;
+	}
+	return NULL;
+}
+
+static int _document_openencoded(int fdroot, const char *url,
+		http_message_t *request, http_message_t *response)
+{
+	const document_encoding_t *encoding = _document_encoding(request, response,
+			document_encodings(fdroot, url));
+	if (encoding == NULL)
+		return -1;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s%s", url, encoding->extension);
+	int fdfile = openat(fdroot, path, O_RDONLY);
+	if (fdfile != -1)
+		httpmessage_addheader(response, "Content-Encoding", encoding->name, -1);
+	return fdfile;
+}
+
+void document_validators(const struct stat *filestat, const char *suffix,
+		char *etag, size_t etaglen, char *lastmodified, size_t lastmodifiedlen)
+{
+	if (suffix == NULL)
+		suffix = "";
+	snprintf(etag, etaglen, "\"%lx-%lx-%lx%s\"",
+			(unsigned long)filestat->st_ino, (unsigned long)filestat->st_size,
+			(unsigned long)filestat->st_mtim.tv_sec, suffix);
+	struct tm tm;
+	gmtime_r(&filestat->st_mtim.tv_sec, &tm);
+	strftime(lastmodified, lastmodifiedlen, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+#ifdef RESULT_304
+/**
+ * If-None-Match has the precedence over If-Modified-Since (RFC 7232)
+ */
+static int _document_notmodified(http_message_t *request, const char *etag, time_t mtime)
+{
+	const char *match = httpmessage_REQUEST(request, "If-None-Match");
+	if (match != NULL && match[0] != '\0')
+		return (strchr(match, '*') != NULL || strstr(match, etag) != NULL);
+	const char *since = httpmessage_REQUEST(request, "If-Modified-Since");
+	if (since != NULL && since[0] != '\0')
+	{
+		struct tm tm = {0};
+		if (strptime(since, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+			return 0;
+		return (mtime <= timegm(&tm));
+	}
+	return 0;
+}
+#endif
+
+/**
+ * the validators are sent with the content and with the 304 response.
+ * return ESUCCESS if the client already has the content.
+ */
+static int _document_validate(http_message_t *request, http_message_t *response,
+		const char *etag, const char *lastmodified, time_t mtime)
+{
+	httpmessage_addheader(response, "ETag", etag, -1);
+	httpmessage_addheader(response, "Last-Modified", lastmodified, -1);
+#ifdef RESULT_304
+	if (_document_notmodified(request, etag, mtime))
+	{
+		document_dbg("document: not modified %s", etag);
+		httpmessage_result(response, RESULT_304);
+		return ESUCCESS;
+	}
+#endif
+	return EREJECT;
+}
+
+/**
+ * the first document which accepts the URI answers to the request,
+ * the server module sends the policy of its docroot.
+ */
+static int _document_cachepolicy(void *arg, http_message_t *request, const char **policy)
+{
+	const _mod_document_mod_t *mod = (const _mod_document_mod_t *)arg;
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (htaccess_check(&mod->config->htaccess, uri, NULL) == EREJECT)
+		return EREJECT;
+	/// the responses of the Rest commands are not cached
+	const char *method = httpmessage_REQUEST(request, "method");
+	if (!strcmp(method, str_get) || !strcmp(method, str_head))
+		*policy = mod->config->cachecontrol;
+	return ESUCCESS;
+}
+
 static int _document_getconnnectorget(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
@@ -179,6 +359,13 @@ static int _document_getconnnectorget(_mod_document_mod_t *mod,
 			*connector = dirlisting_connector;
 		}
 		else
+#endif
+#ifdef DOCUMENTARCHIVE
+		if (document_archiveaccept(config, request) == ESUCCESS)
+		{
+			*connector = archive_connector;
+		}
+		else
 #endif
 		if (config->defaultpage != NULL)
 		{
@@ -206,8 +393,15 @@ static int _document_getconnnectorget(_mod_document_mod_t *mod,
 	else
 	{
 		*connector = getfile_connector;
-		fdfile = openat(fdroot, url, O_RDONLY);
 		*mime = utils_getmime(url);
+		if (config->options & DOCUMENT_PRECOMPRESSED)
+			fdfile = _document_openencoded(fdroot, url, request, response);
+#ifdef DOCUMENTDEFLATE
+		if (fdfile == -1 && document_deflateaccept(config, request, *mime) == ESUCCESS)
+			*connector = deflatefile_connector;
+#endif
+		if (fdfile == -1)
+			fdfile = openat(fdroot, url, O_RDONLY);
 	}
 	return fdfile;
 }
@@ -223,6 +417,292 @@ static int _document_getconnnectorheader(_mod_document_mod_t *mod,
 	return fdfile;
 }
 
+static document_connector_t *_document_setprivate(_mod_document_mod_t *mod,
+		http_message_t *request, http_message_t *response,
+		int fdfile, int fdroot, const char *uri, const char *mime,
+		http_connector_t connector, const struct stat *filestat, int type)
+{
+	const mod_document_t *config = mod->config;
+
+	if (S_ISDIR(filestat->st_mode))
+	{
+		type |= DOCUMENT_DIRLISTING;
+	}
+
+	document_connector_t *private = calloc(1, sizeof(*private));
+	httpmessage_private(request, private);
+
+	mod_transfer_t transfer = mod_send_read;
+	if (config->options & DOCUMENT_MMAP)
+	{
+		transfer = mod_send_mmap;
+	}
+#ifdef SENDFILE
+	/**
+	 * on TLS, sendfile is available only if the kernel encrypts
+	 * the connection (kTLS), otherwise the file is read or mapped
+	 */
+	if ((config->options & DOCUMENT_SENDFILE) &&
+		(!(config->options & DOCUMENT_TLS) || mod_sendfile_ktls(httpmessage_client(request))))
+	{
+		transfer = mod_send_sendfile;
+	}
+#endif
+	private->transfer = transfer;
+	private->mod = mod;
+	private->ctl = httpmessage_client(request);
+	private->fdfile = fdfile;
+	private->fdroot = fdroot;
+	private->url = uri;
+	private->mime = mime;
+	private->func = connector;
+	private->size = filestat->st_size;
+	private->offset = 0;
+	private->type = type;
+#ifdef DOCUMENTDEFLATE
+	if (connector == deflatefile_connector && document_deflatestart(private, response) == ESUCCESS)
+		private->transfer = mod_send_deflate;
+	else if (connector == deflatefile_connector)
+		private->func = getfile_connector;
+#endif
+#ifdef DEBUG
+	clock_gettime(CLOCK_REALTIME, &private->start);
+	private->datasize = private->size;
+#endif
+	return private;
+}
+
+#ifdef DOCUMENTCACHE
+/**
+ * the content is sent directly after the header, in one write
+ */
+static int mod_send_memory(document_connector_t *private, http_message_t *response)
+{
+	if (!(private->type & DOCUMENT_CACHE))
+	{
+		/**
+		 * the first loop must not send content
+		 * it should send the header first.
+		 */
+		private->type |= DOCUMENT_CACHE;
+		errno = EAGAIN;
+		return ECONTINUE;
+	}
+	int ret = httpclient_send(private->ctl, private->data + private->offset, private->size);
+	if (ret < 0 && errno == EWOULDBLOCK)
+		errno = EAGAIN;
+	return ret;
+}
+
+static void _document_setcached(document_connector_t *private, document_cacheentry_t *entry,
+		http_message_t *response)
+{
+	private->cacheentry = entry;
+	if (entry == NULL)
+		return;
+	if (!(private->type & DOCUMENT_DEFLATE))
+		private->data = document_cachedata(entry);
+	if (private->data != NULL)
+		private->transfer = mod_send_memory;
+}
+
+/**
+ * the precompressed files are kept inside the cache as the other files,
+ * the original entry knows which ones exist.
+ */
+static document_cacheentry_t *_document_getencoded(_mod_document_mod_t *mod, document_cacheentry_t *entry,
+		const char *uri, http_message_t *request, http_message_t *response)
+{
+	const document_encoding_t *encoding = _document_encoding(request, response,
+			document_cacheencodings(entry));
+	if (encoding == NULL)
+		return NULL;
+	char path[PATH_MAX];
+	int pathlen = snprintf(path, sizeof(path), "%s%s", uri, encoding->extension);
+	if (pathlen >= (int)sizeof(path))
+		return NULL;
+	document_cacheentry_t *encoded = document_cacheget(mod->cache, mod->fdroot, path, pathlen);
+	if (encoded == NULL)
+	{
+		int fdfile = openat(mod->fdroot, path, O_RDONLY);
+		struct stat filestat;
+		if (fdfile == -1)
+			return NULL;
+		if (fstat(fdfile, &filestat) == -1 ||
+			(encoded = document_cacheadd(mod->cache, mod->fdroot, path, pathlen,
+					fdfile, &filestat, utils_getmime(path))) == NULL)
+		{
+			close(fdfile);
+			/// another request may have added it meanwhile
+			encoded = document_cacheget(mod->cache, mod->fdroot, path, pathlen);
+		}
+		if (encoded == NULL)
+			return NULL;
+	}
+	httpmessage_addheader(response, "Content-Encoding", encoding->name, -1);
+	return encoded;
+}
+
+/**
+ * the descriptor of a precompressed file is cached with the path of this
+ * file, and the original file is added too: the next requests find it
+ * and then the precompressed file with _document_getencoded.
+ */
+static document_cacheentry_t *_document_cacheadd(_mod_document_mod_t *mod, const char *uri, size_t urilen,
+		int fdfile, const struct stat *filestat, const char *mime)
+{
+	document_cacheentry_t *entry = document_cacheadd(mod->cache, mod->fdroot, uri, urilen,
+				fdfile, filestat, mime);
+	if (entry != NULL || !(mod->config->options & DOCUMENT_PRECOMPRESSED))
+		return entry;
+	for (const document_encoding_t *encoding = g_encodings; encoding->flag != 0; encoding++)
+	{
+		char path[PATH_MAX];
+		int pathlen = snprintf(path, sizeof(path), "%s%s", uri, encoding->extension);
+		if (pathlen >= (int)sizeof(path))
+			continue;
+		entry = document_cacheadd(mod->cache, mod->fdroot, path, pathlen,
+					fdfile, filestat, utils_getmime(path));
+		if (entry == NULL)
+			continue;
+		int fdorig = openat(mod->fdroot, uri, O_RDONLY);
+		if (fdorig == -1)
+			break;
+		struct stat origstat;
+		document_cacheentry_t *orig = NULL;
+		if (fstat(fdorig, &origstat) == 0)
+			orig = document_cacheadd(mod->cache, mod->fdroot, uri, urilen, fdorig, &origstat, mime);
+		/// only the cache keeps the original file
+		if (orig != NULL)
+			document_cacherelease(mod->cache, orig);
+		else
+			close(fdorig);
+		break;
+	}
+	return entry;
+}
+
+/**
+ * the file is already opened by a previous request
+ */
+static int _document_getcached(_mod_document_mod_t *mod, document_cacheentry_t *entry,
+		const char *uri, const char *method, http_message_t *request, http_message_t *response)
+{
+	const struct stat *filestat = NULL;
+	const char *mime = NULL;
+	int fdfile = document_cachefd(entry, &filestat, &mime);
+	document_cacheentry_t *encoded = NULL;
+	if (mod->config->options & DOCUMENT_PRECOMPRESSED)
+	{
+		/// the precompressed file keeps the mime of the original file
+		encoded = _document_getencoded(mod, entry, uri, request, response);
+		if (encoded != NULL)
+		{
+			document_cacherelease(mod->cache, entry);
+			entry = encoded;
+			fdfile = document_cachefd(entry, &filestat, NULL);
+		}
+	}
+	http_connector_t connector = NULL;
+	if (!strcmp(method, str_get))
+		connector = getfile_connector;
+#ifdef DOCUMENTDEFLATE
+	const char *deflated = NULL;
+	size_t deflatedsize = 0;
+	if (connector != NULL && encoded == NULL &&
+		document_deflateaccept(mod->config, request, mime) == ESUCCESS)
+	{
+		/// the small files are compressed once into the cache
+		deflated = document_cachedeflate(mod->cache, entry, mod->config->deflatelevel, &deflatedsize);
+		if (deflated == NULL)
+			connector = deflatefile_connector;
+		else
+			document_deflateheaders(response);
+	}
+#endif
+
+	const char *etag = NULL;
+	const char *lastmodified = NULL;
+	document_cachevalidators(entry, &etag, &lastmodified);
+#ifdef DOCUMENTDEFLATE
+	/// the compressed content is another representation of the file
+	char deflatedetag[48];
+	if (deflated != NULL || connector == deflatefile_connector)
+	{
+		char unused[32];
+		document_validators(filestat, "-gzip", deflatedetag, sizeof(deflatedetag), unused, sizeof(unused));
+		etag = deflatedetag;
+	}
+#endif
+	if (_document_validate(request, response, etag, lastmodified, filestat->st_mtim.tv_sec) == ESUCCESS)
+	{
+		document_cacherelease(mod->cache, entry);
+		return ESUCCESS;
+	}
+
+	document_dbg("document: cached %s", uri);
+	document_connector_t *private = _document_setprivate(mod, request, response,
+				fdfile, 0, uri, mime, connector, filestat, 0);
+#ifdef DOCUMENTDEFLATE
+	if (deflated != NULL)
+	{
+		private->type |= DOCUMENT_DEFLATE;
+		private->data = deflated;
+		private->size = deflatedsize;
+	}
+#endif
+	_document_setcached(private, entry, response);
+	return EREJECT;
+}
+#endif
+
+/**
+ * the errors of the request are 4xx, the errors of the server are 5xx.
+ */
+static void _document_errorresult(http_message_t *response, int error)
+{
+	switch (error)
+	{
+#if defined RESULT_403
+	case EACCES:
+	case EPERM:
+		httpmessage_result(response, RESULT_403);
+	break;
+#endif
+#if defined RESULT_409
+	case EBUSY:
+	case EEXIST:
+	case ENOTEMPTY:
+		httpmessage_result(response, RESULT_409);
+	break;
+#endif
+#if defined RESULT_404
+	case ENOENT:
+		httpmessage_result(response, RESULT_404);
+	break;
+#endif
+	case EINVAL:
+	case EISDIR:
+	case ENOTDIR:
+	case ENAMETOOLONG:
+	case ELOOP:
+		httpmessage_result(response, RESULT_400);
+	break;
+#if defined RESULT_507
+	case ENOSPC:
+	case EDQUOT:
+		httpmessage_result(response, RESULT_507);
+	break;
+#endif
+	default:
+#if defined RESULT_500
+		httpmessage_result(response, RESULT_500);
+#else
+		httpmessage_result(response, RESULT_400);
+#endif
+	}
+}
+
 static int _document_connector(void *arg, http_message_t *request, http_message_t *response)
 {
 	document_connector_t *private = httpmessage_private(request, NULL);
@@ -268,6 +748,17 @@ static int _document_connector(void *arg, http_message_t *request, http_message_
 		httpmessage_result(response, RESULT_404);
 		return  ESUCCESS;
 	}
+	const char *method = httpmessage_REQUEST(request, "method");
+#ifdef DOCUMENTCACHE
+	int usecache = (mod->cache != NULL && fdroot == mod->fdroot &&
+			(!strcmp(method, str_get) || !strcmp(method, str_head)));
+	if (usecache)
+	{
+		document_cacheentry_t *entry = document_cacheget(mod->cache, fdroot, uri, urilen);
+		if (entry != NULL)
+			return _document_getcached(mod, entry, uri, method, request, response);
+	}
+#endif
 	/// without dup otherwise two successive requests fail (test049)
 	fdroot = dup(fdroot);
 
@@ -275,12 +766,13 @@ static int _document_connector(void *arg, http_message_t *request, http_message_
 	const char *mime = NULL;
 
 	int type = 0;
-	const char *method = httpmessage_REQUEST(request, "method");
 #ifdef DOCUMENTREST
-	if ((config->options & DOCUMENT_REST) && !strcmp(method, str_put))
+	char *tmpname = NULL;
+	if ((config->options & DOCUMENT_REST) &&
+		(!strcmp(method, str_put) || !strcmp(method, str_patch)))
 	{
 		fdfile = _document_getconnnectorput(mod, fdroot, uri, urilen,
-					&mime, request, response, &connector);
+					&mime, request, response, &connector, &tmpname);
 		type |= DOCUMENT_REST;
 	}
 	else if ((config->options & DOCUMENT_REST) && !strcmp(method, str_post))
@@ -295,6 +787,13 @@ static int _document_connector(void *arg, http_message_t *request, http_message_
 					&mime, request, response, &connector);
 		type |= DOCUMENT_REST;
 	}
+	else if ((config->options & DOCUMENT_REST) && !strcmp(method, str_head) &&
+		_document_getconnnectorupload(mod, fdroot, uri, urilen,
+					&mime, request, response, &connector) == 0)
+	{
+		fdfile = 0;
+		type |= DOCUMENT_REST;
+	}
 	else
 #endif
 	if (!strcmp(method, str_get))
@@ -315,29 +814,7 @@ static int _document_connector(void *arg, http_message_t *request, http_message_
 	if (fdfile == 0)
 	{
 		if (errno > 0)
-		{
-			switch (errno)
-			{
-#if defined RESULT_403
-			case EACCES:
-				httpmessage_result(response, RESULT_403);
-			break;
-#endif
-#if defined RESULT_409
-			case EBUSY:
-			case EEXIST:
-				httpmessage_result(response, RESULT_409);
-			break;
-#endif
-#if defined RESULT_404
-			case ENOENT:
-				httpmessage_result(response, RESULT_404);
-			break;
-#endif
-			default:
-				httpmessage_result(response, RESULT_400);
-			}
-		}
+			_document_errorresult(response, errno);
 		close(fdroot);
 		return  ESUCCESS;
 	}
@@ -351,60 +828,60 @@ static int _document_connector(void *arg, http_message_t *request, http_message_
 	if (fstat(fdfile, &filestat) == -1)
 	{
 		err("document: spurious error on fstat %s", strerror(errno));
+#ifdef DOCUMENTREST
+		if (tmpname != NULL)
+			unlinkat(fdroot, tmpname, 0);
+		free(tmpname);
+#endif
 		close(fdroot);
 		close(fdfile);
 		return -1;
 	}
 	document_dbg("document: open %s", uri);
 
-#ifdef RANGEREQUEST
-	if (config->options & DOCUMENT_RANGE)
+	if (S_ISREG(filestat.st_mode) && !(type & DOCUMENT_REST))
 	{
-		char range[20];
-		int rangelen = snprintf(range, sizeof(range), "bytes %.9ld/*", (long)filestat.st_size);
-		httpmessage_addheader(response, "Content-Range", range, rangelen);
-	}
+		char etag[48];
+		char lastmodified[32];
+		document_validators(&filestat, NULL, etag, sizeof(etag), lastmodified, sizeof(lastmodified));
+#ifdef DOCUMENTDEFLATE
+		if (connector == deflatefile_connector)
+			document_validators(&filestat, "-gzip", etag, sizeof(etag), lastmodified, sizeof(lastmodified));
 #endif
-
-	if (S_ISDIR(filestat.st_mode))
-	{
-		type |= DOCUMENT_DIRLISTING;
+		if (_document_validate(request, response, etag, lastmodified, filestat.st_mtim.tv_sec) == ESUCCESS)
+		{
+			close(fdfile);
+			close(fdroot);
+			return ESUCCESS;
+		}
 	}
 
-	private = calloc(1, sizeof(*private));
-	httpmessage_private(request, private);
-
-	mod->transfer = mod_send_read;
-#ifdef SENDFILE
-	if (config->options & DOCUMENT_SENDFILE)
+	private = _document_setprivate(mod, request, response, fdfile, fdroot, uri,
+				mime, connector, &filestat, type);
+#ifdef DOCUMENTREST
+	if ((type & DOCUMENT_REST) && (!strcmp(method, str_put) || !strcmp(method, str_patch)) &&
+		document_uploadstart(private, request, tmpname) != ESUCCESS)
 	{
-		mod->transfer = mod_send_sendfile;
+		int error = errno;
+		document_close(private, request);
+		_document_errorresult(response, error);
+		return ESUCCESS;
 	}
 #endif
-	private->mod = mod;
-	private->ctl = httpmessage_client(request);
-	private->fdfile = fdfile;
-	private->fdroot = fdroot;
-	private->url = uri;
-	private->mime = mime;
-	private->func = connector;
-	private->size = filestat.st_size;
-	private->offset = 0;
-	private->type = type;
-#ifdef DEBUG
-	clock_gettime(CLOCK_REALTIME, &private->start);
-	private->datasize = private->size;
+#ifdef DOCUMENTCACHE
+	if (usecache)
+		_document_setcached(private, _document_cacheadd(mod, uri, urilen,
+				fdfile, &filestat, mime), response);
 #endif
 	return EREJECT;
 }
 
-int getfile_connector(void *arg, http_message_t *request, http_message_t *response)
+int getfile_connector(void *UNUSED(arg), http_message_t *request, http_message_t *response)
 {
 	document_connector_t *private = httpmessage_private(request, NULL);
-	const _mod_document_mod_t *mod = (_mod_document_mod_t *)arg;
 	int ret;
 
-	ret = mod->transfer(private, response);
+	ret = private->transfer(private, response);
 	if (ret < 0)
 	{
 		if (errno == EAGAIN)
@@ -439,33 +916,6 @@ int getfile_connector(void *arg, http_message_t *request, http_message_t *respon
 	return ECONTINUE;
 }
 
-static int mod_send_read(document_connector_t *private, http_message_t *response)
-{
-	int ret = 0;
-	int size;
-	int chunksize;
-	char content[CONTENTCHUNK];
-
-	/**
-	 * check the size for the range support
-	 * the size may be different of the real size file
-	 */
-	chunksize = (CONTENTCHUNK > private->size)?private->size:CONTENTCHUNK;
-	size = read(private->fdfile, content, chunksize);
-	if (size > 0)
-	{
-		ret = size;
-		content[size] = 0;
-		httpmessage_addcontent(response, "none", content, size);
-		document_dbg("document: send %d", size);
-	}
-	else if (size == -1)
-	{
-		err("document: response() read file error %s", strerror(errno));
-	}
-	return ret;
-}
-
 static int _transfer_connector(void *arg, http_message_t *request, http_message_t *response)
 {
 	document_connector_t *private = httpmessage_private(request, NULL);
@@ -487,7 +937,15 @@ static int _mime_connector(void *arg, http_message_t *request, http_message_t *r
 	if (private != NULL &&
 		   (private->fdfile > 0) &&
 		   private->mime)
-		httpmessage_addcontent(response, private->mime, NULL, private->size);
+	{
+		long long size = private->size;
+#ifdef DOCUMENTDEFLATE
+		/// the length of the compressed content is unknown
+		if (private->func == deflatefile_connector)
+			size = -1;
+#endif
+		httpmessage_addcontent(response, private->mime, NULL, size);
+	}
 
 	return EREJECT;
 }
@@ -513,12 +971,22 @@ static int document_configpart(config_setting_t *config, server_t *server, int i
 #ifdef SENDFILE
 	if (utils_searchexp("sendfile", options, NULL) == ESUCCESS)
 	{
-		if (!ouistiti_issecure(server))
-			static_file->options |= DOCUMENT_SENDFILE;
-		else
-			warn("sendfile configuration is not allowed with tls");
+		static_file->options |= DOCUMENT_SENDFILE;
+		if (ouistiti_issecure(server))
+		{
+			warn("sendfile configuration with tls requires the ktls option of tls");
+			static_file->options |= DOCUMENT_TLS;
+		}
 	}
 #endif
+	if (utils_searchexp("mmap", options, NULL) == ESUCCESS)
+	{
+		static_file->options |= DOCUMENT_MMAP;
+	}
+	if (utils_searchexp("precompressed", options, NULL) == ESUCCESS)
+	{
+		static_file->options |= DOCUMENT_PRECOMPRESSED;
+	}
 #ifdef RANGEREQUEST
 	if (utils_searchexp("range", options, NULL) == ESUCCESS)
 	{
@@ -530,6 +998,8 @@ static int document_configpart(config_setting_t *config, server_t *server, int i
 	{
 		static_file->options |= DOCUMENT_REST;
 	}
+	static_file->uploadexpire = DEFAULT_UPLOADEXPIRE;
+	config_setting_lookup_int(config, "uploadexpire", &static_file->uploadexpire);
 #endif
 #ifdef DOCUMENTHOME
 	if (utils_searchexp("home", options, NULL) == ESUCCESS)
@@ -537,6 +1007,39 @@ static int document_configpart(config_setting_t *config, server_t *server, int i
 		static_file->options |= DOCUMENT_HOME;
 	}
 #endif
+#ifdef DOCUMENTCACHE
+	if (utils_searchexp("cache", options, NULL) == ESUCCESS)
+	{
+		static_file->options |= DOCUMENT_CACHE;
+	}
+	static_file->cachesize = DEFAULT_CACHESIZE;
+	config_setting_lookup_int(config, "cachesize", &static_file->cachesize);
+	static_file->cacheinterval = DEFAULT_CACHEINTERVAL;
+	config_setting_lookup_int(config, "cacheinterval", &static_file->cacheinterval);
+	static_file->cachefilesize = DEFAULT_CACHEFILESIZE;
+	config_setting_lookup_int(config, "cachefilesize", &static_file->cachefilesize);
+	static_file->cachememory = DEFAULT_CACHEMEMORY;
+	config_setting_lookup_int(config, "cachememory", &static_file->cachememory);
+#endif
+	static_file->transfersize = DEFAULT_TRANSFERSIZE;
+	config_setting_lookup_int(config, "transfersize", &static_file->transfersize);
+	config_setting_lookup_string(config, "cachecontrol", &static_file->cachecontrol);
+#ifdef DOCUMENTDEFLATE
+	if (utils_searchexp("deflate", options, NULL) == ESUCCESS)
+	{
+		static_file->options |= DOCUMENT_DEFLATE;
+	}
+	static_file->deflatetypes = DEFAULT_DEFLATETYPES;
+	config_setting_lookup_string(config, "deflatetypes", &static_file->deflatetypes);
+	static_file->deflatelevel = DEFAULT_DEFLATELEVEL;
+	config_setting_lookup_int(config, "deflatelevel", &static_file->deflatelevel);
+#endif
+#ifdef DOCUMENTARCHIVE
+	if (utils_searchexp("archive", options, NULL) == ESUCCESS)
+	{
+		static_file->options |= DOCUMENT_ARCHIVE;
+	}
+#endif
 
 	if (!strcmp(config_setting_name(config), "filestorage"))
 		static_file->options |= DOCUMENT_REST;
@@ -601,6 +1104,25 @@ static int document_config(void *iterator, server_t *server, int index, void **c
 }
 #endif
 
+#ifdef DOCUMENTCACHE
+/**
+ * the files are read with the rights of the user of the server,
+ * the forked clients inherit of the files loaded now
+ */
+static void _document_start(void *arg)
+{
+	_mod_document_mod_t *mod = (_mod_document_mod_t *)arg;
+	const mod_document_t *config = mod->config;
+
+	if (mod->fdroot != -1)
+		document_cachepreload(mod->cache, mod->fdroot, &config->htaccess);
+#ifdef DOCUMENTDEFLATE
+	if (config->options & DOCUMENT_DEFLATE)
+		document_cachedeflateall(mod->cache, config->deflatetypes, config->deflatelevel);
+#endif
+}
+#endif
+
 static void *mod_document_create(http_server_t *server, mod_document_t *config)
 {
 	if (!config)
@@ -611,6 +1133,7 @@ static void *mod_document_create(http_server_t *server, mod_document_t *config)
 	_mod_document_mod_t *mod = calloc(1, sizeof(*mod));
 
 	mod->config = config;
+	mod->server = server;
 	mod->fdroot = open(config->docroot, O_DIRECTORY);
 	if (mod->fdroot == -1)
 	{
@@ -641,8 +1164,18 @@ static void *mod_document_create(http_server_t *server, mod_document_t *config)
 			document_dbg("document: home directory is %s", config->dochome);
 		}
 	}
+#endif
+#ifdef DOCUMENTCACHE
+	if (config->options & DOCUMENT_CACHE)
+	{
+		mod->cache = document_cachecreate(config->cachesize, config->cacheinterval,
+					config->cachefilesize, config->cachememory);
+		if (mod->cache != NULL)
+			ouistiti_setstart(server, _document_start, mod);
+	}
 #endif
 	httpserver_addconnector(server, _document_connector, mod, CONNECTOR_DOCUMENT, str_document);
+	ouistiti_setcachepolicy(server, _document_cachepolicy, mod);
 #ifdef RANGEREQUEST
 	if (config->options & DOCUMENT_RANGE)
 		httpserver_addconnector(server, range_connector, mod, CONNECTOR_DOCUMENT, str_document);
@@ -655,6 +1188,7 @@ static void *mod_document_create(http_server_t *server, mod_document_t *config)
 	{
 		httpserver_addmethod(server, METHOD(str_put), MESSAGE_PROTECTED | MESSAGE_ALLOW_CONTENT);
 		httpserver_addmethod(server, METHOD(str_delete), MESSAGE_PROTECTED);
+		httpserver_addmethod(server, METHOD(str_patch), MESSAGE_PROTECTED | MESSAGE_ALLOW_CONTENT);
 	}
 #endif
 	return mod;
@@ -663,6 +1197,13 @@ static void *mod_document_create(http_server_t *server, mod_document_t *config)
 static void mod_document_destroy(void *data)
 {
 	_mod_document_mod_t *mod = (_mod_document_mod_t *)data;
+#ifdef DOCUMENTCACHE
+	if (mod->cache)
+		document_cachedestroy(mod->cache);
+#endif
+	ouistiti_unsetcachepolicy(mod);
+	ouistiti_unsetstart(mod);
+	htaccess_free(&mod->config->htaccess);
 	free(mod->config);
 	free(data);
 }
@@ -30,6 +30,7 @@
 #define __MOD_DOCUMENT_H__
 
 #include <dirent.h>
+#include <sys/stat.h>
 
 #define DOCUMENT_DIRLISTING 0x01
 #define DOCUMENT_SENDFILE 0x02
@@ -37,6 +38,16 @@
 #define DOCUMENT_REST 0x08
 #define DOCUMENT_HOME 0x10
 #define DOCUMENT_TLS 0x20
+#define DOCUMENT_CACHE 0x40
+#define DOCUMENT_TRANSFER 0x80
+#define DOCUMENT_CORK 0x100
+#define DOCUMENT_MMAP 0x200
+#define DOCUMENT_PRECOMPRESSED 0x400
+#define DOCUMENT_DEFLATE 0x800
+#define DOCUMENT_ARCHIVE 0x1000
+
+#define DOCUMENT_ENCODING_GZIP 0x01
+#define DOCUMENT_ENCODING_BR 0x02
 
 #include "ouistiti.h"
 
@@ -44,12 +55,19 @@
 extern "C"
 {
 #endif
+typedef struct htaccess_exp_s htaccess_exp_t;
 typedef struct htaccess_s htaccess_t;
 struct htaccess_s
 {
 	string_t denyfirst;
 	string_t allow;
 	string_t denylast;
+	/**
+	 * the patterns compiled by htaccess_config
+	 */
+	htaccess_exp_t *denyfirstexp;
+	htaccess_exp_t *allowexp;
+	htaccess_exp_t *denylastexp;
 };
 
 typedef struct mod_document_s
@@ -59,6 +77,15 @@ typedef struct mod_document_s
 	htaccess_t htaccess;
 	const char *defaultpage;
 	int options;
+	int cachesize;
+	int cacheinterval;
+	int cachefilesize;
+	int cachememory;
+	int transfersize;
+	const char *deflatetypes;
+	int deflatelevel;
+	const char *cachecontrol;
+	int uploadexpire;
 } mod_document_t;
 
 extern const module_t mod_document;
@@ -67,18 +94,29 @@ extern const module_t mod_document;
  * interface to change the data transfer function
  */
 #define CONTENTCHUNK 64
+#define TRANSFER_MINSIZE (4 * 1024)
+#define DEFAULT_TRANSFERSIZE (64 * 1024)
 
 typedef struct _mod_document_mod_s _mod_document_mod_t;
 typedef struct _document_connector_s document_connector_t;
 typedef int (*mod_transfer_t)(document_connector_t *private, http_message_t *response);
+typedef struct document_cache_s document_cache_t;
+typedef struct document_cacheentry_s document_cacheentry_t;
+typedef struct document_deflate_s document_deflate_t;
+typedef struct document_range_s document_range_t;
+typedef struct document_listing_s document_listing_t;
+typedef struct document_upload_s document_upload_t;
+typedef struct document_batch_s document_batch_t;
+typedef struct document_archive_s document_archive_t;
 
 struct _mod_document_mod_s
 {
 	mod_document_t *config;
+	http_server_t *server;
 	void *vhost;
-	mod_transfer_t transfer;
 	int fdroot;
 	int fdhome;
+	document_cache_t *cache;
 };
 
 struct _document_connector_s
@@ -91,11 +129,24 @@ struct _document_connector_s
 	int fdfile;
 	int fdroot;
 	int type;
-	struct dirent **ents;
-	int nbents;
+	document_listing_t *listing;
+	document_upload_t *upload;
+	document_batch_t *batch;
+	document_archive_t *archive;
 	http_connector_t func;
 	unsigned long long size;
 	unsigned long long offset;
+	document_cacheentry_t *cacheentry;
+	mod_transfer_t transfer;
+	char *buffer;
+	size_t buffersize;
+	int sndbuf;
+	void *map;
+	size_t mapsize;
+	off_t mapoffset;
+	const char *data;
+	document_deflate_t *deflate;
+	document_range_t *range;
 #ifdef DEBUG
 	struct timespec start;
 	unsigned long long datasize;
@@ -107,17 +158,25 @@ struct _document_connector_s
  */
 #ifdef RANGEREQUEST
 int range_connector(void *arg, http_message_t *request, http_message_t *response);
+void document_rangeclose(document_connector_t *private);
 #endif
 #ifdef DIRLISTING
 int dirlisting_connector(void *arg, http_message_t *request, http_message_t *response);
+void document_listingclose(document_connector_t *private);
+#endif
+#ifdef DOCUMENTARCHIVE
+int archive_connector(void *arg, http_message_t *request, http_message_t *response);
+int document_archiveaccept(const mod_document_t *config, http_message_t *request);
+void document_archiveclose(document_connector_t *private);
 #endif
 int getfile_connector(void *arg, http_message_t *request, http_message_t *response);
 
 #ifdef DOCUMENTREST
+#define DEFAULT_UPLOADEXPIRE (24 * 3600)
 int _document_getconnnectorput(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
-		http_connector_t *connector);
+		http_connector_t *connector, char **tmpname);
 int _document_getconnnectorpost(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
@@ -126,15 +185,70 @@ int _document_getconnnectordelete(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
 		http_connector_t *connector);
+int _document_getconnnectorupload(_mod_document_mod_t *mod,
+		int fdroot, const char *url, int urllen, const char **mime,
+		http_message_t *request, http_message_t *response,
+		http_connector_t *connector);
+int document_uploadstart(document_connector_t *private, http_message_t *request, char *tmpname);
+void document_uploadclose(document_connector_t *private);
+void document_batchclose(document_connector_t *private);
 #endif
 
 void document_close(document_connector_t *private, http_message_t *request);
+int document_encodings(int fdroot, const char *url);
+void document_validators(const struct stat *filestat, const char *suffix,
+		char *etag, size_t etaglen, char *lastmodified, size_t lastmodifiedlen);
+
+int mod_send_read(document_connector_t *private, http_message_t *response);
+int mod_send_mmap(document_connector_t *private, http_message_t *response);
+void document_transferclose(document_connector_t *private);
+char *document_transferbuffer(document_connector_t *private, size_t max);
+int document_acceptencoding(http_message_t *request);
+
+#ifdef DOCUMENTDEFLATE
+#define DEFAULT_DEFLATETYPES "text/*,application/json,application/javascript,application/xml,image/svg+xml"
+#define DEFAULT_DEFLATELEVEL 6
+int document_deflateaccept(const mod_document_t *config, http_message_t *request, const char *mime);
+void document_deflateheaders(http_message_t *response);
+int document_deflatestart(document_connector_t *private, http_message_t *response);
+int document_deflatecontent(document_connector_t *private, http_message_t *response,
+		const char *data, size_t size, int finish);
+void document_deflateclose(document_connector_t *private);
+int document_deflatebuffer(int level, const char *data, size_t size, char **output, size_t *outputsize);
+int mod_send_deflate(document_connector_t *private, http_message_t *response);
+int deflatefile_connector(void *arg, http_message_t *request, http_message_t *response);
+#endif
+
+#ifdef DOCUMENTCACHE
+#define DEFAULT_CACHESIZE 64
+#define DEFAULT_CACHEINTERVAL 1
+#define DEFAULT_CACHEFILESIZE (16 * 1024)
+#define DEFAULT_CACHEMEMORY (1024 * 1024)
+document_cache_t *document_cachecreate(int size, int interval, size_t filesize, size_t memory);
+void document_cachepreload(document_cache_t *cache, int fdroot, const htaccess_t *htaccess);
+void document_cachedestroy(document_cache_t *cache);
+document_cacheentry_t *document_cacheget(document_cache_t *cache, int fdroot, const char *url, size_t urllen);
+document_cacheentry_t *document_cacheadd(document_cache_t *cache, int fdroot, const char *url, size_t urllen,
+		int fd, const struct stat *filestat, const char *mime);
+void document_cacherelease(document_cache_t *cache, document_cacheentry_t *entry);
+int document_cachefd(const document_cacheentry_t *entry, const struct stat **filestat, const char **mime);
+const char *document_cachedata(const document_cacheentry_t *entry);
+void document_cachevalidators(const document_cacheentry_t *entry, const char **etag, const char **lastmodified);
+int document_cacheencodings(const document_cacheentry_t *entry);
+#ifdef DOCUMENTDEFLATE
+const char *document_cachedeflate(document_cache_t *cache, document_cacheentry_t *entry, int level, size_t *size);
+void document_cachedeflateall(document_cache_t *cache, const char *types, int level);
+#endif
+void document_cachestats(document_cache_t *cache, unsigned long *hits, unsigned long *misses);
+#endif
 
 #ifdef FILE_CONFIG
 #include <libconfig.h>
 int htaccess_config(config_setting_t *setting, htaccess_t *htaccess);
 #endif
 int htaccess_check(const htaccess_t *htaccess, const char *uri, const char **path_info);
+void htaccess_free(htaccess_t *htaccess);
+int htaccess_route(const htaccess_t *htaccess, char **prefixes, char **extensions);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,7 @@ modules-$(MODULES)+=mod_document
 slib-$(STATIC)+=mod_document
 mod_document_SOURCES+=mod_document.c
 mod_document_SOURCES+=document_htaccess.c
+mod_document_SOURCES+=document_transfer.c
 mod_document_CFLAGS+=-DSTATIC_FILE
 mod_document_CFLAGS+=$(LIBHTTPSERVER_CFLAGS)
 mod_document_LDFLAGS+=$(LIBHTTPSERVER_LDFLAGS)
@@ -16,6 +17,19 @@ mod_document_SOURCES-$(DIRLISTING)+=mod_dirlisting.c
 mod_document_SOURCES-$(RANGEREQUEST)+=mod_range.c
 
 mod_document_SOURCES-$(DOCUMENTREST)+=mod_documentrest.c
+ifeq ($(DOCUMENTREST),y)
+mod_document_LIBS-$(USE_PTHREAD)+=pthread
+endif
+
+mod_document_SOURCES-$(DOCUMENTCACHE)+=document_cache.c
+ifeq ($(DOCUMENTCACHE),y)
+mod_document_LIBS-$(USE_PTHREAD)+=pthread
+endif
+
+mod_document_SOURCES-$(DOCUMENTDEFLATE)+=document_deflate.c
+mod_document_LIBRARY-$(DOCUMENTDEFLATE)+=zlib
+
+mod_document_SOURCES-$(DOCUMENTARCHIVE)+=document_archive.c
 
 mod_document_CFLAGS-$(DEBUG)+=-g -DDEBUG
 
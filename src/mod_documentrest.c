@@ -25,14 +25,23 @@
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *****************************************************************************/
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+#include <linux/fs.h>
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
@@ -43,6 +52,7 @@
 #include "ouistiti/log.h"
 #include "mod_document.h"
 #include "mod_auth.h"
+#include "../compliant.h"
 
 #ifndef AT_NO_AUTOMOUNT
 #define AT_NO_AUTOMOUNT         0x800   /* Suppress terminal automount traversal */
@@ -55,6 +65,494 @@
 
 #define HAVE_SYMLINK
 
+/**
+ * the file is received into an anonymous file (O_TMPFILE) or into
+ * a hidden file of the same directory, and it is linked to its name
+ * only at the end of the upload.
+ */
+struct document_upload_s
+{
+	char *tmpname;
+	int replace;
+	unsigned long long size;
+	unsigned long long length;
+	/**
+	 * a chunk of a resumable upload is written at its offset into
+	 * the hidden partial file.
+	 */
+	int chunk;
+	unsigned long long offset;
+};
+
+/**
+ * the resumable upload of "dir/name" is kept into "dir/.name.partial"
+ * and the received ranges are appended into "dir/.name.partial.ranges".
+ */
+#define UPLOAD_PARTSUFFIX "partial"
+#define UPLOAD_RANGESSUFFIX "partial.ranges"
+#define UPLOAD_SWEEPINTERVAL 60
+
+typedef struct upload_range_s upload_range_t;
+struct upload_range_s
+{
+	unsigned long long start;
+	unsigned long long end;
+};
+
+static int _upload_tmpname(const char *url, char *path, size_t length)
+{
+	static unsigned int counter = 0;
+	const char *name = strrchr(url, '/');
+	int dirlen = (name != NULL)? name - url + 1: 0;
+	name = (name != NULL)? name + 1: url;
+	int ret = snprintf(path, length, "%.*s.%s.upload%d-%u", dirlen, url, name, getpid(),
+			__sync_fetch_and_add(&counter, 1));
+	if (ret < 0 || (size_t)ret >= length)
+		return EREJECT;
+	return ESUCCESS;
+}
+
+static int _upload_partname(const char *url, const char *suffix, char *path, size_t length)
+{
+	const char *name = strrchr(url, '/');
+	int dirlen = (name != NULL)? name - url + 1: 0;
+	name = (name != NULL)? name + 1: url;
+	int ret = snprintf(path, length, "%.*s.%s.%s", dirlen, url, name, suffix);
+	if (ret < 0 || (size_t)ret >= length)
+		return EREJECT;
+	return ESUCCESS;
+}
+
+static void _upload_dirname(const char *url, char *dir, size_t length)
+{
+	const char *name = strrchr(url, '/');
+	if (name != NULL && (size_t)(name - url) < length)
+		snprintf(dir, length, "%.*s", (int)(name - url), url);
+	else
+		strcpy(dir, ".");
+}
+
+static int _upload_expire(const mod_document_t *config)
+{
+	return (config->uploadexpire > 0)? config->uploadexpire: DEFAULT_UPLOADEXPIRE;
+}
+
+/**
+ * tmpname receives the name of the hidden file to remove or link it,
+ * or NULL for the anonymous file.
+ */
+static int _upload_open(int fdroot, const char *url, char **tmpname)
+{
+	char dir[PATH_MAX];
+	_upload_dirname(url, dir, sizeof(dir));
+	int fdfile = -1;
+	*tmpname = NULL;
+#ifdef O_TMPFILE
+	fdfile = openat(fdroot, dir, O_TMPFILE | O_WRONLY, 0640);
+	if (fdfile >= 0)
+		return fdfile;
+	/// the filesystem doesn't support O_TMPFILE
+	if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)
+		return -1;
+#endif
+	char path[PATH_MAX];
+	if (_upload_tmpname(url, path, sizeof(path)) != ESUCCESS)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fdfile = openat(fdroot, path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fdfile < 0)
+		return -1;
+	*tmpname = strdup(path);
+	if (*tmpname == NULL)
+	{
+		unlinkat(fdroot, path, 0);
+		close(fdfile);
+		errno = ENOMEM;
+		return -1;
+	}
+	return fdfile;
+}
+
+/**
+ * the new file replaces the old one atomically with the rename.
+ * tmpname is the hidden file, or NULL for the anonymous file fdfile.
+ */
+static int _upload_link(int fdroot, int fdfile, const char *url, const char *tmpname, int replace)
+{
+	char path[PATH_MAX];
+	int ret = -1;
+	if (tmpname == NULL)
+	{
+		char fdpath[32];
+		snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fdfile);
+		if (!replace)
+			return linkat(AT_FDCWD, fdpath, fdroot, url, AT_SYMLINK_FOLLOW);
+		if (_upload_tmpname(url, path, sizeof(path)) != ESUCCESS)
+			return -1;
+		if (linkat(AT_FDCWD, fdpath, fdroot, path, AT_SYMLINK_FOLLOW) == -1)
+			return -1;
+		tmpname = path;
+	}
+	if (replace)
+		ret = renameat(fdroot, tmpname, fdroot, url);
+	else
+		ret = linkat(fdroot, tmpname, fdroot, url, 0);
+	int error = errno;
+	unlinkat(fdroot, tmpname, 0);
+	errno = error;
+	return ret;
+}
+
+static int _upload_commit(document_connector_t *private)
+{
+	document_upload_t *upload = private->upload;
+	int ret = _upload_link(private->fdroot, private->fdfile, private->url, upload->tmpname, upload->replace);
+	free(upload->tmpname);
+	upload->tmpname = NULL;
+	return ret;
+}
+
+static void _upload_record(int fdroot, const char *url, unsigned long long start, unsigned long long end)
+{
+	char path[PATH_MAX];
+	if (start >= end || _upload_partname(url, UPLOAD_RANGESSUFFIX, path, sizeof(path)) != ESUCCESS)
+		return;
+	/// each record is written at once, the parallel chunks don't mix them
+	int fd = openat(fdroot, path, O_WRONLY | O_APPEND | O_CREAT, 0640);
+	if (fd < 0)
+		return;
+	upload_range_t range = { .start = start, .end = end};
+	if (write(fd, &range, sizeof(range)) != sizeof(range))
+		err("document: upload %s ranges error %s", url, strerror(errno));
+	close(fd);
+}
+
+static int _upload_rangecmp(const void *a, const void *b)
+{
+	const upload_range_t *first = a;
+	const upload_range_t *second = b;
+	if (first->start == second->start)
+		return 0;
+	return (first->start < second->start)? -1: 1;
+}
+
+/**
+ * returns the offset of the first byte not received yet
+ */
+static unsigned long long _upload_received(int fdroot, const char *url)
+{
+	char path[PATH_MAX];
+	if (_upload_partname(url, UPLOAD_RANGESSUFFIX, path, sizeof(path)) != ESUCCESS)
+		return 0;
+	int fd = openat(fdroot, path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	unsigned long long offset = 0;
+	struct stat filestat;
+	upload_range_t *ranges = NULL;
+	size_t nbranges = 0;
+	if (fstat(fd, &filestat) == 0)
+		nbranges = filestat.st_size / sizeof(*ranges);
+	if (nbranges > 0)
+		ranges = calloc(nbranges, sizeof(*ranges));
+	if (ranges != NULL && pread(fd, ranges, nbranges * sizeof(*ranges), 0) == (ssize_t)(nbranges * sizeof(*ranges)))
+	{
+		qsort(ranges, nbranges, sizeof(*ranges), _upload_rangecmp);
+		for (size_t i = 0; i < nbranges && ranges[i].start <= offset; i++)
+		{
+			if (ranges[i].end > offset)
+				offset = ranges[i].end;
+		}
+	}
+	free(ranges);
+	close(fd);
+	return offset;
+}
+
+static void _upload_remove(int fdroot, const char *url)
+{
+	char path[PATH_MAX];
+	if (_upload_partname(url, UPLOAD_PARTSUFFIX, path, sizeof(path)) == ESUCCESS)
+		unlinkat(fdroot, path, 0);
+	if (_upload_partname(url, UPLOAD_RANGESSUFFIX, path, sizeof(path)) == ESUCCESS)
+		unlinkat(fdroot, path, 0);
+}
+
+/**
+ * the temporary files of an upload are ".<name>.partial",
+ * ".<name>.partial.ranges" and ".<name>.upload<pid>-<n>".
+ */
+static int _upload_istemporary(const char *filename)
+{
+	static const char *suffixes[] = { "." UPLOAD_PARTSUFFIX, "." UPLOAD_RANGESSUFFIX };
+	if (filename[0] != '.')
+		return 0;
+	size_t length = strlen(filename);
+	for (unsigned int i = 0; i < sizeof(suffixes) / sizeof(*suffixes); i++)
+	{
+		size_t suffixlen = strlen(suffixes[i]);
+		/// the name of the uploaded file is not empty
+		if (length > suffixlen + 1 && !strcmp(filename + length - suffixlen, suffixes[i]))
+			return 1;
+	}
+	const char *upload = NULL;
+	for (const char *it = strstr(filename + 2, ".upload"); it != NULL; it = strstr(it + 1, ".upload"))
+		upload = it;
+	if (upload == NULL)
+		return 0;
+	const char *it = upload + sizeof(".upload") - 1;
+	if (!isdigit((unsigned char)*it))
+		return 0;
+	while (isdigit((unsigned char)*it))
+		it++;
+	if (*it++ != '-' || !isdigit((unsigned char)*it))
+		return 0;
+	while (isdigit((unsigned char)*it))
+		it++;
+	return (*it == '\0');
+}
+
+/**
+ * the uploads abandoned into the directory are removed
+ * when they expire, at most once per minute.
+ */
+static void _upload_sweep(int fdroot, const char *url, int expire)
+{
+	static time_t last = 0;
+	time_t now = time(NULL);
+	if (now - last < UPLOAD_SWEEPINTERVAL)
+		return;
+	last = now;
+
+	char dir[PATH_MAX];
+	_upload_dirname(url, dir, sizeof(dir));
+	int fddir = openat(fdroot, dir, O_RDONLY | O_DIRECTORY);
+	if (fddir < 0)
+		return;
+	DIR *dirstream = fdopendir(fddir);
+	if (dirstream == NULL)
+	{
+		close(fddir);
+		return;
+	}
+	struct dirent *ent;
+	while ((ent = readdir(dirstream)) != NULL)
+	{
+		if (!_upload_istemporary(ent->d_name))
+			continue;
+		struct stat filestat;
+		if (fstatat(fddir, ent->d_name, &filestat, AT_SYMLINK_NOFOLLOW) == 0 &&
+			S_ISREG(filestat.st_mode) && filestat.st_mtime + expire < now)
+		{
+			warn("document: upload %s/%s expired", dir, ent->d_name);
+			unlinkat(fddir, ent->d_name, 0);
+		}
+	}
+	closedir(dirstream);
+}
+
+/**
+ * the partial file has the size of the whole upload, it is created by the
+ * first chunk or by the creation of the upload.
+ */
+static int _upload_openpart(int fdroot, const char *url, unsigned long long total, int expire)
+{
+	char path[PATH_MAX];
+	if (_upload_partname(url, UPLOAD_PARTSUFFIX, path, sizeof(path)) != ESUCCESS)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	struct stat filestat;
+	int fdfile = openat(fdroot, path, O_WRONLY);
+	if (fdfile >= 0 && fstat(fdfile, &filestat) == 0 && filestat.st_mtime + expire < time(NULL))
+	{
+		/// the upload restarts from the beginning
+		warn("document: upload %s expired", url);
+		close(fdfile);
+		_upload_remove(fdroot, url);
+		fdfile = -1;
+	}
+	if (fdfile >= 0)
+	{
+		/// the size is 0 while another chunk creates the file
+		if (total > 0 && filestat.st_size > 0 && (unsigned long long)filestat.st_size != total)
+		{
+			close(fdfile);
+			errno = EINVAL;
+			return -1;
+		}
+		return fdfile;
+	}
+	/// the chunk without length has to continue an upload
+	if (total == 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	_upload_sweep(fdroot, url, expire);
+	fdfile = openat(fdroot, path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+	if (fdfile < 0 && errno == EEXIST)
+		return openat(fdroot, path, O_WRONLY);
+	if (fdfile < 0)
+		return -1;
+	if (fallocate(fdfile, 0, 0, total) == -1 &&
+		(errno == ENOSPC || ftruncate(fdfile, total) == -1))
+	{
+		int error = errno;
+		err("document: no space for %s (%llu bytes)", url, total);
+		close(fdfile);
+		unlinkat(fdroot, path, 0);
+		errno = error;
+		return -1;
+	}
+	return fdfile;
+}
+
+/**
+ * the chunk is defined by "Content-Range: bytes <start>-<end>/<total>"
+ * or by "Upload-Offset: <start>" for the upload already created.
+ * returns 1 for a chunk, 0 without chunk and -1 on error.
+ */
+static int _upload_chunk(http_message_t *request, unsigned long long *start,
+		unsigned long long *end, unsigned long long *total)
+{
+	const char *contentlength = httpmessage_REQUEST(request, "Content-Length");
+	unsigned long long length = (contentlength != NULL)? strtoull(contentlength, NULL, 10): 0;
+	const char *range = httpmessage_REQUEST(request, "Content-Range");
+	const char *offset = httpmessage_REQUEST(request, "Upload-Offset");
+	char *endptr = NULL;
+	if (range != NULL && range[0] != '\0')
+	{
+		if (strncmp(range, "bytes ", 6))
+			return -1;
+		*start = strtoull(range + 6, &endptr, 10);
+		if (*endptr != '-')
+			return -1;
+		*end = strtoull(endptr + 1, &endptr, 10);
+		if (*endptr != '/')
+			return -1;
+		*total = strtoull(endptr + 1, &endptr, 10);
+		if (*end < *start || *end >= *total || (length > 0 && *end - *start + 1 != length))
+			return -1;
+		return 1;
+	}
+	if (offset != NULL && offset[0] != '\0')
+	{
+		*start = strtoull(offset, &endptr, 10);
+		if (*endptr != '\0' || length == 0)
+			return -1;
+		*end = *start + length - 1;
+		*total = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void _upload_headers(int fdroot, const char *url, const struct stat *filestat,
+		int expire, http_message_t *response)
+{
+	char value[32];
+	snprintf(value, sizeof(value), "%llu", _upload_received(fdroot, url));
+	httpmessage_addheader(response, "Upload-Offset", value, -1);
+	snprintf(value, sizeof(value), "%llu", (unsigned long long)filestat->st_size);
+	httpmessage_addheader(response, "Upload-Length", value, -1);
+	time_t expires = filestat->st_mtime + expire;
+	struct tm tm;
+	gmtime_r(&expires, &tm);
+	strftime(value, sizeof(value), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	httpmessage_addheader(response, "Upload-Expires", value, -1);
+}
+
+/**
+ * the first request to take the partial file finalizes the upload
+ */
+static int _upload_finish(int fdroot, const char *url, int replace)
+{
+	char partname[PATH_MAX];
+	char path[PATH_MAX];
+	if (_upload_partname(url, UPLOAD_PARTSUFFIX, partname, sizeof(partname)) != ESUCCESS ||
+		_upload_tmpname(url, path, sizeof(path)) != ESUCCESS)
+		return EREJECT;
+	if (renameat(fdroot, partname, fdroot, path) == -1)
+		return (errno == ENOENT)? ESUCCESS: EREJECT;
+	_upload_remove(fdroot, url);
+	return (_upload_link(fdroot, -1, url, path, replace) == 0)? ESUCCESS: EREJECT;
+}
+
+/**
+ * the chunk is recorded and the last one finalizes the upload.
+ * returns ECONTINUE while chunks are missing.
+ */
+static int _upload_chunkcommit(document_connector_t *private, http_message_t *response)
+{
+	document_upload_t *upload = private->upload;
+	_upload_record(private->fdroot, private->url, upload->offset, upload->offset + upload->size);
+	upload->size = 0;
+
+	struct stat filestat;
+	if (fstat(private->fdfile, &filestat) == -1)
+		return EREJECT;
+	_upload_headers(private->fdroot, private->url, &filestat,
+			_upload_expire(private->mod->config), response);
+	if (_upload_received(private->fdroot, private->url) < (unsigned long long)filestat.st_size)
+		return ECONTINUE;
+
+	return _upload_finish(private->fdroot, private->url, upload->replace);
+}
+
+void document_uploadclose(document_connector_t *private)
+{
+	document_upload_t *upload = private->upload;
+	if (upload == NULL)
+		return;
+	/// the interrupted chunk keeps the received data
+	if (upload->chunk)
+		_upload_record(private->fdroot, private->url, upload->offset, upload->offset + upload->size);
+	/// the upload is not complete, the hidden file is removed
+	if (upload->tmpname != NULL)
+	{
+		unlinkat(private->fdroot, upload->tmpname, 0);
+		free(upload->tmpname);
+	}
+	free(upload);
+	private->upload = NULL;
+}
+
+/**
+ * If-Match allows to replace the file, it contains "*" or the ETag
+ * of the current file.
+ */
+static int _upload_ifmatch(int fdroot, const char *url, http_message_t *request, int *replace)
+{
+	const char *match = httpmessage_REQUEST(request, "If-Match");
+	struct stat filestat;
+	int exist = (fstatat(fdroot, url, &filestat, 0) == 0);
+	*replace = 0;
+	if (match == NULL || match[0] == '\0')
+	{
+		errno = EEXIST;
+		return exist? EREJECT: ESUCCESS;
+	}
+	if (!exist || !S_ISREG(filestat.st_mode))
+	{
+		errno = ENOENT;
+		return EREJECT;
+	}
+	char etag[48];
+	char lastmodified[32];
+	document_validators(&filestat, NULL, etag, sizeof(etag), lastmodified, sizeof(lastmodified));
+	if (strchr(match, '*') == NULL && strstr(match, etag) == NULL)
+	{
+		errno = EEXIST;
+		return EREJECT;
+	}
+	*replace = 1;
+	return ESUCCESS;
+}
+
 static int restheader_connector(http_message_t *request, http_message_t *response, int error)
 {
 	const char *uri = NULL;
@@ -97,6 +595,8 @@ static int putfile_connector(void *arg, http_message_t *request, http_message_t
 	 * on connection error
 	 */
 	size_t rest = 1;
+	/// rest is unsigned, the errors are kept aside
+	int failed = 0;
 	inputlen = httpmessage_content(request, &input, &rest);
 	document_dbg("document: put %lld bytes into file", inputlen);
 
@@ -106,33 +606,32 @@ static int putfile_connector(void *arg, http_message_t *request, http_message_t
 	 */
 	ret = EINCOMPLETE;
 	errno = 0;
-	while (inputlen > 0)
+	while (inputlen > 0 && inputlen != (unsigned long long)EREJECT)
 	{
-		int wret = write(private->fdfile, input, inputlen);
-		if (wret < 0)
+		/// the offset is kept by the upload, the file may be preallocated
+		ssize_t wret = pwrite(private->fdfile, input, inputlen,
+				private->upload->offset + private->upload->size);
+		if (wret < 0 && errno == EINTR)
+			continue;
+		if (wret <= 0)
 		{
 			err("document: access file %s error %s", private->url, strerror(errno));
-			if (errno != EAGAIN)
-			{
-				error = errno;
-				rest = -1;
-				break;
-			}
+			error = (wret < 0)? errno: ENOSPC;
+			failed = 1;
+			break;
 		}
-		else if (wret > 0)
-		{
 #ifdef DEBUG
-			private->datasize += wret;
+		private->datasize += wret;
 #endif
-			inputlen -= wret;
-			input += wret;
-		}
+		private->upload->size += wret;
+		inputlen -= wret;
+		input += wret;
 	}
 	if (inputlen == EREJECT)
 	{
 		rest = 0;
 	}
-	if (rest < 1)
+	if (rest < 1 || failed)
 	{
 #ifdef DEBUG
 		struct timespec stop;
@@ -143,25 +642,51 @@ static int putfile_connector(void *arg, http_message_t *request, http_message_t
 		value.tv_nsec = stop.tv_nsec - private->start.tv_nsec;
 		dbg("document: (%llu bytes) time %ld:%03ld", private->datasize, value.tv_sec, value.tv_nsec/1000000);
 #endif
-		warn("document: %s uploaded", private->url);
-		if (private->fdfile)
+		document_upload_t *upload = private->upload;
+		int complete = 1;
+		if (!failed && upload->size < upload->length)
 		{
-			ret = close(private->fdfile);
-#ifdef PUTTMPFILE
-			char path[PATH_MAX];
-			snprintf(path, PATH_MAX, "/proc/self/fd/%d", private->fdfile);
-			ret = linkat(mode->fdroot, path, AT_FDCWD, private->url, AT_SYMLINK_FOLLOW);
-#endif
+			err("document: %s upload interrupted (%llu/%llu bytes)", private->url, upload->size, upload->length);
+			error = ECONNRESET;
+			failed = 1;
+		}
+		if (upload->chunk)
+		{
+			int chunkret = _upload_chunkcommit(private, response);
+			complete = (chunkret != ECONTINUE);
+			if (!failed && chunkret == EREJECT)
+			{
+				err("document: %s chunk error %s", private->url, strerror(errno));
+				error = errno;
+				failed = 1;
+			}
+		}
+		else if (!failed && _upload_commit(private) != 0)
+		{
+			err("document: %s link error %s", private->url, strerror(errno));
+			error = errno;
+			failed = 1;
 		}
-		private->fdfile = 0;
+		if (!failed && complete)
+			warn("document: %s uploaded", private->url);
 		document_close(private, request);
-		if (rest < 0)
+		if (failed && error == EEXIST)
+#ifdef RESULT_409
+			httpmessage_result(response, RESULT_409);
+#else
+			httpmessage_result(response, RESULT_400);
+#endif
+#ifdef RESULT_507
+		else if (failed && (error == ENOSPC || error == EDQUOT))
+			httpmessage_result(response, RESULT_507);
+#endif
+		else if (failed)
 #ifdef RESULT_500
 			httpmessage_result(response, RESULT_500);
 #else
 			httpmessage_result(response, RESULT_404);
 #endif
-		else
+		else if (complete)
 #ifdef RESULT_201
 			httpmessage_result(response, RESULT_201);
 #else
@@ -172,13 +697,35 @@ static int putfile_connector(void *arg, http_message_t *request, http_message_t
 	return ret;
 }
 
+/**
+ * If-Match rejects the upload with "412 Precondition Failed",
+ * an existing file without it is a conflict.
+ */
+static void _upload_reject(http_message_t *request, http_message_t *response, int error)
+{
+	restheader_connector(request, response, error);
+#ifdef RESULT_412
+	const char *match = httpmessage_REQUEST(request, "If-Match");
+	if (match != NULL && match[0] != '\0' && (error == EEXIST || error == ENOENT))
+	{
+		httpmessage_result(response, RESULT_412);
+		error = 0;
+	}
+	else
+#endif
+	if (error == EEXIST)
+		httpmessage_result(response, RESULT_409);
+	errno = error;
+}
+
 int _document_getconnnectorput(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
-		http_connector_t *connector)
+		http_connector_t *connector, char **tmpname)
 {
 	int fdfile = -1;
 	const char *contenttype = httpmessage_REQUEST(request,"Content-Type");
+	*tmpname = NULL;
 	errno = 0;
 	if (url[urllen - 1] == '/' || (contenttype && !strcmp(contenttype, "text/directory")))
 	{
@@ -189,10 +736,23 @@ int _document_getconnnectorput(_mod_document_mod_t *mod,
 	}
 	else
 	{
-		fdfile = openat(fdroot, url, O_WRONLY | O_CREAT | O_EXCL, 0640);
-		if (fdfile < 0)
+		int replace = 0;
+		unsigned long long start, end, total;
+		int chunk = _upload_chunk(request, &start, &end, &total);
+		/// PATCH sends only the chunks of a resumable upload
+		if (chunk == 0 && !strcmp(httpmessage_REQUEST(request, "method"), str_patch))
+			chunk = -1;
+		if (chunk < 0)
+		{
+			restheader_connector(request, response, EINVAL);
+			errno = EINVAL;
+			fdfile = 0; /// The request is complete by this connector
+		}
+		else if (_upload_ifmatch(fdroot, url, request, &replace) != ESUCCESS ||
+			(fdfile = (chunk)? _upload_openpart(fdroot, url, total, _upload_expire(mod->config)):
+				_upload_open(fdroot, url, tmpname)) < 0)
 		{
-			restheader_connector(request, response, errno);
+			_upload_reject(request, response, errno);
 			fdfile = 0; /// The request is complete by this connector
 		}
 		else
@@ -201,6 +761,524 @@ int _document_getconnnectorput(_mod_document_mod_t *mod,
 	return fdfile;
 }
 
+/**
+ * the resumable upload is created with its length, the chunks
+ * are sent after with PUT or PATCH.
+ */
+static int _upload_create(_mod_document_mod_t *mod, int fdroot, const char *url,
+		http_message_t *request, http_message_t *response)
+{
+	int replace = 0;
+	const char *length = httpmessage_REQUEST(request, "Upload-Length");
+	unsigned long long total = (length != NULL)? strtoull(length, NULL, 10): 0;
+	int expire = _upload_expire(mod->config);
+	int fdfile = -1;
+	if (total == 0)
+	{
+		restheader_connector(request, response, EINVAL);
+		errno = EINVAL;
+		return 0;
+	}
+	if (_upload_ifmatch(fdroot, url, request, &replace) != ESUCCESS ||
+		(fdfile = _upload_openpart(fdroot, url, total, expire)) < 0)
+	{
+		_upload_reject(request, response, errno);
+		return 0;
+	}
+	struct stat filestat;
+	if (fstat(fdfile, &filestat) == 0)
+		_upload_headers(fdroot, url, &filestat, expire, response);
+	close(fdfile);
+#ifdef RESULT_201
+	httpmessage_result(response, RESULT_201);
+#endif
+	restheader_connector(request, response, 0);
+	errno = 0;
+	return 0;
+}
+
+/**
+ * HEAD returns the state of the resumable upload of the file.
+ */
+int _document_getconnnectorupload(_mod_document_mod_t *mod,
+		int fdroot, const char *url, int urllen, const char **mime,
+		http_message_t *request, http_message_t *response,
+		http_connector_t *connector)
+{
+	char path[PATH_MAX];
+	struct stat filestat;
+	int expire = _upload_expire(mod->config);
+	if (_upload_partname(url, UPLOAD_PARTSUFFIX, path, sizeof(path)) != ESUCCESS ||
+		fstatat(fdroot, path, &filestat, 0) == -1 ||
+		filestat.st_mtime + expire < time(NULL))
+		return -1;
+	_upload_headers(fdroot, url, &filestat, expire, response);
+	httpmessage_addheader(response, str_cachecontrol, STRING_REF("no-store"));
+	errno = 0;
+	return 0; /// The request is complete by this connector
+}
+
+/**
+ * the file is opened, the upload keeps the way to commit it.
+ * The upload takes tmpname, the hidden file is removed on error.
+ */
+int document_uploadstart(document_connector_t *private, http_message_t *request, char *tmpname)
+{
+	document_upload_t *upload = calloc(1, sizeof(*upload));
+	if (upload == NULL)
+	{
+		if (tmpname != NULL)
+			unlinkat(private->fdroot, tmpname, 0);
+		free(tmpname);
+		errno = ENOMEM;
+		return EREJECT;
+	}
+	upload->tmpname = tmpname;
+	private->upload = upload;
+	const char *match = httpmessage_REQUEST(request, "If-Match");
+	upload->replace = (match != NULL && match[0] != '\0');
+	const char *contentlength = httpmessage_REQUEST(request, "Content-Length");
+	upload->length = (contentlength != NULL)? strtoull(contentlength, NULL, 10): 0;
+	struct stat filestat;
+	unsigned long long start, end, total;
+	if (_upload_chunk(request, &start, &end, &total) > 0)
+	{
+		upload->chunk = 1;
+		upload->offset = start;
+		/// the chunk must stay into the file
+		if (fstat(private->fdfile, &filestat) == 0 && filestat.st_size > 0 &&
+			end >= (unsigned long long)filestat.st_size)
+		{
+			errno = EINVAL;
+			return EREJECT;
+		}
+		return ESUCCESS;
+	}
+
+	/// the blocks of the file are reserved before the reception
+	if (upload->length > 0 && fallocate(private->fdfile, FALLOC_FL_KEEP_SIZE, 0, upload->length) == -1 &&
+		errno == ENOSPC)
+	{
+		err("document: no space for %s (%llu bytes)", private->url, upload->length);
+		return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+/**
+ * the copy shares the blocks (reflink) when the filesystem allows it,
+ * otherwise the kernel copies the data without userspace buffer.
+ * The pieces are recorded as the ranges of an upload for the progress.
+ */
+#define COPY_ASYNCSIZE (64 * 1024 * 1024)
+#define COPY_CHUNKSIZE (16 * 1024 * 1024)
+#define COPY_MAXDEPTH 16
+
+static int _copy_data(int fdin, int fdout, unsigned long long size, int fdroot, const char *progress)
+{
+	unsigned long long offset = 0;
+	int usesendfile = 0;
+	while (offset < size)
+	{
+		size_t length = (size - offset > COPY_CHUNKSIZE)? COPY_CHUNKSIZE: size - offset;
+		ssize_t ret = -1;
+		if (!usesendfile)
+		{
+			loff_t in = offset;
+			loff_t out = offset;
+			ret = copy_file_range(fdin, &in, fdout, &out, length, 0);
+			/// the files are not on the same filesystem or it is not supported
+			if (ret < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+				usesendfile = 1;
+		}
+		if (usesendfile)
+		{
+			off_t in = offset;
+			if (lseek(fdout, offset, SEEK_SET) == (off_t)-1)
+				return EREJECT;
+			ret = sendfile(fdout, fdin, &in, length);
+		}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return EREJECT;
+		if (progress != NULL)
+			_upload_record(fdroot, progress, offset, offset + ret);
+		offset += ret;
+	}
+	return ESUCCESS;
+}
+
+/**
+ * the copy in background owns its descriptors and its paths,
+ * fdin is -1 for a directory.
+ */
+typedef struct copy_job_s copy_job_t;
+struct copy_job_s
+{
+	int fdroot;
+	int fdin;
+	int fdout;
+	unsigned long long size;
+	char *src;
+	char *dst;
+	int expire;
+};
+
+static void _copy_jobfree(copy_job_t *job)
+{
+	if (job->fdroot != -1)
+		close(job->fdroot);
+	if (job->fdin != -1)
+		close(job->fdin);
+	if (job->fdout != -1)
+		close(job->fdout);
+	free(job->src);
+	free(job->dst);
+	free(job);
+}
+
+static int _copy_tree(int fdroot, const char *src, const char *dst, int expire, int depth);
+
+static void *_copy_run(void *arg)
+{
+	copy_job_t *job = arg;
+	int ret = EREJECT;
+	if (job->fdin != -1)
+	{
+		ret = _copy_data(job->fdin, job->fdout, job->size, job->fdroot, job->dst);
+		if (ret == ESUCCESS)
+			ret = _upload_finish(job->fdroot, job->dst, 0);
+	}
+	else
+		ret = _copy_tree(job->fdroot, job->src, job->dst, job->expire, 0);
+	if (ret != ESUCCESS)
+		err("document: copy %s error %s", job->dst, strerror(errno));
+	else
+		warn("document: %s copied", job->dst);
+	_copy_jobfree(job);
+	return NULL;
+}
+
+/**
+ * the process in background doesn't keep the sockets of the server
+ */
+static void _copy_detach(const copy_job_t *job)
+{
+	int fds[3] = {job->fdroot, job->fdin, job->fdout};
+	int first = STDERR_FILENO + 1;
+	/// the descriptors are sorted to close the ranges between them
+	for (int i = 0; i < 3; i++)
+	{
+		int min = i;
+		for (int j = i + 1; j < 3; j++)
+			if (fds[j] < fds[min])
+				min = j;
+		int fd = fds[min];
+		fds[min] = fds[i];
+		fds[i] = fd;
+		if (fd < first)
+			continue;
+#ifdef HAVE_CLOSE_RANGE
+		if (fd > first)
+			close_range(first, fd - 1, 0);
+#else
+		for (int other = first; other < fd; other++)
+			close(other);
+#endif
+		first = fd + 1;
+	}
+#ifdef HAVE_CLOSE_RANGE
+	close_range(first, ~0U, 0);
+#else
+	long max = sysconf(_SC_OPEN_MAX);
+	for (int other = first; other < max; other++)
+		close(other);
+#endif
+}
+
+/**
+ * fork is safe only from a process with one thread (fork model or
+ * without VTHREAD), a thread of the server process runs the copy
+ * otherwise. The number of threads is the number of links of the
+ * task directory minus 2.
+ */
+static int _copy_background(copy_job_t *job)
+{
+#ifdef USE_PTHREAD
+	struct stat taskstat;
+	if (stat("/proc/self/task", &taskstat) == 0 && taskstat.st_nlink > 3)
+	{
+		pthread_attr_t attr;
+		pthread_t thread;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		int ret = pthread_create(&thread, &attr, _copy_run, job);
+		pthread_attr_destroy(&attr);
+		if (ret != 0)
+		{
+			errno = ret;
+			return EREJECT;
+		}
+		return ECONTINUE;
+	}
+#endif
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		/// the second child is adopted by init, nobody waits for it
+		if (fork() == 0)
+		{
+			_copy_detach(job);
+			_copy_run(job);
+			_exit(0);
+		}
+		_exit(0);
+	}
+	if (pid == -1)
+		return EREJECT;
+	waitpid(pid, NULL, 0);
+	_copy_jobfree(job);
+	return ECONTINUE;
+}
+
+static copy_job_t *_copy_job(int fdroot, const char *src, const char *dst, int expire)
+{
+	copy_job_t *job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return NULL;
+	job->fdin = -1;
+	job->fdout = -1;
+	job->expire = expire;
+	job->fdroot = fcntl(fdroot, F_DUPFD_CLOEXEC, 0);
+	job->src = strdup(src);
+	job->dst = strdup(dst);
+	if (job->fdroot == -1 || job->src == NULL || job->dst == NULL)
+	{
+		_copy_jobfree(job);
+		return NULL;
+	}
+	return job;
+}
+
+/**
+ * the copy in background is seen as a resumable upload of the
+ * destination, HEAD returns its progress.
+ */
+static int _copy_async(int fdroot, int fdin, const char *src, const char *dst,
+		const struct stat *filestat, int expire)
+{
+	copy_job_t *job = _copy_job(fdroot, src, dst, expire);
+	if (job == NULL)
+		return EREJECT;
+	job->size = filestat->st_size;
+	job->fdin = fcntl(fdin, F_DUPFD_CLOEXEC, 0);
+	job->fdout = _upload_openpart(fdroot, dst, job->size, expire);
+	if (job->fdin == -1 || job->fdout == -1)
+	{
+		if (job->fdout != -1)
+			_upload_remove(fdroot, dst);
+		_copy_jobfree(job);
+		return EREJECT;
+	}
+	fchmod(job->fdout, filestat->st_mode & 0777);
+	int ret = _copy_background(job);
+	if (ret != ECONTINUE)
+	{
+		_copy_jobfree(job);
+		_upload_remove(fdroot, dst);
+	}
+	return ret;
+}
+
+/**
+ * returns ECONTINUE when the copy continues in background
+ */
+static int _copy_file(int fdroot, const char *src, const char *dst, int expire, int async)
+{
+	int fdin = openat(fdroot, src, O_RDONLY);
+	if (fdin < 0)
+		return EREJECT;
+	struct stat filestat;
+	if (fstat(fdin, &filestat) == -1)
+	{
+		close(fdin);
+		return EREJECT;
+	}
+	/// the copy doesn't replace a file
+	if (faccessat(fdroot, dst, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+	{
+		close(fdin);
+		errno = EEXIST;
+		return EREJECT;
+	}
+	char *tmpname = NULL;
+	int fdout = _upload_open(fdroot, dst, &tmpname);
+	if (fdout < 0)
+	{
+		close(fdin);
+		return EREJECT;
+	}
+	int ret = EREJECT;
+#ifdef FICLONE
+	/// the reflink is immediate, there is no reason to wait
+	if (ioctl(fdout, FICLONE, fdin) == 0)
+		ret = ESUCCESS;
+	else
+#endif
+	if (async && (unsigned long long)filestat.st_size > COPY_ASYNCSIZE)
+		ret = _copy_async(fdroot, fdin, src, dst, &filestat, expire);
+	else
+		ret = _copy_data(fdin, fdout, filestat.st_size, fdroot, NULL);
+	int error = errno;
+	if (ret == ESUCCESS)
+	{
+		fchmod(fdout, filestat.st_mode & 0777);
+		if (_upload_link(fdroot, fdout, dst, tmpname, 0) == -1)
+		{
+			error = errno;
+			ret = EREJECT;
+		}
+	}
+	else if (tmpname != NULL)
+		unlinkat(fdroot, tmpname, 0);
+	free(tmpname);
+	close(fdout);
+	close(fdin);
+	errno = error;
+	return ret;
+}
+
+static unsigned long long _copy_treesize(int fdroot, const char *src, int depth)
+{
+	struct stat filestat;
+	if (fstatat(fdroot, src, &filestat, AT_SYMLINK_NOFOLLOW) == -1)
+		return 0;
+	if (!S_ISDIR(filestat.st_mode))
+		return S_ISREG(filestat.st_mode)? filestat.st_size: 0;
+	if (depth >= COPY_MAXDEPTH)
+		return 0;
+	int fddir = openat(fdroot, src, O_RDONLY | O_DIRECTORY);
+	DIR *dirstream = (fddir >= 0)? fdopendir(fddir): NULL;
+	if (dirstream == NULL)
+	{
+		if (fddir >= 0)
+			close(fddir);
+		return 0;
+	}
+	unsigned long long size = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dirstream)) != NULL)
+	{
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		char path[PATH_MAX];
+		if (snprintf(path, sizeof(path), "%s/%s", src, ent->d_name) < (int)sizeof(path))
+			size += _copy_treesize(fdroot, path, depth + 1);
+	}
+	closedir(dirstream);
+	return size;
+}
+
+/**
+ * the directories are created with the mode of the source,
+ * the files of the uploads in progress are not copied.
+ */
+static int _copy_tree(int fdroot, const char *src, const char *dst, int expire, int depth)
+{
+	struct stat filestat;
+	if (fstatat(fdroot, src, &filestat, AT_SYMLINK_NOFOLLOW) == -1)
+		return EREJECT;
+	if (S_ISREG(filestat.st_mode))
+		return (_copy_file(fdroot, src, dst, expire, 0) == ESUCCESS)? ESUCCESS: EREJECT;
+	if (S_ISLNK(filestat.st_mode))
+	{
+		char target[PATH_MAX];
+		ssize_t length = readlinkat(fdroot, src, target, sizeof(target) - 1);
+		if (length < 0)
+			return EREJECT;
+		target[length] = '\0';
+		return (symlinkat(target, fdroot, dst) == 0)? ESUCCESS: EREJECT;
+	}
+	if (!S_ISDIR(filestat.st_mode))
+		return ESUCCESS;
+	if (depth >= COPY_MAXDEPTH)
+	{
+		errno = ELOOP;
+		return EREJECT;
+	}
+	if (mkdirat(fdroot, dst, filestat.st_mode & 0777) == -1)
+		return EREJECT;
+	int fddir = openat(fdroot, src, O_RDONLY | O_DIRECTORY);
+	DIR *dirstream = (fddir >= 0)? fdopendir(fddir): NULL;
+	if (dirstream == NULL)
+	{
+		if (fddir >= 0)
+			close(fddir);
+		return EREJECT;
+	}
+	int ret = ESUCCESS;
+	struct dirent *ent;
+	while (ret == ESUCCESS && (ent = readdir(dirstream)) != NULL)
+	{
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..") ||
+			_upload_istemporary(ent->d_name))
+			continue;
+		char srcpath[PATH_MAX];
+		char dstpath[PATH_MAX];
+		if (snprintf(srcpath, sizeof(srcpath), "%s/%s", src, ent->d_name) >= (int)sizeof(srcpath) ||
+			snprintf(dstpath, sizeof(dstpath), "%s/%s", dst, ent->d_name) >= (int)sizeof(dstpath))
+		{
+			errno = ENAMETOOLONG;
+			ret = EREJECT;
+			break;
+		}
+		ret = _copy_tree(fdroot, srcpath, dstpath, expire, depth + 1);
+	}
+	closedir(dirstream);
+	return ret;
+}
+
+/**
+ * "cp" copies a file, "cp -r" a directory too.
+ * The large copies continue in background.
+ */
+static int _document_copy(_mod_document_mod_t *mod, int fdroot, const char *src,
+		const char *dst, int recursive)
+{
+	struct stat filestat;
+	int expire = _upload_expire(mod->config);
+	if (dst == NULL || dst[0] == '\0')
+	{
+		errno = EINVAL;
+		return EREJECT;
+	}
+	if (fstatat(fdroot, src, &filestat, 0) == -1)
+		return EREJECT;
+	if (S_ISREG(filestat.st_mode))
+		return _copy_file(fdroot, src, dst, expire, 1);
+	if (!S_ISDIR(filestat.st_mode) || !recursive)
+	{
+		errno = EISDIR;
+		return EREJECT;
+	}
+	if (faccessat(fdroot, dst, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+	{
+		errno = EEXIST;
+		return EREJECT;
+	}
+	if (_copy_treesize(fdroot, src, 0) <= COPY_ASYNCSIZE)
+		return _copy_tree(fdroot, src, dst, expire, 0);
+
+	copy_job_t *job = _copy_job(fdroot, src, dst, expire);
+	if (job == NULL)
+		return EREJECT;
+	int ret = _copy_background(job);
+	if (ret != ECONTINUE)
+		_copy_jobfree(job);
+	return ret;
+}
+
 static int _document_renameat(int fddir, const char *oldpath, const char *newpath)
 {
 	return renameat(fddir, oldpath, fddir, newpath);
@@ -224,6 +1302,350 @@ static int changename(int fdroot, http_message_t *UNUSED(request), const char *o
 	return ret;
 }
 
+/**
+ * the batch is a JSON array of operations:
+ * [{"op":"mv","path":"/dir/file","to":"/dir/newfile"},{"op":"rm","path":"/dir/old"},...]
+ * "op" is one of "mv", "ln", "rm", "mkdir", "chmod" (with "mode":"644").
+ * The paths are relative to the docroot as X-POST-ARG.
+ */
+#define BATCH_MAXSIZE (256 * 1024)
+#define BATCH_MAXOPS 1024
+
+struct document_batch_s
+{
+	char *data;
+	size_t length;
+};
+
+typedef struct batch_op_s batch_op_t;
+struct batch_op_s
+{
+	char *op;
+	char *path;
+	char *to;
+	char *mode;
+};
+
+static char *_batch_skipspace(char *data)
+{
+	while (*data == ' ' || *data == '\t' || *data == '\r' || *data == '\n')
+		data++;
+	return data;
+}
+
+/**
+ * the string is decoded in place, only the simple escapes are accepted
+ */
+static char *_batch_string(char *data, char **value)
+{
+	if (*data != '"')
+		return NULL;
+	data++;
+	*value = data;
+	char *out = data;
+	while (*data != '"')
+	{
+		if (*data == '\0')
+			return NULL;
+		if (*data == '\\')
+		{
+			data++;
+			switch (*data)
+			{
+			case 'n':
+				*out = '\n';
+			break;
+			case 't':
+				*out = '\t';
+			break;
+			case '"':
+			case '\\':
+			case '/':
+				*out = *data;
+			break;
+			default:
+				return NULL;
+			}
+		}
+		else
+			*out = *data;
+		out++;
+		data++;
+	}
+	*out = '\0';
+	return data + 1;
+}
+
+static char *_batch_op(char *data, batch_op_t *op)
+{
+	memset(op, 0, sizeof(*op));
+	data = _batch_skipspace(data);
+	if (*data != '{')
+		return NULL;
+	data = _batch_skipspace(data + 1);
+	while (data != NULL && *data != '}')
+	{
+		char *key = NULL;
+		char *value = NULL;
+		data = _batch_string(data, &key);
+		if (data == NULL)
+			return NULL;
+		data = _batch_skipspace(data);
+		if (*data != ':')
+			return NULL;
+		data = _batch_string(_batch_skipspace(data + 1), &value);
+		if (data == NULL)
+			return NULL;
+		if (!strcmp(key, "op"))
+			op->op = value;
+		else if (!strcmp(key, "path"))
+			op->path = value;
+		else if (!strcmp(key, "to"))
+			op->to = value;
+		else if (!strcmp(key, "mode"))
+			op->mode = value;
+		data = _batch_skipspace(data);
+		if (*data == ',')
+			data = _batch_skipspace(data + 1);
+		else if (*data != '}')
+			return NULL;
+	}
+	if (data == NULL || op->op == NULL || op->path == NULL)
+		return NULL;
+	return data + 1;
+}
+
+static void _batch_appendstring(http_message_t *response, const char *string)
+{
+	httpmessage_appendcontent(response, STRING_REF("\""));
+	const char *start = string;
+	for (; *string != '\0'; string++)
+	{
+		if (*string != '"' && *string != '\\' && (unsigned char)*string >= ' ')
+			continue;
+		httpmessage_appendcontent(response, start, string - start);
+		char escape[8];
+		if (*string == '"' || *string == '\\')
+			snprintf(escape, sizeof(escape), "\\%c", *string);
+		else
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*string);
+		httpmessage_appendcontent(response, escape, -1);
+		start = string + 1;
+	}
+	httpmessage_appendcontent(response, start, string - start);
+	httpmessage_appendcontent(response, STRING_REF("\""));
+}
+
+/**
+ * the path stays into the docroot and the rules of the server
+ * (htaccess of the document, userfilter...) are checked for each path
+ * with the method of the equivalent request.
+ */
+static const char *_document_path(const _mod_document_mod_t *mod, http_message_t *request,
+		const char *method, const char *path)
+{
+	if (path == NULL)
+		return NULL;
+	while (path[0] == '/')
+		path++;
+	if (path[0] == '\0' || !strcmp(path, "..") || !strncmp(path, "../", 3) ||
+		strstr(path, "/../") != NULL ||
+		(strlen(path) >= 3 && !strcmp(path + strlen(path) - 3, "/..")))
+		return NULL;
+	char uri[PATH_MAX];
+	if (snprintf(uri, sizeof(uri), "/%s", path) >= (int)sizeof(uri))
+		return NULL;
+	if (htaccess_check(&mod->config->htaccess, uri, NULL) == EREJECT ||
+		ouistiti_checkpath(mod->server, request, method, uri) != ESUCCESS)
+		return NULL;
+	return path;
+}
+
+static const char *_batch_path(document_connector_t *private, http_message_t *request,
+		const char *method, const char *path)
+{
+	return _document_path(private->mod, request, method, path);
+}
+
+static int _batch_run(document_connector_t *private, http_message_t *request, const batch_op_t *op)
+{
+	int fdroot = private->fdroot;
+	const char *path = NULL;
+	const char *to = NULL;
+	int ret = -1;
+	errno = 0;
+	if (!strcmp(op->op, "rm"))
+	{
+		struct stat filestat;
+		if ((path = _batch_path(private, request, str_delete, op->path)) == NULL)
+			errno = EACCES;
+		else if (fstatat(fdroot, path, &filestat, AT_SYMLINK_NOFOLLOW) == 0)
+			ret = unlinkat(fdroot, path, S_ISDIR(filestat.st_mode)? AT_REMOVEDIR: 0);
+	}
+	else if (!strcmp(op->op, "mkdir"))
+	{
+		if ((path = _batch_path(private, request, str_put, op->path)) == NULL)
+			errno = EACCES;
+		else
+			ret = mkdirat(fdroot, path, 0777);
+	}
+	else if (!strcmp(op->op, "chmod"))
+	{
+		if ((path = _batch_path(private, request, str_post, op->path)) == NULL)
+			errno = EACCES;
+		else if (op->mode == NULL)
+			errno = EINVAL;
+		else
+			ret = fchmodat(fdroot, path, strtol(op->mode, NULL, 8) & 07777, 0);
+	}
+	else if (!strcmp(op->op, "mv") || !strcmp(op->op, "ln"))
+	{
+		if ((path = _batch_path(private, request, str_post, op->path)) == NULL ||
+			op->to == NULL || (to = _batch_path(private, request, str_put, op->to)) == NULL)
+			errno = (op->to == NULL)? EINVAL: EACCES;
+		else if (!strcmp(op->op, "mv"))
+			ret = changename(fdroot, request, path, to, _document_renameat);
+#ifdef HAVE_SYMLINK
+		else
+			ret = changename(fdroot, request, path, to, _document_symlinkat);
+#endif
+	}
+	else
+		errno = EINVAL;
+	if (ret != 0 && errno == 0)
+		errno = EINVAL;
+	return (ret == 0)? 0: errno;
+}
+
+/**
+ * each operation is executed in the order of the array, an error
+ * doesn't stop the next operations.
+ */
+static int _batch_execute(document_connector_t *private, http_message_t *request,
+		http_message_t *response)
+{
+	document_batch_t *batch = private->batch;
+	char *data = _batch_skipspace(batch->data);
+	if (*data != '[')
+		return EREJECT;
+	data = _batch_skipspace(data + 1);
+	int nbops = 0;
+	httpmessage_addcontent(response, "text/json", STRING_REF("["));
+	while (*data != ']' && nbops < BATCH_MAXOPS)
+	{
+		batch_op_t op;
+		data = _batch_op(data, &op);
+		if (data == NULL)
+			break;
+		int error = _batch_run(private, request, &op);
+		warn("document: batch %s %s %s", op.op, op.path, (error)? strerror(error): "OK");
+		if (nbops > 0)
+			httpmessage_appendcontent(response, STRING_REF(","));
+		httpmessage_appendcontent(response, STRING_REF("\n{\"op\":"));
+		_batch_appendstring(response, op.op);
+		httpmessage_appendcontent(response, STRING_REF(",\"path\":"));
+		_batch_appendstring(response, op.path);
+		if (error)
+		{
+			httpmessage_appendcontent(response, STRING_REF(",\"result\":\"KO\",\"error\":"));
+			_batch_appendstring(response, strerror(error));
+		}
+		else
+			httpmessage_appendcontent(response, STRING_REF(",\"result\":\"OK\""));
+		httpmessage_appendcontent(response, STRING_REF("}"));
+		nbops++;
+		data = _batch_skipspace(data);
+		if (*data == ',')
+			data = _batch_skipspace(data + 1);
+	}
+	/// the operations after an error of syntax are not executed
+	if (data == NULL || *data != ']')
+	{
+		if (nbops > 0)
+			httpmessage_appendcontent(response, STRING_REF(","));
+		httpmessage_appendcontent(response, STRING_REF("\n{\"result\":\"KO\",\"error\":\"Invalid argument\"}"));
+	}
+	httpmessage_appendcontent(response, STRING_REF("\n]\n"));
+	return ESUCCESS;
+}
+
+void document_batchclose(document_connector_t *private)
+{
+	document_batch_t *batch = private->batch;
+	if (batch == NULL)
+		return;
+	free(batch->data);
+	free(batch);
+	private->batch = NULL;
+}
+
+/**
+ * the whole array is received before the first operation
+ */
+static int batch_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	document_connector_t *private = httpmessage_private(request, NULL);
+	document_batch_t *batch = private->batch;
+	if (batch == NULL)
+	{
+		batch = calloc(1, sizeof(*batch));
+		if (batch == NULL)
+		{
+			document_close(private, request);
+			httpmessage_result(response, RESULT_500);
+			return ESUCCESS;
+		}
+		private->batch = batch;
+	}
+
+	const char *input;
+	unsigned long long inputlen;
+	size_t rest = 1;
+	int error = 0;
+	inputlen = httpmessage_content(request, &input, &rest);
+	if (inputlen > 0 && inputlen != (unsigned long long)EREJECT)
+	{
+		char *data = NULL;
+		if (batch->length + inputlen < BATCH_MAXSIZE)
+			data = realloc(batch->data, batch->length + inputlen + 1);
+		if (data == NULL)
+		{
+			err("document: batch too large");
+			error = E2BIG;
+			rest = 0;
+		}
+		else
+		{
+			memcpy(data + batch->length, input, inputlen);
+			batch->length += inputlen;
+			data[batch->length] = '\0';
+			batch->data = data;
+		}
+	}
+	if (inputlen == EREJECT)
+	{
+		rest = 0;
+	}
+	if (rest < 1)
+	{
+		if (error == 0 && (batch->data == NULL ||
+			_batch_execute(private, request, response) != ESUCCESS))
+			error = EINVAL;
+		if (error)
+		{
+#ifdef RESULT_413
+			if (error == E2BIG)
+				httpmessage_result(response, RESULT_413);
+			else
+#endif
+				httpmessage_result(response, RESULT_400);
+			restheader_connector(request, response, error);
+		}
+		document_close(private, request);
+	}
+	return EINCOMPLETE;
+}
+
 int _document_getconnnectorpost(_mod_document_mod_t *mod,
 		int fdroot, const char *url, int urllen, const char **mime,
 		http_message_t *request, http_message_t *response,
@@ -231,11 +1653,20 @@ int _document_getconnnectorpost(_mod_document_mod_t *mod,
 {
 	int error = 0;
 	int fdfile = -1;
+	const char *cmd = httpmessage_REQUEST(request, "X-POST-CMD");
+	if (cmd && !strcmp("upload", cmd))
+		return _upload_create(mod, fdroot, url, request, response);
+	if (cmd && !strcmp("batch", cmd))
+	{
+		/// the directory of the request receives the batch
+		fdfile = openat(fdroot, (url[0] != '\0')? url: ".", O_RDONLY | O_DIRECTORY);
+		if (fdfile >= 0)
+			*connector = batch_connector;
+		return fdfile;
+	}
 	if (faccessat(fdroot, url, F_OK, 0) == -1)
 		return fdfile;
 
-	const char *cmd = httpmessage_REQUEST(request, "X-POST-CMD");
-
 	errno = 0;
 	if (cmd && !strcmp("mv", cmd))
 	{
@@ -247,6 +1678,36 @@ int _document_getconnnectorpost(_mod_document_mod_t *mod,
 		error = errno;
 		fdfile = 0; /// The request is complete by this connector
 	}
+	else if (cmd && (!strcmp("cp", cmd) || !strcmp("cp -r", cmd)))
+	{
+		const char *postarg = httpmessage_REQUEST(request, "X-POST-ARG");
+		/// the destination is checked like the path of a PUT request
+		const char *dst = _document_path(mod, request, str_put, postarg);
+		int ret = EREJECT;
+		errno = EACCES;
+		if (dst != NULL)
+		{
+			warn("document: copy %s to %s", url, dst);
+			errno = 0;
+			ret = _document_copy(mod, fdroot, url, dst, !strcmp("cp -r", cmd));
+		}
+		else
+			err("document: copy %s to %s refused", url, postarg);
+		error = (ret == EREJECT)? errno: 0;
+		if (ret == ECONTINUE)
+#ifdef RESULT_202
+			httpmessage_result(response, RESULT_202);
+#else
+			httpmessage_result(response, RESULT_200);
+#endif
+		else if (ret == ESUCCESS)
+#ifdef RESULT_201
+			httpmessage_result(response, RESULT_201);
+#else
+			httpmessage_result(response, RESULT_200);
+#endif
+		fdfile = 0; /// The request is complete by this connector
+	}
 	else if (cmd && !strcmp("chmod", cmd))
 	{
 		warn("chmod %s", url);
@@ -275,6 +1736,7 @@ int _document_getconnnectorpost(_mod_document_mod_t *mod,
 		fdfile = 0; /// The request is complete by this connector
 	}
 	restheader_connector(request, response, error);
+	errno = error;
 	return fdfile;
 }
 
@@ -5,6 +5,7 @@ mod_mbedtls_SOURCES+=mod_tls.c
 mod_mbedtls_CFLAGS+=$(LIBHTTPSERVER_CFLAGS)
 mod_mbedtls_LDFLAGS+=$(LIBHTTPSERVER_LDFLAGS)
 mod_mbedtls_LIBS+=$(LIBHTTPSERVER_NAME)
+mod_mbedtls_LIBS+=ouiutils
 mod_mbedtls_LIBS+=mbedtls mbedx509 mbedcrypto
 mod_mbedtls_LIBRARY+=libconfig
 mod_mbedtls_ALIAS-$(MODULES)+=mod_tls.so
@@ -86,6 +86,18 @@ void *mod_openssl_create(http_server_t *server, mod_tls_t *modconfig)
 
 	ctx = SSL_CTX_new(method);
 	SSL_CTX_set_ecdh_auto(ctx, 1);
+	if (modconfig->options & TLS_KTLS)
+	{
+#ifdef SSL_OP_ENABLE_KTLS
+		/**
+		 * openssl keeps the encryption in user space
+		 * if the kernel doesn't support the cipher
+		 */
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		warn("tls: ktls not supported by this version of openssl");
+#endif
+	}
 	if (modconfig->crtfile)
 	{
 		int ret = SSL_CTX_use_certificate_file(ctx, (const char *) modconfig->crtfile, SSL_FILETYPE_PEM);
@@ -168,6 +180,10 @@ static void *_tlsserver_create(void *arg, http_client_t *clt)
 		return NULL;
 	}
 	dbg("tls: connection accepted");
+#ifdef BIO_get_ktls_send
+	if (BIO_get_ktls_send(SSL_get_wbio(ctx->ssl)))
+		dbg("tls: ktls send enabled");
+#endif
 	return ctx;
 }
 
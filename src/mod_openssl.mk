@@ -7,6 +7,7 @@ mod_openssl_CFLAGS+=-I../src
 mod_openssl_CFLAGS+=$(LIBHTTPSERVER_CFLAGS)
 mod_openssl_LDFLAGS+=$(LIBHTTPSERVER_LDFLAGS)
 mod_openssl_LIBS+=$(LIBHTTPSERVER_NAME)
+mod_openssl_LIBS+=ouiutils
 mod_openssl_LIBRARY+=libconfig
 mod_openssl_ALIAS-$(MODULES)+=mod_tls.so
 
@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/sendfile.h>
 #include <errno.h>
+#include <time.h>
 
 #include "ouistiti/httpserver.h"
 #include "ouistiti/utils.h"
@@ -48,54 +49,329 @@
 #define dbg(...)
 #endif
 
-int range_connector(void *arg, http_message_t *request, http_message_t *response)
+/**
+ * the ranges are limited to protect the server against the requests
+ * with a lot of small ranges.
+ */
+#define RANGE_MAXRANGES 16
+
+typedef struct range_part_s range_part_t;
+struct range_part_s
 {
-	document_connector_t *private = httpmessage_private(request, NULL);
+	unsigned long long offset;
+	unsigned long long size;
+};
 
-	if (private == NULL || private->type & DOCUMENT_DIRLISTING || !(private->fdfile > 0))
-		return EREJECT;
+struct document_range_s
+{
+	unsigned long long filesize;
+	const char *mime;
+	char boundary[40];
+	char contenttype[80];
+	int nbparts;
+	int current;
+	int state;
+	/// the header of the current part or the final boundary
+	char header[256];
+	size_t headerlen;
+	size_t headeroffset;
+	range_part_t parts[RANGE_MAXRANGES];
+};
+
+enum
+{
+	RANGE_START,
+	RANGE_HEADER,
+	RANGE_BODY,
+	RANGE_END,
+};
+
+/**
+ * RFC 7233 2.1: the invalid ranges are ignored (return EREJECT),
+ * the ranges after the end of the file are not satisfiable.
+ * return the number of satisfiable parts.
+ */
+static int _range_cmp(const void *a, const void *b)
+{
+	const range_part_t *parta = a;
+	const range_part_t *partb = b;
+	if (parta->offset == partb->offset)
+		return 0;
+	return (parta->offset < partb->offset)? -1: 1;
+}
 
-	int filesize = private->size;
+/**
+ * the parts are sent in the order of the file, the overlapping
+ * and the successive parts are merged.
+ */
+static int _range_merge(range_part_t *parts, int nbparts)
+{
+	qsort(parts, nbparts, sizeof(*parts), _range_cmp);
+	int nbmerged = 1;
+	for (int i = 1; i < nbparts; i++)
+	{
+		range_part_t *previous = &parts[nbmerged - 1];
+		if (parts[i].offset <= previous->offset + previous->size)
+		{
+			if (parts[i].offset + parts[i].size > previous->offset + previous->size)
+				previous->size = parts[i].offset + parts[i].size - previous->offset;
+			continue;
+		}
+		parts[nbmerged++] = parts[i];
+	}
+	return nbmerged;
+}
 
-	const char *rangesize = NULL;
-	const char *range = httpmessage_REQUEST(request,"Range");
-	if (range != NULL && range[0] != '\0')
-		rangesize = strstr(range, "bytes=");
+static int _range_parse(const char *value, unsigned long long filesize, range_part_t *parts)
+{
+	int nbparts = 0;
 
-	if (rangesize)
+	while (*value == ' ') value++;
+	if (strncmp(value, "bytes=", 6))
+		return EREJECT;
+	value += 6;
+	do
 	{
-		int offset;
-		rangesize += 6;
-		offset = atoi(rangesize);
-		if (offset > filesize)
+		unsigned long long first;
+		unsigned long long last = filesize - 1;
+		char *end = NULL;
+
+		while (*value == ' ' || *value == ',') value++;
+		if (*value == '-')
 		{
-			goto NOSATISFIABLE;
+			/// suffix range "bytes=-500"
+			if (value[1] < '0' || value[1] > '9')
+				return EREJECT;
+			unsigned long long length = strtoull(value + 1, &end, 10);
+			if (length == 0 || filesize == 0)
+				first = filesize;
+			else
+				first = (length < filesize)? filesize - length: 0;
 		}
-		private->offset = offset;
-		const char *end = strchr(rangesize, '-');
-		if (end != NULL)
+		else if (*value >= '0' && *value <= '9')
 		{
-			offset = filesize;
-			if (*(end+1) >= '0' && *(end+1) <= '9')
-				offset = atoi(end+1);
-			if (*(end+1) == '*' || *(end+1) == '\0')
-				offset = private->size - 1;
-			if (offset > (filesize - 1) || offset < private->offset)
+			first = strtoull(value, &end, 10);
+			if (*end != '-')
+				return EREJECT;
+			end++;
+			if (*end >= '0' && *end <= '9')
 			{
-				goto NOSATISFIABLE;
+				unsigned long long rangelast = strtoull(end, &end, 10);
+				if (rangelast < first)
+					return EREJECT;
+				if (rangelast < last)
+					last = rangelast;
 			}
-			private->size = offset - private->offset + 1;
+			else if (*end == '*')
+				end++;
 		}
+		else
+			return EREJECT;
+		while (*end == ' ') end++;
+		if (*end != ',' && *end != '\0')
+			return EREJECT;
+		value = end;
 
-		char range[256];
-		int rangelen = snprintf(range, 256, "bytes %lu-%d/%d",
-					(unsigned long)private->offset,
-					offset,
-					filesize);
-		httpmessage_addheader(response, "Content-Range", range, rangelen);
-		httpmessage_result(response, RESULT_206);
+		if (first >= filesize)
+			continue;
+		/// the following ranges are merged at once, the others at the end
+		if (nbparts > 0 && first >= parts[nbparts - 1].offset &&
+			first <= parts[nbparts - 1].offset + parts[nbparts - 1].size)
+		{
+			range_part_t *previous = &parts[nbparts - 1];
+			if (last + 1 > previous->offset + previous->size)
+				previous->size = last + 1 - previous->offset;
+			continue;
+		}
+		if (nbparts == RANGE_MAXRANGES)
+			return EREJECT;
+		parts[nbparts].offset = first;
+		parts[nbparts].size = last - first + 1;
+		nbparts++;
+	} while (*value != '\0');
+	if (nbparts > 1)
+		nbparts = _range_merge(parts, nbparts);
+	return nbparts;
+}
+
+/**
+ * If-Range contains the ETag or the Last-Modified date
+ * sent with the previous response.
+ */
+static int _range_ifrange(http_message_t *request, document_connector_t *private)
+{
+	const char *ifrange = httpmessage_REQUEST(request, "If-Range");
+	if (ifrange == NULL || ifrange[0] == '\0')
+		return ESUCCESS;
+	struct stat filestat;
+	if (fstat(private->fdfile, &filestat) == -1)
+		return EREJECT;
+	char etag[48];
+	char lastmodified[32];
+	document_validators(&filestat, NULL, etag, sizeof(etag), lastmodified, sizeof(lastmodified));
+	/// a weak ETag is never valid for a range
+	if (ifrange[0] == '"')
+		return strcmp(ifrange, etag)? EREJECT: ESUCCESS;
+	return strcmp(ifrange, lastmodified)? EREJECT: ESUCCESS;
+}
 
-		lseek(private->fdfile, private->offset, SEEK_SET);
+/**
+ * the header of the part "index" or the final boundary
+ */
+static size_t _range_partheader(const document_range_t *range, int index, char *buffer, size_t size)
+{
+	int length;
+	if (index < range->nbparts)
+	{
+		const range_part_t *part = &range->parts[index];
+		length = snprintf(buffer, size, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %llu-%llu/%llu\r\n\r\n",
+				range->boundary, range->mime, part->offset,
+				part->offset + part->size - 1, range->filesize);
+	}
+	else
+		length = snprintf(buffer, size, "\r\n--%s--\r\n", range->boundary);
+	if (length < 0 || (size_t)length >= size)
+		return 0;
+	return length;
+}
+
+static unsigned long long _range_multipart(document_connector_t *private, document_range_t *range)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	snprintf(range->boundary, sizeof(range->boundary), "ouistiti%08lx%08lx%04x",
+			(unsigned long)now.tv_sec, (unsigned long)now.tv_nsec, (unsigned int)private->fdfile);
+	snprintf(range->contenttype, sizeof(range->contenttype), "multipart/byteranges; boundary=%s",
+			range->boundary);
+
+	unsigned long long length = 0;
+	for (int i = 0; i <= range->nbparts; i++)
+	{
+		char header[256];
+		length += _range_partheader(range, i, header, sizeof(header));
+		if (i < range->nbparts)
+			length += range->parts[i].size;
+	}
+	return length;
+}
+
+/**
+ * each part is sent by the transfer function of the document,
+ * at the offset of the part inside the file.
+ */
+static int _range_partsconnector(void *arg, http_message_t *request, http_message_t *response)
+{
+	document_connector_t *private = httpmessage_private(request, NULL);
+	document_range_t *range = private->range;
+	int ret;
+
+	switch (range->state)
+	{
+	case RANGE_START:
+		/// the first loop of the transfer sends the header of the response
+		ret = private->transfer(private, response);
+		if (ret < 0 && errno != EAGAIN)
+			break;
+		range->current = 0;
+		range->headerlen = _range_partheader(range, 0, range->header, sizeof(range->header));
+		range->headeroffset = 0;
+		range->state = RANGE_HEADER;
+		return ECONTINUE;
+	case RANGE_HEADER:
+		ret = httpclient_send(private->ctl, range->header + range->headeroffset,
+				range->headerlen - range->headeroffset);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return ECONTINUE;
+		if (ret < 0)
+			break;
+		range->headeroffset += ret;
+		if (range->headeroffset < range->headerlen)
+			return ECONTINUE;
+		if (range->current == range->nbparts)
+		{
+			warn("document: send %d parts of %s", range->nbparts, private->url);
+			document_close(private, request);
+			return ESUCCESS;
+		}
+		private->offset = range->parts[range->current].offset;
+		private->size = range->parts[range->current].size;
+		range->state = RANGE_BODY;
+		return ECONTINUE;
+	case RANGE_BODY:
+		ret = private->transfer(private, response);
+		if (ret < 0 && errno == EAGAIN)
+			return ECONTINUE;
+		if (ret <= 0)
+			break;
+		private->offset += ret;
+		private->size -= ret;
+		if (private->size > 0)
+			return ECONTINUE;
+		range->current++;
+		range->headerlen = _range_partheader(range, range->current, range->header, sizeof(range->header));
+		range->headeroffset = 0;
+		range->state = RANGE_HEADER;
+		return ECONTINUE;
+	}
+	err("document: send %s (%d,%s)", private->url, ret, strerror(errno));
+	document_close(private, request);
+	return EREJECT;
+}
+
+static int _range_setparts(document_connector_t *private, const range_part_t *parts, int nbparts)
+{
+	document_range_t *range = calloc(1, sizeof(*range));
+	if (range == NULL)
+		return EREJECT;
+	range->filesize = private->size;
+	range->mime = (private->mime != NULL)? private->mime: "application/octet-stream";
+	range->nbparts = nbparts;
+	memcpy(range->parts, parts, nbparts * sizeof(*parts));
+	private->range = range;
+	private->size = _range_multipart(private, range);
+	private->mime = range->contenttype;
+	/// the parts are not contiguous, they are read
+	if (private->transfer == mod_send_mmap)
+		private->transfer = mod_send_read;
+	if (private->func != NULL)
+		private->func = _range_partsconnector;
+	return ESUCCESS;
+}
+
+int range_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	document_connector_t *private = httpmessage_private(request, NULL);
+
+	if (private == NULL || private->type & DOCUMENT_DIRLISTING || !(private->fdfile > 0))
+		return EREJECT;
+	/// the compressed content has not the same ranges than the file
+	if (private->type & DOCUMENT_DEFLATE)
+		return EREJECT;
+
+	unsigned long long filesize = private->size;
+	range_part_t parts[RANGE_MAXRANGES];
+	int nbparts = EREJECT;
+	const char *value = httpmessage_REQUEST(request, "Range");
+	if (value != NULL && value[0] != '\0' && _range_ifrange(request, private) == ESUCCESS)
+		nbparts = _range_parse(value, filesize, parts);
+	if (nbparts == 0)
+		goto NOSATISFIABLE;
+
+	if (nbparts == 1)
+	{
+		private->offset = parts[0].offset;
+		private->size = parts[0].size;
+		char contentrange[80];
+		int length = snprintf(contentrange, sizeof(contentrange), "bytes %llu-%llu/%llu",
+					private->offset, private->offset + private->size - 1, filesize);
+		httpmessage_addheader(response, "Content-Range", contentrange, length);
+		httpmessage_result(response, RESULT_206);
+	}
+	else if (nbparts > 1 && _range_setparts(private, parts, nbparts) == ESUCCESS)
+		httpmessage_result(response, RESULT_206);
+	else if (nbparts == EREJECT && value != NULL && value[0] != '\0')
+	{
+		dbg("document: range ignored %s", value);
 	}
 	httpmessage_addheader(response, "Accept-Ranges", STRING_REF("bytes"));
 
@@ -103,11 +379,17 @@ int range_connector(void *arg, http_message_t *request, http_message_t *response
 
 NOSATISFIABLE:
 	{
-		char range[256];
-		int rangelen = snprintf(range, 256, "bytes */%d", filesize);
-		httpmessage_addheader(response, "Content-Range", range, rangelen);
+		char contentrange[80];
+		int length = snprintf(contentrange, sizeof(contentrange), "bytes */%llu", filesize);
+		httpmessage_addheader(response, "Content-Range", contentrange, length);
 		httpmessage_result(response, RESULT_416);
 		document_close(private, request);
 	}
 	return ESUCCESS;
 }
+
+void document_rangeclose(document_connector_t *private)
+{
+	free(private->range);
+	private->range = NULL;
+}
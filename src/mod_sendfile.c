@@ -33,8 +33,11 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
 #include <errno.h>
-#include <signal.h>
 
 #include "../compliant.h"
 #include "ouistiti/httpserver.h"
@@ -48,68 +51,97 @@
 #define dbg(...)
 #endif
 
-#define sighandler_t __sighandler_t
+/**
+ * sendfile(2) transfers at most 0x7ffff000 bytes
+ */
+#define SENDFILE_MAXSIZE 0x7ffff000
 
-#define CONTENTSIZE 1024
-int mod_send_sendfile(document_connector_t *private, http_message_t *response)
+static void _sendfile_cork(int sock, int cork)
 {
-	int ret;
-	ssize_t size;
+#ifdef TCP_CORK
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+#endif
+}
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+/**
+ * the TLS layer may give the encryption of the connection to the kernel,
+ * the file is sent with sendfile after the header written by SSL_write.
+ */
+int mod_sendfile_ktls(http_client_t *ctl)
+{
+#ifdef TLS_TX
+	int sock = httpclient_socket(ctl);
+	struct tls_crypto_info info;
+	socklen_t length = sizeof(info);
+	/// getsockopt fails with EBUSY if the TX encryption is not set
+	if (sock > 0 && getsockopt(sock, SOL_TLS, TLS_TX, &info, &length) == 0)
+		return 1;
+#endif
+	return 0;
+}
+
+/**
+ * SIGPIPE is ignored by the main process, a closed connection
+ * returns EPIPE.
+ */
+int mod_send_sendfile(document_connector_t *private, http_message_t *UNUSED(response))
+{
+	int sock = httpclient_socket(private->ctl);
 
 	if (!(private->type & DOCUMENT_SENDFILE))
 	{
 		/**
 		 * the first loop must not send content
 		 * it should send the header first.
+		 * The socket is corked to send the header with the
+		 * beginning of the file.
 		 */
-		private->type |= DOCUMENT_SENDFILE;
+		private->type |= DOCUMENT_SENDFILE | DOCUMENT_CORK;
+		_sendfile_cork(sock, 1);
 		errno = EAGAIN;
 		return ECONTINUE;
 	}
 
 	/**
-	 * check the size for the rnage support
-	 * the size may be different of the real size file
+	 * the size may be different of the real size file with range,
+	 * the offset of the request is given to sendfile.
 	 */
-	size = (private->size < CONTENTSIZE)? private->size : CONTENTSIZE;
-#ifdef HAVE_SIGACTION
-	sigset_t sigset;
-	sigemptyset (&sigset);
-	sigaddset(&sigset, SIGPIPE);
-	sigprocmask(SIG_BLOCK, &sigset, NULL);
-#else
-	sighandler_t handler_old;
-	handler_old = signal(SIGPIPE, SIG_IGN);
-#endif
-
-	do
+	size_t size = (private->size < SENDFILE_MAXSIZE)? private->size : SENDFILE_MAXSIZE;
+	off_t offset = private->offset;
+	size_t sent = 0;
+	ssize_t ret = 0;
+	while (sent < size)
 	{
-		ret = httpclient_wait(httpmessage_client(response), 1);
+		ret = sendfile(sock, private->fdfile, &offset, size - sent);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		sent += ret;
 	}
-	while (ret == EINCOMPLETE);
-	if (ret > 0)
+	if (private->type & DOCUMENT_CORK)
 	{
-		do
-		{
-			int sock = ret;
-			ret = sendfile(sock, private->fdfile, NULL, size);
-		}
-		while (ret < 0 && errno == EINTR);
+		private->type &= ~DOCUMENT_CORK;
+		_sendfile_cork(sock, 0);
 	}
-	if (ret >= 0)
-#ifdef HAVE_SIGACTION
-		sigprocmask(SIG_UNBLOCK, &sigset, NULL);
-#else
-		signal(SIGPIPE, handler_old);
-#endif
-	if (ret == 0 && size > 0)
+
+	if (sent > 0)
+		return sent;
+	if (ret < 0)
 	{
-		ret = -1;
-		errno = EAGAIN;
+		/// the socket is full, the event loop will call again
+		if (errno == EWOULDBLOCK)
+			errno = EAGAIN;
+		if (errno != EAGAIN)
+			warn("sendfile %ld %d", (long)ret, errno);
+		return -1;
 	}
-	if (ret < 0)
-		warn("sendfile %d %d", ret, errno);
-	return ret;
+	/// the file is shorter than expected
+	return 0;
 }
 
 /**
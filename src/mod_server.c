@@ -85,6 +85,11 @@ static void *mod_server_config(config_setting_t *iterator, server_t *server)
 		if (options && utils_searchexp("otherorigin", options, NULL) == ESUCCESS)
 			security->options |= SECURITY_OTHERORIGIN;
 	}
+	/**
+	 * the policy of the server, the documents with their own policy
+	 * replace it for their files.
+	 */
+	config_setting_lookup_string(iterator, "cachecontrol", &security->cachecontrol);
 	return security;
 }
 #else
@@ -100,20 +105,31 @@ static int _server_connector(void *arg, http_message_t *request, http_message_t
 	mod_security_t *config = mod->config;
 	int ret = EREJECT;
 	int options = 0;
+	const char *cachecontrol = NULL;
 
 	const char *software = httpmessage_SERVER(request, "software");
 	httpmessage_addheader(response, "Server", software, -1);
 	if (config)
 	{
 		options = config->options;
+		cachecontrol = config->cachecontrol;
 	}
 	if (!(options & SECURITY_FRAME))
 	{
 		httpmessage_addheader(response, "X-Frame-Options", STRING_REF("DENY"));
 	}
-	if (!(options & SECURITY_CACHE))
+	const char *policy = ouistiti_cachepolicy(mod->server, request);
+	if (policy != NULL)
 	{
-		httpmessage_addheader(response, "Cache-Control", STRING_REF("no-cache,no-store,max-age=0,must-revalidate"));
+		httpmessage_addheader(response, str_cachecontrol, policy, -1);
+	}
+	else if (!(options & SECURITY_CACHE) && cachecontrol != NULL)
+	{
+		httpmessage_addheader(response, str_cachecontrol, cachecontrol, -1);
+	}
+	else if (!(options & SECURITY_CACHE))
+	{
+		httpmessage_addheader(response, str_cachecontrol, STRING_REF("no-cache,no-store,max-age=0,must-revalidate"));
 		httpmessage_addheader(response, "Pragma", STRING_REF("no-cache"));
 		httpmessage_addheader(response, "Expires", STRING_REF("0"));
 	}
@@ -42,6 +42,7 @@ extern "C"
 typedef struct mod_security_s
 {
 	int options;
+	const char *cachecontrol;
 } mod_security_t;
 
 extern const module_t mod_server;
@@ -36,6 +36,7 @@
 
 #include "ouistiti/log.h"
 #include "ouistiti/httpserver.h"
+#include "ouistiti/utils.h"
 #ifdef httpserver_config
 #include "ouistiti/config.h"
 #endif
@@ -62,6 +63,10 @@ void *tls_config(void *arg, server_t *server)
 		config_setting_lookup_string(configtls, "keyfile", (const char **)&tls->keyfile);
 		config_setting_lookup_string(configtls, "cachain", (const char **)&tls->cachain);
 		config_setting_lookup_string(configtls, "dhmfile", (const char **)&tls->dhmfile);
+		const char *options = NULL;
+		config_setting_lookup_string(configtls, "options", &options);
+		if (utils_searchexp("ktls", options, NULL) == ESUCCESS)
+			tls->options |= TLS_KTLS;
 	}
 	return tls;
 }
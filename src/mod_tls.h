@@ -38,6 +38,8 @@ extern "C"
 
 extern const char str_tls[4];
 
+#define TLS_KTLS 0x01
+
 typedef struct mod_tls_s mod_tls_t;
 struct mod_tls_s
 {
@@ -45,6 +47,7 @@ struct mod_tls_s
 	char *keyfile;
 	char *cachain;
 	char *dhmfile;
+	int options;
 };
 
 extern const module_t mod_tls;
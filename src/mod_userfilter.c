@@ -359,13 +359,14 @@ static int _jsonifyrule(_mod_userfilter_t *ctx, int64_t id, http_message_t *resp
 	return ret;
 }
 
-static int userfilter_connector(void *arg, http_message_t *request, http_message_t *response)
+/**
+ * the rules are checked for the request or for another uri
+ * (see ouistiti_checkpath).
+ */
+static int _userfilter_checkpath(void *arg, http_message_t *request, const char *method, const char *uri)
 {
 	_mod_userfilter_t *ctx = (_mod_userfilter_t *)arg;
 	const mod_userfilter_t *config = ctx->config;
-	int ret = ESUCCESS;
-	const char *uri = httpmessage_REQUEST(request,"uri");
-	const char *method = httpmessage_REQUEST(request, "method");
 	const char *user = auth_info(request, STRING_REF(str_user));
 	if (user == NULL)
 		user = str_anonymous;
@@ -376,12 +377,24 @@ static int userfilter_connector(void *arg, http_message_t *request, http_message
 		 * this path is always allowed
 		 */
 		userfilter_dbg("userfilter: forward to allowed path %s", config->allow);
-		ret = EREJECT;
+		return ESUCCESS;
 	}
-	else if (_request(ctx, method, user,
+	return _request(ctx, method, user,
 				auth_info(request, STRING_REF(str_group)),
 				auth_info(request, STRING_REF(str_home)),
-				uri) == 0)
+				uri);
+}
+
+static int userfilter_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	int ret = ESUCCESS;
+	const char *uri = httpmessage_REQUEST(request,"uri");
+	const char *method = httpmessage_REQUEST(request, "method");
+	const char *user = auth_info(request, STRING_REF(str_user));
+	if (user == NULL)
+		user = str_anonymous;
+
+	if (_userfilter_checkpath(arg, request, method, uri) == ESUCCESS)
 	{
 		ret = EREJECT;
 	}
@@ -733,6 +746,7 @@ void *mod_userfilter_create(http_server_t *server, void *arg)
 	httpserver_addmethod(server, METHOD(str_delete), MESSAGE_ALLOW_CONTENT | MESSAGE_PROTECTED);
 	httpserver_addconnector(server, userfilter_connector, mod, \
 			CONNECTOR_DOCFILTER, str_userfilter);
+	ouistiti_setpathfilter(server, _userfilter_checkpath, mod);
 	if (config->configuri != NULL)
 		httpserver_addconnector(server, rootgenerator_connector, mod, \
 				CONNECTOR_DOCUMENT, str_userfilter);
@@ -743,6 +757,7 @@ void *mod_userfilter_create(http_server_t *server, void *arg)
 void mod_userfilter_destroy(void *arg)
 {
 	_mod_userfilter_t *mod = (_mod_userfilter_t *)arg;
+	ouistiti_unsetpathfilter(mod);
 	sqlite3_close(mod->db);
 #ifdef FILE_CONFIG
 	free(mod->config);
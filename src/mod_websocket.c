@@ -104,6 +104,7 @@ struct _mod_websocket_s
 	mod_websocket_run_t run;
 	void *runarg;
 	int fdroot;
+	void *route;
 };
 
 struct _mod_websocket_ctx_s
@@ -206,6 +207,8 @@ static int websocket_connector_init(_mod_websocket_ctx_t *ctx, http_message_t *r
 	_mod_websocket_t *mod = ctx->mod;
 	int ret = EREJECT;
 
+	if (ouistiti_checkroute(mod->route, request) != ESUCCESS)
+		return EREJECT;
 	const char *path_info = NULL;
 	const char *uri = httpmessage_REQUEST(request, "uri");
 	if (htaccess_check(&mod->config->htaccess, uri, &path_info) != ESUCCESS)
@@ -461,6 +464,12 @@ static void *mod_websocket_create(http_server_t *server, mod_websocket_t *config
 
 	mod->runarg = config;
 	mod->fdroot = fdroot;
+	char *prefixes = NULL;
+	char *extensions = NULL;
+	htaccess_route(&config->htaccess, &prefixes, &extensions);
+	mod->route = ouistiti_addroute(server, prefixes, extensions);
+	free(prefixes);
+	free(extensions);
 	httpserver_addmod(server, _mod_websocket_getctx, _mod_websocket_freectx, mod, str_websocket);
 	return mod;
 }
@@ -469,6 +478,7 @@ static void mod_websocket_destroy(void *data)
 {
 	_mod_websocket_t *mod = (_mod_websocket_t *)data;
 #ifdef FILE_CONFIG
+	htaccess_free(&mod->config->htaccess);
 	free(mod->config);
 #endif
 	close(mod->fdroot);
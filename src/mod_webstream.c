@@ -90,6 +90,7 @@ struct _mod_webstream_s
 	mod_webstream_t *config;
 	socket_t socket;
 	int fdroot;
+	void *route;
 };
 
 struct _mod_webstream_ctx_s
@@ -176,6 +177,8 @@ static int _webstream_connector(void *arg, http_message_t *request, http_message
 
 	if (ctx->client == 0)
 	{
+		if (ouistiti_checkroute(mod->route, request) != ESUCCESS)
+			return EREJECT;
 		const char *path_info = NULL;
 		const char *uri = httpmessage_REQUEST(request, "uri");
 		if (htaccess_check(&mod->config->htaccess, uri, &path_info) != ESUCCESS)
@@ -354,6 +357,12 @@ static void *mod_webstream_create(http_server_t *server, mod_webstream_t *config
 
 	mod->config = config;
 	mod->fdroot = fdroot;
+	char *prefixes = NULL;
+	char *extensions = NULL;
+	htaccess_route(&config->htaccess, &prefixes, &extensions);
+	mod->route = ouistiti_addroute(server, prefixes, extensions);
+	free(prefixes);
+	free(extensions);
 	httpserver_addmod(server, _mod_webstream_getctx, _mod_webstream_freectx, mod, str_webstream);
 	srandom(time(NULL));
 	return mod;
@@ -363,6 +372,7 @@ static void mod_webstream_destroy(void *data)
 {
 	_mod_webstream_t *mod = (_mod_webstream_t *)data;
 #ifdef FILE_CONFIG
+	htaccess_free(&mod->config->htaccess);
 	free(mod->config);
 #endif
 	close(mod->fdroot);
@@ -0,0 +1,356 @@
+/*****************************************************************************
+ * routing.c: URI routing of the connectors
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "ouistiti/httpserver.h"
+#include "ouistiti/log.h"
+#include "ouistiti.h"
+
+#define route_dbg(...)
+
+#ifdef ROUTING
+static const char str_router[] = "router";
+
+#define ROUTE_PREFIX 0x01
+#define ROUTE_EXTENSION 0x02
+#define ROUTE_MATCH (ROUTE_PREFIX | ROUTE_EXTENSION)
+
+typedef struct router_s router_t;
+typedef struct route_s route_t;
+typedef struct routenode_s routenode_t;
+typedef struct routeref_s routeref_t;
+
+struct routeref_s
+{
+	int id;
+	routeref_t *next;
+};
+
+/**
+ * the trie stores one caracter by node, the children continue the
+ * string and the siblings are the alternatives at the same position.
+ */
+struct routenode_s
+{
+	char c;
+	routeref_t *routes;
+	routenode_t *child;
+	routenode_t *sibling;
+};
+
+struct route_s
+{
+	router_t *router;
+	http_connector_t connector;
+	void *arg;
+	int id;
+	int any;
+	route_t *next;
+};
+
+struct router_s
+{
+	http_server_t *server;
+	routenode_t *prefixes;
+	routenode_t *extensions;
+	route_t *routes;
+	int nroutes;
+	router_t *next;
+};
+
+/**
+ * the result of the lookup is kept for all the connectors of the
+ * same request.
+ */
+typedef struct routematch_s
+{
+	const router_t *router;
+	const http_message_t *request;
+	const char *uri;
+	unsigned char *flags;
+	int size;
+} routematch_t;
+
+static router_t *g_routers = NULL;
+static __thread routematch_t g_match = {0};
+
+static void _routenode_insert(routenode_t **root, const char *string, size_t length, int id)
+{
+	routenode_t **parent = root;
+	routenode_t *node = NULL;
+	for (size_t i = 0; i < length; i++)
+	{
+		node = *parent;
+		while (node != NULL && node->c != string[i])
+			node = node->sibling;
+		if (node == NULL)
+		{
+			node = calloc(1, sizeof(*node));
+			node->c = string[i];
+			node->sibling = *parent;
+			*parent = node;
+		}
+		parent = &node->child;
+	}
+	if (node == NULL)
+		return;
+	routeref_t *ref = calloc(1, sizeof(*ref));
+	ref->id = id;
+	ref->next = node->routes;
+	node->routes = ref;
+}
+
+static void _routenode_free(routenode_t *node)
+{
+	while (node != NULL)
+	{
+		routenode_t *sibling = node->sibling;
+		_routenode_free(node->child);
+		routeref_t *ref = node->routes;
+		while (ref != NULL)
+		{
+			routeref_t *next = ref->next;
+			free(ref);
+			ref = next;
+		}
+		free(node);
+		node = sibling;
+	}
+}
+
+/**
+ * walk the trie along the string and mark all the routes
+ * ending on the way.
+ */
+static void _routenode_walk(const routenode_t *node, const char *string, unsigned char *flags, unsigned char flag)
+{
+	for (; node != NULL && *string != '\0'; string++)
+	{
+		while (node != NULL && node->c != *string)
+			node = node->sibling;
+		if (node == NULL)
+			break;
+		for (const routeref_t *ref = node->routes; ref != NULL; ref = ref->next)
+			flags[ref->id] |= flag;
+		node = node->child;
+	}
+}
+
+static int _router_insert(routenode_t **root, const char *list, int id)
+{
+	int ret = 0;
+	while (list != NULL && *list != '\0')
+	{
+		const char *end = strchr(list, ',');
+		size_t length = (end != NULL)? (size_t)(end - list): strlen(list);
+		if (length > 0)
+		{
+			_routenode_insert(root, list, length, id);
+			ret++;
+		}
+		list = (end != NULL)? end + 1: NULL;
+	}
+	return ret;
+}
+
+static const unsigned char *_router_lookup(const router_t *router, http_message_t *request)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (g_match.router == router && g_match.request == request && g_match.uri == uri)
+		return g_match.flags;
+
+	if (g_match.size < router->nroutes)
+	{
+		unsigned char *flags = realloc(g_match.flags, router->nroutes);
+		if (flags == NULL)
+			return NULL;
+		g_match.flags = flags;
+		g_match.size = router->nroutes;
+	}
+	for (const route_t *route = router->routes; route != NULL; route = route->next)
+		g_match.flags[route->id] = route->any;
+
+	_routenode_walk(router->prefixes, uri, g_match.flags, ROUTE_PREFIX);
+	for (const char *dot = strchr(uri, '.'); dot != NULL; dot = strchr(dot + 1, '.'))
+		_routenode_walk(router->extensions, dot + 1, g_match.flags, ROUTE_EXTENSION);
+
+	g_match.router = router;
+	g_match.request = request;
+	g_match.uri = uri;
+	return g_match.flags;
+}
+
+/**
+ * this connector runs before all documents connectors to
+ * refresh the lookup with the new request.
+ */
+static int _router_connector(void *arg, http_message_t *request, http_message_t *UNUSED(response))
+{
+	const router_t *router = (const router_t *)arg;
+	g_match.router = NULL;
+	_router_lookup(router, request);
+	return EREJECT;
+}
+
+int ouistiti_checkroute(const void *arg, http_message_t *request)
+{
+	const route_t *route = (const route_t *)arg;
+	if (route == NULL)
+		return ESUCCESS;
+	const unsigned char *flags = _router_lookup(route->router, request);
+	if (flags != NULL && (flags[route->id] & ROUTE_MATCH) != ROUTE_MATCH)
+	{
+		route_dbg("router: skip connector %d", route->id);
+		return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+static int _route_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const route_t *route = (const route_t *)arg;
+	if (ouistiti_checkroute(route, request) != ESUCCESS)
+		return EREJECT;
+	return route->connector(route->arg, request, response);
+}
+
+static router_t *_router_get(http_server_t *server)
+{
+	router_t *router = g_routers;
+	while (router != NULL && router->server != server)
+		router = router->next;
+	if (router == NULL)
+	{
+		router = calloc(1, sizeof(*router));
+		router->server = server;
+		httpserver_addconnector(server, _router_connector, router, CONNECTOR_SERVER, str_router);
+		router->next = g_routers;
+		g_routers = router;
+	}
+	return router;
+}
+
+/**
+ * the connectors registered for each client can't be wrapped,
+ * they check their route themselves with ouistiti_checkroute.
+ */
+void *ouistiti_addroute(http_server_t *server, const char *prefixes, const char *extensions)
+{
+	if ((prefixes == NULL || prefixes[0] == '\0') && (extensions == NULL || extensions[0] == '\0'))
+		return NULL;
+
+	router_t *router = _router_get(server);
+	route_t *route = calloc(1, sizeof(*route));
+	route->router = router;
+	route->id = router->nroutes++;
+	if (_router_insert(&router->prefixes, prefixes, route->id) == 0)
+		route->any |= ROUTE_PREFIX;
+	if (_router_insert(&router->extensions, extensions, route->id) == 0)
+		route->any |= ROUTE_EXTENSION;
+	route->next = router->routes;
+	router->routes = route;
+	dbg("router: route %d on %s %s", route->id, prefixes?prefixes:"*", extensions?extensions:"*");
+	return route;
+}
+
+int ouistiti_setroute(http_server_t *server, http_connector_t connector, void *arg, int priority, const char *name,
+		const char *prefixes, const char *extensions)
+{
+	route_t *route = ouistiti_addroute(server, prefixes, extensions);
+	if (route == NULL)
+	{
+		httpserver_addconnector(server, connector, arg, priority, name);
+		return ESUCCESS;
+	}
+	route->connector = connector;
+	route->arg = arg;
+	dbg("router: %s on route %d", name, route->id);
+
+	/**
+	 * the connector keeps its place in the list of connectors,
+	 * only the URI checking is moved into the router.
+	 */
+	httpserver_addconnector(server, _route_connector, route, priority, name);
+	return ESUCCESS;
+}
+
+void ouistiti_freeroutes(http_server_t *server)
+{
+	router_t **prev = &g_routers;
+	router_t *router = g_routers;
+	while (router != NULL && router->server != server)
+	{
+		prev = &router->next;
+		router = router->next;
+	}
+	if (router == NULL)
+		return;
+	*prev = router->next;
+
+	if (g_match.router == router)
+		g_match.router = NULL;
+	_routenode_free(router->prefixes);
+	_routenode_free(router->extensions);
+	route_t *route = router->routes;
+	while (route != NULL)
+	{
+		route_t *next = route->next;
+		free(route);
+		route = next;
+	}
+	free(router);
+	if (g_routers == NULL)
+	{
+		free(g_match.flags);
+		g_match.flags = NULL;
+		g_match.size = 0;
+	}
+}
+#else
+int ouistiti_setroute(http_server_t *server, http_connector_t connector, void *arg, int priority, const char *name,
+		const char *UNUSED(prefixes), const char *UNUSED(extensions))
+{
+	httpserver_addconnector(server, connector, arg, priority, name);
+	return ESUCCESS;
+}
+
+void *ouistiti_addroute(http_server_t *UNUSED(server), const char *UNUSED(prefixes), const char *UNUSED(extensions))
+{
+	return NULL;
+}
+
+int ouistiti_checkroute(const void *UNUSED(route), http_message_t *UNUSED(request))
+{
+	return ESUCCESS;
+}
+
+void ouistiti_freeroutes(http_server_t *UNUSED(server))
+{
+}
+#endif
@@ -36,6 +36,7 @@ const char str_https[6] = "https";
 //const char str_head[] = "HEAD";
 const char str_put[] = "PUT";
 const char str_delete[] = "DELETE";
+const char str_patch[] = "PATCH";
 const char str_options[] = "OPTIONS";
 
 const char str_authenticate[] = "WWW-Authenticate";
@@ -213,7 +213,12 @@ static void *mod_python_create(http_server_t *server, mod_python_config_t *modco
 		script = script->next;
 	}
 	PyErr_Clear();
-	httpserver_addconnector(server, _python_connector, mod, CONNECTOR_DOCUMENT, str_python);
+	char *prefixes = NULL;
+	char *extensions = NULL;
+	htaccess_route(&modconfig->htaccess, &prefixes, &extensions);
+	ouistiti_setroute(server, _python_connector, mod, CONNECTOR_DOCUMENT, str_python, prefixes, extensions);
+	free(prefixes);
+	free(extensions);
 
 	return mod;
 }
@@ -224,6 +229,7 @@ static void mod_python_destroy(void *arg)
 
 	if (mod->config->env)
 		free(mod->config->env);
+	htaccess_free(&mod->config->htaccess);
 	free(mod->config);
 	free(mod);
 }
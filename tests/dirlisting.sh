@@ -0,0 +1,27 @@
+#!/bin/sh
+# The entries of the listing are in the order of the directory.
+# Each entry of the response must be one of the directory, once,
+# and the response must have the expected number of entries.
+
+COUNT=$1
+RESPONSE=/tmp/ouistiti.test
+ENTRIES=$(dirname $0)/dirlisting_entries.txt
+
+grep -a -q '{"method":"GET","name":"/dirlisting","content":\[' ${RESPONSE} || exit 1
+grep -a -q '{}\],"result":"OK"}' ${RESPONSE} || exit 1
+grep -a -o '{"name":"[^}]*}' ${RESPONSE} > ${RESPONSE}.entries
+if [ $(wc -l < ${RESPONSE}.entries) -ne ${COUNT} ]; then
+	echo "$(wc -l < ${RESPONSE}.entries) entries instead ${COUNT}"
+	exit 1
+fi
+if [ $(sort -u ${RESPONSE}.entries | wc -l) -ne ${COUNT} ]; then
+	echo "entry sent twice"
+	exit 1
+fi
+while read -r ENTRY; do
+	if ! grep -q -F -x "${ENTRY}" ${ENTRIES}; then
+		echo "unknown entry ${ENTRY}"
+		exit 1
+	fi
+done < ${RESPONSE}.entries
+rm -f ${RESPONSE}.entries
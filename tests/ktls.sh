@@ -0,0 +1,26 @@
+#!/bin/sh
+# The kernel counts the TLS sessions which encrypt the sent data
+# (software or offloaded to the device). The counter must grow during
+# the test, otherwise the file was not sent through kTLS.
+
+STAT=/proc/net/tls_stat
+SAVE=/tmp/ouistiti.ktls
+
+ktls_sessions () {
+	awk '/^TlsTxSw|^TlsTxDevice/{n += $2} END {print n + 0}' ${STAT}
+}
+
+case $1 in
+	save)
+		ktls_sessions > ${SAVE}
+		;;
+	check)
+		BEFORE=$(cat ${SAVE})
+		AFTER=$(ktls_sessions)
+		rm -f ${SAVE}
+		if [ ${AFTER} -le ${BEFORE} ]; then
+			echo "ktls not used: ${BEFORE} -> ${AFTER} TX sessions"
+			exit 1
+		fi
+		;;
+esac
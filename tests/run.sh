@@ -123,6 +123,9 @@ start () {
 stop () {
 	TARGET=$1
 
+	if [ -n "$STOPCMD" ]; then
+		eval $STOPCMD
+	fi
 	if [ -n "$PID" ]; then
 		kill $PID
 		sleep 1
@@ -147,9 +150,12 @@ test () {
 	unset TESTHEADERLEN
 	unset TESTCONTENTLEN
 	unset TESTOPTION
+	unset TESTFILE
 	unset ASYNC_PID
 	unset PREPARE_ASYNC
 	unset PREPARE
+	unset STOPCMD
+	unset TESTCHECK
 	unset PID
 	TESTDEFAULTPORT=$DEFAULTPORT
 	TESTRESPONSE=$(basename ${TEST})_rs.txt
@@ -196,7 +202,11 @@ test () {
 			echo "get $CURLPARAM"
 			echo "----"
 		fi
-		$CURL $CURLOUT -f -s -S $CURLPARAM > $TMPRESPONSE
+		if [ -n "$TESTFILE" ]; then
+			$CURL -o $TMPRESPONSE.data -f -s -S -w "%{speed_download}" $CURLPARAM > $TMPRESPONSE
+		else
+			$CURL $CURLOUT -f -s -S $CURLPARAM > $TMPRESPONSE
+		fi
 	fi
 	if [ -n "$WGETURL" ]; then
 		if [ -n "$INFO" ]; then
@@ -261,6 +271,21 @@ test () {
 		echo "content error received $rescontentlen instead $TESTCONTENTLEN"
 		ERR=3
 	fi
+	if [ -n "$TESTFILE" ]; then
+		cmp -s $TMPRESPONSE.data $TESTFILE
+		if [ ! $? -eq 0 ]; then
+			echo "content error received data differs from $TESTFILE"
+			ERR=5
+		fi
+		echo "speed         : $(cat $TMPRESPONSE) bytes/s"
+	fi
+	if [ -n "$TESTCHECK" ]; then
+		eval $TESTCHECK
+		if [ ! $? -eq 0 ]; then
+			echo "check error $TESTCHECK"
+			ERR=6
+		fi
+	fi
 	if [ ! $ERR -eq 0 ]; then
 		echo "$TEST quits on error"
 		stop $TARGET
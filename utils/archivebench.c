@@ -0,0 +1,276 @@
+/*****************************************************************************
+ * archivebench.c: measure the archives of the directories of the document module
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_document.h"
+
+#define DEFAULT_LOOPS 5
+
+#ifdef SENDFILE
+extern int mod_send_sendfile(document_connector_t *private, http_message_t *response);
+#endif
+
+const char str_get[4] = "GET";
+
+/**
+ * the client is a loopback TCP socket, a thread reads
+ * and drops the content. The request is only its query.
+ */
+static int g_sock = -1;
+static document_connector_t *g_private = NULL;
+static const char *g_query = NULL;
+
+int httpclient_socket(http_client_t *UNUSED(client))
+{
+	return g_sock;
+}
+
+int httpclient_send(http_client_t *UNUSED(client), const void *buf, size_t len)
+{
+	return send(g_sock, buf, len, MSG_NOSIGNAL);
+}
+
+void httpclient_shutdown(http_client_t *UNUSED(client))
+{
+}
+
+http_client_t *httpmessage_client(http_message_t *UNUSED(message))
+{
+	return NULL;
+}
+
+void *httpmessage_private(http_message_t *UNUSED(message), void *data)
+{
+	if (data != NULL)
+		g_private = data;
+	return g_private;
+}
+
+const char *httpmessage_REQUEST(http_message_t *UNUSED(message), const char *key)
+{
+	if (!strcmp(key, "query"))
+		return g_query;
+	if (!strcmp(key, "protocol"))
+		return "HTTP/1.1";
+	return "";
+}
+
+int httpmessage_result(http_message_t *UNUSED(message), int UNUSED(result))
+{
+	return 0;
+}
+
+int httpmessage_addheader(http_message_t *UNUSED(message), const char *UNUSED(key),
+		const char *UNUSED(value), ssize_t UNUSED(valuelen))
+{
+	return 0;
+}
+
+int httpmessage_addcontent(http_message_t *UNUSED(message), const char *UNUSED(type),
+		const char *UNUSED(content), ssize_t UNUSED(length))
+{
+	return 0;
+}
+
+int htaccess_check(const htaccess_t *UNUSED(htaccess), const char *UNUSED(uri), const char **UNUSED(path_info))
+{
+	return ESUCCESS;
+}
+
+int ouistiti_checkpath(http_server_t *UNUSED(server), http_message_t *UNUSED(request),
+		const char *UNUSED(method), const char *UNUSED(uri))
+{
+	return ESUCCESS;
+}
+
+void document_close(document_connector_t *private, http_message_t *UNUSED(request))
+{
+	document_archiveclose(private);
+	close(private->fdfile);
+	free(private);
+	g_private = NULL;
+}
+
+static unsigned long long g_received = 0;
+
+static void *_drain(void *arg)
+{
+	int sock = (int)(long)arg;
+	static char buffer[262144];
+	ssize_t length;
+	while ((length = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+		g_received += length;
+	close(sock);
+	return NULL;
+}
+
+static int _connect(pthread_t *thread)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrlen = sizeof(addr);
+	if (bind(server, (struct sockaddr *)&addr, addrlen) != 0 || listen(server, 1) != 0 ||
+		getsockname(server, (struct sockaddr *)&addr, &addrlen) != 0)
+	{
+		close(server);
+		return -1;
+	}
+	g_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(g_sock, (struct sockaddr *)&addr, addrlen) != 0)
+	{
+		close(server);
+		return -1;
+	}
+	int sock = accept(server, NULL, NULL);
+	close(server);
+	g_received = 0;
+	pthread_create(thread, NULL, _drain, (void *)(long)sock);
+	return g_sock;
+}
+
+static const struct
+{
+	const char *name;
+	const char *query;
+	mod_transfer_t transfer;
+} g_archives[] =
+{
+	{"tar", "archive=tar", mod_send_read},
+#ifdef SENDFILE
+	{"tar+sendfile", "archive=tar", mod_send_sendfile},
+#endif
+	{"zip", "archive=zip", mod_send_read},
+	{NULL, NULL, NULL},
+};
+
+/**
+ * the loop of archive_connector on a blocking socket,
+ * the size is the received content with the chunks
+ */
+static double bench(_mod_document_mod_t *mod, int archive, const char *directory, unsigned long long *size)
+{
+	pthread_t thread;
+	if (_connect(&thread) == -1)
+		return 0;
+
+	document_connector_t *private = calloc(1, sizeof(*private));
+	private->mod = mod;
+	private->fdroot = AT_FDCWD;
+	private->fdfile = open(directory, O_RDONLY | O_DIRECTORY);
+	private->url = directory;
+	private->transfer = g_archives[archive].transfer;
+	g_query = g_archives[archive].query;
+	httpmessage_private(NULL, private);
+
+	struct timespec start;
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (g_private != NULL && archive_connector(NULL, NULL, NULL) == ECONTINUE);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	if (g_private != NULL)
+		document_close(g_private, NULL);
+	shutdown(g_sock, SHUT_WR);
+	pthread_join(thread, NULL);
+	close(g_sock);
+	*size = g_received;
+
+	double duration = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+	return *size / duration / 1048576.0;
+}
+
+static int _compare(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	return (va > vb) - (va < vb);
+}
+
+static long _maxrss(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+int main(int argc, char * const argv[])
+{
+	int loops = DEFAULT_LOOPS;
+	mod_document_t config = {0};
+	config.transfersize = DEFAULT_TRANSFERSIZE;
+	config.options = DOCUMENT_ARCHIVE;
+	_mod_document_mod_t mod = { .config = &config };
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>] <directory>...\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	double *results = calloc(loops, sizeof(*results));
+	for (int i = optind; i < argc; i++)
+	{
+		printf("%s\n", argv[i]);
+		for (int j = 0; g_archives[j].name != NULL; j++)
+		{
+			unsigned long long size = 0;
+			for (int l = 0; l < loops; l++)
+				results[l] = bench(&mod, j, argv[i], &size);
+			qsort(results, loops, sizeof(*results), _compare);
+			/// the memory of the walk doesn't depend on the size of the tree
+			printf("\t%-13s %llu bytes %.1f MB/s max RSS %ld kB\n", g_archives[j].name,
+					size, results[loops / 2], _maxrss());
+		}
+	}
+	free(results);
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*****************************************************************************
+ * cgienvbench.c: measure the building of the CGI environment
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libconfig.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_cgi.h"
+#include "mod_auth.h"
+
+#define DEFAULT_LOOPS 1000000
+
+static const char *g_config =
+	"docroot = \"/srv/www/cgi-bin\";"
+	"allow = \"*.cgi*\"; deny = \"*\"; denylast = true;"
+	"env = [\"LD_LIBRARY_PATH=/usr/local/lib\", \"PYTHONPATH=/srv/www/lib\", \"LANG=C.UTF-8\"];";
+
+/**
+ * the values of a usual request, the request is not parsed
+ * to measure only the environment
+ */
+static const char *g_request[][2] =
+{
+	{"software", "ouistiti"},
+	{"name", "www.ouistiti.net"},
+	{"protocol", "HTTP/1.1"},
+	{"addr", "192.168.1.10"},
+	{"port", "443"},
+	{"service", "https"},
+	{"method", "POST"},
+	{"scheme", "https"},
+	{"uri", "/test.cgi/my/path_info"},
+	{"query", "user=foo&lang=fr&page=12"},
+	{"Content-Length", "2048"},
+	{"Content-Type", "application/x-www-form-urlencoded"},
+	{"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"},
+	{"Accept-Encoding", "gzip, deflate, br"},
+	{"Accept-Language", "fr-FR,fr;q=0.8,en-US;q=0.5,en;q=0.3"},
+	{"Cookie", "session=8f14e45fceea167a5a36dedd4bea2543; theme=dark"},
+	{"User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0"},
+	{"Host", "www.ouistiti.net"},
+	{"Referer", "https://www.ouistiti.net/index.html"},
+	{"remote_addr", "192.168.1.20"},
+	{"remote_port", "51234"},
+	{NULL, NULL},
+};
+
+const char str_user[] = "user";
+const char str_group[] = "group";
+
+size_t httpmessage_REQUEST2(http_message_t *UNUSED(message), const char *key, const char **value)
+{
+	for (int i = 0; g_request[i][0] != NULL; i++)
+	{
+		if (!strcmp(g_request[i][0], key))
+		{
+			*value = g_request[i][1];
+			return strlen(g_request[i][1]);
+		}
+	}
+	*value = NULL;
+	return 0;
+}
+
+size_t auth_info2(http_message_t *UNUSED(request), const char *key, const char **value)
+{
+	return httpmessage_REQUEST2(NULL, key, value);
+}
+
+int ouistiti_issecure(server_t *UNUSED(server))
+{
+	return 1;
+}
+
+static double bench(const mod_cgi_config_t *config, long loops)
+{
+	struct timespec start;
+	struct timespec stop;
+	static const char cgi_path[] = "test.cgi";
+	static const char path_info[] = "/my/path_info";
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < loops; i++)
+	{
+		char **env = cgi_buildenv(config, NULL, cgi_path, sizeof(cgi_path) - 1, path_info, sizeof(path_info) - 1);
+		free(env);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return ((stop.tv_sec - start.tv_sec) * 1000000000.0 + (stop.tv_nsec - start.tv_nsec)) / loops;
+}
+
+int main(int argc, char * const argv[])
+{
+	long loops = DEFAULT_LOOPS;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>]\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	config_t configfile;
+	config_init(&configfile);
+	if (config_read_string(&configfile, g_config) != CONFIG_TRUE)
+	{
+		fprintf(stderr, "config error: %s\n", config_error_text(&configfile));
+		config_destroy(&configfile);
+		return -1;
+	}
+	config_setting_t *root = config_root_setting(&configfile);
+	mod_cgi_config_t *precomputed = NULL;
+	cgienv_config(root, root, NULL, &precomputed, NULL);
+	/// without the static part, all the variables are built on each request
+	mod_cgi_config_t dynamic = *precomputed;
+	dynamic.staticenv = NULL;
+	dynamic.nbstaticenv = 0;
+
+	printf("one block:               %.1f ns/env\n", bench(&dynamic, loops));
+	printf("one block + static part: %.1f ns/env\n", bench(precomputed, loops));
+
+	free(precomputed->staticenv);
+	free(precomputed->env);
+	htaccess_free(&precomputed->htaccess);
+	free(precomputed);
+	config_destroy(&configfile);
+	return 0;
+}
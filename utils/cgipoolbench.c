@@ -0,0 +1,199 @@
+/*****************************************************************************
+ * cgipoolbench.c: measure the requests of the CGI pool
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_cgi.h"
+
+#define DEFAULT_LOOPS 1000
+
+static char *g_env[] = {
+	"GATEWAY_INTERFACE=CGI/1.1",
+	"REQUEST_METHOD=GET",
+	"SCRIPT_NAME=/test.fcgi",
+	"QUERY_STRING=",
+	NULL,
+};
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return (stop.tv_sec - start->tv_sec) * 1000000.0 + (stop.tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+/**
+ * the request of the CGI module with a worker of the pool
+ */
+static int request_pool(cgi_pool_t *pool, const mod_cgi_config_t *config, const char *script, char *output, size_t size)
+{
+	cgi_worker_t *worker = cgipool_acquire(pool, config, script);
+	if (worker == NULL)
+		return -1;
+	int length = 0;
+	if (cgipool_begin(worker, g_env) == ESUCCESS && cgipool_write(worker, NULL, 0) == ESUCCESS)
+	{
+		int ret;
+		while ((ret = cgipool_read(worker, output + length, size - length - 1)) > 0)
+			length += ret;
+		if (ret < 0)
+			length = -1;
+	}
+	cgipool_release(worker);
+	if (length >= 0)
+		output[length] = '\0';
+	return length;
+}
+
+/**
+ * the request of the CGI module with posix_spawn, one process per request
+ */
+static int request_spawn(const char *script, char *output, size_t size)
+{
+	int fromcgi[2];
+	if (pipe2(fromcgi, O_CLOEXEC) < 0)
+		return -1;
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, fromcgi[1], STDOUT_FILENO);
+	char * const argv[2] = { (char *)script, NULL };
+	pid_t pid = -1;
+	int ret = posix_spawn(&pid, script, &actions, NULL, argv, g_env);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fromcgi[1]);
+	int length = 0;
+	ssize_t size_read;
+	while (ret == 0 && (size_read = read(fromcgi[0], output + length, size - length - 1)) > 0)
+		length += size_read;
+	close(fromcgi[0]);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+	output[length] = '\0';
+	return (ret == 0)? length: -1;
+}
+
+int main(int argc, char * const argv[])
+{
+	long loops = DEFAULT_LOOPS;
+	const char *cgiscript = NULL;
+	mod_cgi_config_t config = {0};
+	config.pool = "*";
+	config.poolmin = DEFAULT_POOLMIN;
+	config.poolmax = DEFAULT_POOLMAX;
+	config.poolrequests = DEFAULT_POOLREQUESTS;
+	config.poolidle = DEFAULT_POOLIDLE;
+	config.timeout.tv_sec = 3;
+	int verbose = 0;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:r:c:vh");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 'r':
+				config.poolrequests = strtol(optarg, NULL, 10);
+			break;
+			case 'c':
+				cgiscript = optarg;
+			break;
+			case 'v':
+				verbose = 1;
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <requests>][-r <poolrequests>][-c <cgi script>][-v] <docroot> <fastcgi script>\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (optind + 2 > argc)
+	{
+		fprintf(stderr, "%s [-n <requests>][-r <poolrequests>][-c <cgi script>][-v] <docroot> <fastcgi script>\n", argv[0]);
+		return -1;
+	}
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+	const char *docroot = argv[optind];
+	const char *script = argv[optind + 1];
+	int rootfd = open(docroot, O_PATH | O_DIRECTORY);
+	if (rootfd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", docroot, strerror(errno));
+		return -1;
+	}
+
+	char output[4096];
+	cgi_pool_t *pool = cgipool_create(&config, rootfd);
+	/// the first request starts the worker
+	if (request_pool(pool, &config, script, output, sizeof(output)) < 0)
+	{
+		fprintf(stderr, "%s: no FastCGI worker\n", script);
+		cgipool_destroy(pool);
+		return -1;
+	}
+	if (verbose)
+		printf("%s", output);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long errors = 0;
+	for (long i = 0; i < loops; i++)
+	{
+		if (request_pool(pool, &config, script, output, sizeof(output)) < 0)
+			errors++;
+	}
+	printf("pool (%d requests per worker): %.1f us/request, %ld errors\n",
+			config.poolrequests, elapsed(&start) / loops, errors);
+	if (verbose)
+		printf("%s", output);
+	cgipool_destroy(pool);
+
+	if (cgiscript != NULL && fchdir(rootfd) == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		errors = 0;
+		for (long i = 0; i < loops; i++)
+		{
+			if (request_spawn(cgiscript, output, sizeof(output)) < 0)
+				errors++;
+		}
+		printf("posix_spawn: %.1f us/request, %ld errors\n", elapsed(&start) / loops, errors);
+	}
+	close(rootfd);
+	return 0;
+}
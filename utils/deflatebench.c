@@ -0,0 +1,176 @@
+/*****************************************************************************
+ * deflatebench.c: measure the compression of the document module
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_document.h"
+
+#define DEFAULT_LOOPS 100
+#define DEFAULT_LEVEL 6
+
+/**
+ * the content is compressed in one call, the output is the same as
+ * the compression piece by piece of the connectors (Z_NO_FLUSH).
+ */
+static void bench(const char *name, const char *data, size_t size, int level, int loops)
+{
+	char *output = NULL;
+	size_t outputsize = 0;
+	struct timespec start;
+	struct timespec stop;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (int i = 0; i < loops; i++)
+	{
+		free(output);
+		output = NULL;
+		if (document_deflatebuffer(level, data, size, &output, &outputsize) != ESUCCESS)
+		{
+			fprintf(stderr, "%s: deflate error\n", name);
+			return;
+		}
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stop);
+	free(output);
+	double duration = (stop.tv_sec - start.tv_sec) * 1000000.0 + (stop.tv_nsec - start.tv_nsec) / 1000.0;
+	printf("%-24s %8lu -> %7lu bytes (%3lu%%) %8.1f us\n", name, (unsigned long)size,
+			(unsigned long)outputsize, (size > 0)? (unsigned long)(outputsize * 100 / size): 100,
+			duration / loops);
+}
+
+static char *_readfile(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat filestat;
+	if (fd == -1 || fstat(fd, &filestat) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return NULL;
+	}
+	char *data = malloc(filestat.st_size + 1);
+	ssize_t length = 0;
+	if (data != NULL)
+		length = read(fd, data, filestat.st_size);
+	close(fd);
+	if (length < 0)
+	{
+		free(data);
+		return NULL;
+	}
+	*size = length;
+	return data;
+}
+
+/**
+ * the listing of a directory with the format of the dirlisting module
+ */
+static char *_listing(const char *path, size_t *size)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	size_t length = 0;
+	char *data = NULL;
+	FILE *output = open_memstream(&data, &length);
+	fprintf(output, "{\"method\":\"GET\",\"name\":\"%s\",\"content\":[", path);
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL)
+	{
+		struct stat filestat;
+		if (fstatat(dirfd(dir), ent->d_name, &filestat, 0) != 0)
+			continue;
+		fprintf(output, "{\"name\":\"%s\",\"size\":\"%lu %s\",\"type\":%d,\"mime\":\"%s\"},",
+				ent->d_name, (unsigned long)filestat.st_size, "B", ent->d_type,
+				S_ISDIR(filestat.st_mode)? "inode/directory": "application/octet-stream");
+	}
+	fprintf(output, "{}],\"result\":\"OK\"}\n");
+	fclose(output);
+	closedir(dir);
+	*size = length;
+	return data;
+}
+
+int main(int argc, char * const argv[])
+{
+	int loops = DEFAULT_LOOPS;
+	int level = DEFAULT_LEVEL;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:l:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 'l':
+				level = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>][-l <level>] <file|directory>...\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	for (int i = optind; i < argc; i++)
+	{
+		struct stat filestat;
+		if (stat(argv[i], &filestat) != 0)
+		{
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+			continue;
+		}
+		size_t size = 0;
+		char *data;
+		if (S_ISDIR(filestat.st_mode))
+			data = _listing(argv[i], &size);
+		else
+			data = _readfile(argv[i], &size);
+		if (data == NULL)
+			continue;
+		const char *name = strrchr(argv[i], '/');
+		name = (name != NULL && name[1] != '\0')? name + 1: argv[i];
+		bench(name, data, size, level, loops);
+		free(data);
+	}
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*****************************************************************************
+ * htaccessbench.c: measure the htaccess checking
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libconfig.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_document.h"
+
+#define DEFAULT_LOOPS 1000000
+
+/**
+ * the allow/deny lists of the samples configurations
+ */
+static const char *g_configs[] =
+{
+	"allow = \".html,.htm,.css,.js,.txt,*\"; deny = \"^.htaccess,.php\";",
+	"allow = \".html,.*htm*,.css,.js,.txt,*\"; deny = \".htaccess,.cgi,*.php\";",
+	"allow = \"*.cgi*\"; deny = \"*\"; denylast = true;",
+	"allow = \"^/token$,^/trust/,^/index.html$\"; deny = \"*\"; denylast = true;",
+	"allow = \"stream\"; deny = \"*\"; denylast = true;",
+	NULL
+};
+
+static const char *g_uris[] =
+{
+	"/index.html",
+	"/css/bootstrap.min.css",
+	"/js/jquery/jquery-3.6.0.min.js",
+	"/apps/images/logo.png",
+	"/test.cgi/my/path_info",
+	"/trust/token/user",
+	"/.htaccess",
+	"/admin/config.php",
+	"/stream/video.mjpeg",
+	NULL
+};
+
+static double bench(const htaccess_t *htaccess, long loops)
+{
+	struct timespec start;
+	struct timespec stop;
+	int nuris = 0;
+	while (g_uris[nuris] != NULL)
+		nuris++;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < loops; i++)
+	{
+		const char *path_info = NULL;
+		htaccess_check(htaccess, g_uris[i % nuris], &path_info);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return ((stop.tv_sec - start.tv_sec) * 1000000000.0 + (stop.tv_nsec - start.tv_nsec)) / loops;
+}
+
+int main(int argc, char * const argv[])
+{
+	long loops = DEFAULT_LOOPS;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>]\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	for (int i = 0; g_configs[i] != NULL; i++)
+	{
+		config_t configfile;
+		config_init(&configfile);
+		if (config_read_string(&configfile, g_configs[i]) != CONFIG_TRUE)
+		{
+			fprintf(stderr, "config error: %s\n", config_error_text(&configfile));
+			config_destroy(&configfile);
+			continue;
+		}
+		htaccess_t compiled = {0};
+		htaccess_config(config_root_setting(&configfile), &compiled);
+		/// without the compiled patterns, htaccess_check uses utils_searchexp
+		htaccess_t parsed = compiled;
+		parsed.denyfirstexp = NULL;
+		parsed.allowexp = NULL;
+		parsed.denylastexp = NULL;
+
+		for (int j = 0; g_uris[j] != NULL; j++)
+		{
+			const char *compiled_info = NULL;
+			const char *parsed_info = NULL;
+			int compiled_ret = htaccess_check(&compiled, g_uris[j], &compiled_info);
+			int parsed_ret = htaccess_check(&parsed, g_uris[j], &parsed_info);
+			if (compiled_ret != parsed_ret || compiled_info != parsed_info)
+				fprintf(stderr, "mismatch on %s with %s\n", g_uris[j], g_configs[i]);
+		}
+
+		printf("%s\n", g_configs[i]);
+		printf("\tsearchexp: %.1f ns/check\n", bench(&parsed, loops));
+		printf("\tcompiled:  %.1f ns/check\n", bench(&compiled, loops));
+
+		htaccess_free(&compiled);
+		config_destroy(&configfile);
+	}
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * spawnbench.c: measure the start of a CGI script
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LOOPS 200
+#define DEFAULT_SCRIPT "/bin/true"
+
+/**
+ * the memory of the process grows like a server with caches
+ */
+static const size_t g_sizes[] = { 0, 64, 256, 1024, 0 };
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	return (stop.tv_sec - start->tv_sec) * 1000000.0 + (stop.tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+static pid_t run_fork(char * const argv[], char * const env[])
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		execve(argv[0], argv, env);
+		_exit(1);
+	}
+	return pid;
+}
+
+static pid_t run_spawn(char * const argv[], char * const env[])
+{
+	pid_t pid = -1;
+	if (posix_spawn(&pid, argv[0], NULL, NULL, argv, env) != 0)
+		return -1;
+	return pid;
+}
+
+static double bench(pid_t (*run)(char * const argv[], char * const env[]), char * const argv[], long loops)
+{
+	char * const env[] = { "GATEWAY_INTERFACE=CGI/1.1", NULL };
+	double total = 0;
+	for (long i = 0; i < loops; i++)
+	{
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pid_t pid = run(argv, env);
+		/// only the time spent inside the server is measured
+		total += elapsed(&start);
+		if (pid < 0)
+		{
+			fprintf(stderr, "spawn error: %s\n", strerror(errno));
+			return -1;
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return total / loops;
+}
+
+int main(int argc, char * const argv[])
+{
+	long loops = DEFAULT_LOOPS;
+	const char *script = DEFAULT_SCRIPT;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:s:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 's':
+				script = optarg;
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>] [-s <script>]\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	char * const scriptargv[] = { (char *)script, NULL };
+	size_t allocated = 0;
+	char *memory = NULL;
+	int i = 0;
+	do
+	{
+		size_t size = g_sizes[i] * 1024 * 1024;
+		if (size > allocated)
+		{
+			char *tmp = realloc(memory, size);
+			if (tmp == NULL)
+				break;
+			memory = tmp;
+			/// the pages must be mapped to be copied by fork
+			memset(memory + allocated, 0xAA, size - allocated);
+			allocated = size;
+		}
+		printf("%zu MB\n", g_sizes[i]);
+		printf("\tfork:        %.1f us/spawn\n", bench(run_fork, scriptargv, loops));
+		printf("\tposix_spawn: %.1f us/spawn\n", bench(run_spawn, scriptargv, loops));
+		i++;
+	} while (g_sizes[i] != 0);
+	free(memory);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*****************************************************************************
+ * transferbench.c: measure the transfer functions of the document module
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ouistiti/httpserver.h"
+#include "mod_document.h"
+
+#define DEFAULT_LOOPS 7
+
+/**
+ * the client is a loopback TCP socket, a thread reads
+ * and drops the content
+ */
+static int g_sock = -1;
+
+int httpclient_socket(http_client_t *UNUSED(client))
+{
+	return g_sock;
+}
+
+int httpclient_send(http_client_t *UNUSED(client), const void *buf, size_t len)
+{
+	return send(g_sock, buf, len, MSG_NOSIGNAL);
+}
+
+/**
+ * the previous transfer read 64 bytes on the stack for each loop
+ */
+static int send_64bytes(document_connector_t *private, http_message_t *UNUSED(response))
+{
+	char content[64];
+	ssize_t size = pread(private->fdfile, content, sizeof(content), private->offset);
+	if (size <= 0)
+		return size;
+	return httpclient_send(private->ctl, content, size);
+}
+
+static const struct
+{
+	const char *name;
+	mod_transfer_t transfer;
+} g_transfers[] =
+{
+	{"64 bytes", send_64bytes},
+	{"read", mod_send_read},
+	{"mmap", mod_send_mmap},
+	{NULL, NULL},
+};
+
+static void *_drain(void *arg)
+{
+	int sock = (int)(long)arg;
+	static char buffer[262144];
+	while (recv(sock, buffer, sizeof(buffer), 0) > 0);
+	close(sock);
+	return NULL;
+}
+
+static int _connect(pthread_t *thread)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrlen = sizeof(addr);
+	if (bind(server, (struct sockaddr *)&addr, addrlen) != 0 || listen(server, 1) != 0 ||
+		getsockname(server, (struct sockaddr *)&addr, &addrlen) != 0)
+	{
+		close(server);
+		return -1;
+	}
+	g_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(g_sock, (struct sockaddr *)&addr, addrlen) != 0)
+	{
+		close(server);
+		return -1;
+	}
+	int sock = accept(server, NULL, NULL);
+	close(server);
+	pthread_create(thread, NULL, _drain, (void *)(long)sock);
+	return g_sock;
+}
+
+/**
+ * the loop of getfile_connector on a blocking socket
+ */
+static double bench(mod_transfer_t transfer, mod_document_t *config, int fd, size_t size)
+{
+	pthread_t thread;
+	if (_connect(&thread) == -1)
+		return 0;
+
+	_mod_document_mod_t mod = { .config = config };
+	document_connector_t private = {0};
+	private.mod = &mod;
+	private.fdfile = fd;
+	private.size = size;
+
+	struct timespec start;
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (private.size > 0)
+	{
+		int ret = transfer(&private, NULL);
+		if (ret == ECONTINUE && errno == EAGAIN)
+			continue;
+		if (ret <= 0)
+		{
+			fprintf(stderr, "transfer error %s\n", strerror(errno));
+			break;
+		}
+		private.offset += ret;
+		private.size -= ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	document_transferclose(&private);
+	shutdown(g_sock, SHUT_WR);
+	pthread_join(thread, NULL);
+	close(g_sock);
+
+	double duration = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+	return size / duration / 1048576.0;
+}
+
+static int _compare(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	return (va > vb) - (va < vb);
+}
+
+int main(int argc, char * const argv[])
+{
+	int loops = DEFAULT_LOOPS;
+	mod_document_t config = {0};
+	config.transfersize = DEFAULT_TRANSFERSIZE;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:t:h");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 't':
+				config.transfersize = strtol(optarg, NULL, 10);
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>][-t <transfersize>] <file>...\n", argv[0]);
+				return -1;
+		}
+	} while (opt != -1);
+	if (loops < 1)
+		loops = DEFAULT_LOOPS;
+
+	double *results = calloc(loops, sizeof(*results));
+	for (int i = optind; i < argc; i++)
+	{
+		int fd = open(argv[i], O_RDONLY);
+		struct stat filestat;
+		if (fd == -1 || fstat(fd, &filestat) != 0)
+		{
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+			continue;
+		}
+		printf("%s (%lu bytes)\n", argv[i], (unsigned long)filestat.st_size);
+		for (int j = 0; g_transfers[j].name != NULL; j++)
+		{
+			for (int l = 0; l < loops; l++)
+				results[l] = bench(g_transfers[j].transfer, &config, fd, filestat.st_size);
+			qsort(results, loops, sizeof(*results), _compare);
+			printf("\t%-9s %.1f MB/s\n", g_transfers[j].name, results[loops / 2]);
+		}
+		close(fd);
+	}
+	free(results);
+	return 0;
+}
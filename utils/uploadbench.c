@@ -0,0 +1,185 @@
+/*****************************************************************************
+ * uploadbench.c: measure the writing of the uploaded files
+ * this file is part of https://github.com/ouistiti-project/ouistiti
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/falloc.h>
+
+#define DEFAULT_SIZE (1024 * 1024 * 1024)
+#define DEFAULT_CHUNKSIZE (64 * 1024)
+#define DEFAULT_LOOPS 3
+
+/**
+ * the content is received by pieces of chunksize bytes, the socket is
+ * not part of the measure.
+ */
+static int _write(int fd, const char *chunk, size_t chunksize, unsigned long long size)
+{
+	unsigned long long offset = 0;
+	while (offset < size)
+	{
+		size_t length = (size - offset < chunksize)? size - offset: chunksize;
+		ssize_t ret = pwrite(fd, chunk, length, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		offset += ret;
+	}
+	return 0;
+}
+
+/**
+ * the previous upload wrote directly into the file
+ */
+static int upload_direct(const char *path, const char *chunk, size_t chunksize, unsigned long long size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+	if (fd < 0)
+		return -1;
+	int ret = _write(fd, chunk, chunksize, size);
+	close(fd);
+	return ret;
+}
+
+/**
+ * the anonymous file is preallocated and linked at the end
+ */
+static int upload_tmpfile(const char *path, const char *chunk, size_t chunksize, unsigned long long size)
+{
+	char *dup = strdup(path);
+	int fd = open(dirname(dup), O_TMPFILE | O_WRONLY, 0640);
+	free(dup);
+	if (fd < 0)
+		return -1;
+	int ret = -1;
+	char fdpath[32];
+	snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd);
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0 &&
+		_write(fd, chunk, chunksize, size) == 0)
+		ret = linkat(AT_FDCWD, fdpath, AT_FDCWD, path, AT_SYMLINK_FOLLOW);
+	close(fd);
+	return ret;
+}
+
+static const struct
+{
+	const char *name;
+	int (*upload)(const char *path, const char *chunk, size_t chunksize, unsigned long long size);
+} g_uploads[] =
+{
+	{"direct", upload_direct},
+	{"tmpfile", upload_tmpfile},
+	{NULL, NULL},
+};
+
+static int _compare(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	return (va > vb) - (va < vb);
+}
+
+int main(int argc, char * const argv[])
+{
+	int loops = DEFAULT_LOOPS;
+	unsigned long long size = DEFAULT_SIZE;
+	size_t chunksize = DEFAULT_CHUNKSIZE;
+	int syncfile = 0;
+	int opt;
+	do
+	{
+		opt = getopt(argc, argv, "n:s:b:Sh");
+		switch (opt)
+		{
+			case 'n':
+				loops = strtol(optarg, NULL, 10);
+			break;
+			case 's':
+				size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+			break;
+			case 'b':
+				chunksize = strtoul(optarg, NULL, 10);
+			break;
+			case 'S':
+				syncfile = 1;
+			break;
+			case 'h':
+				fprintf(stderr, "%s [-n <loops>][-s <size MB>][-b <chunk size>][-S] <file>\n", argv[0]);
+				fprintf(stderr, "\t-S    sync the filesystem after each upload\n");
+				return -1;
+		}
+	} while (opt != -1);
+	if (optind >= argc || loops < 1 || chunksize == 0)
+	{
+		fprintf(stderr, "%s [-n <loops>][-s <size MB>][-b <chunk size>][-S] <file>\n", argv[0]);
+		return -1;
+	}
+	const char *path = argv[optind];
+
+	char *chunk = malloc(chunksize);
+	if (chunk == NULL)
+		return -1;
+	for (size_t i = 0; i < chunksize; i++)
+		chunk[i] = random();
+
+	double *results = calloc(loops, sizeof(*results));
+	for (int j = 0; g_uploads[j].name != NULL; j++)
+	{
+		for (int l = 0; l < loops; l++)
+		{
+			unlink(path);
+			struct timespec start;
+			struct timespec stop;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (g_uploads[j].upload(path, chunk, chunksize, size) != 0)
+			{
+				fprintf(stderr, "%s: %s error %s\n", path, g_uploads[j].name, strerror(errno));
+				results[l] = 0;
+				continue;
+			}
+			if (syncfile)
+				sync();
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			double duration = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+			results[l] = size / duration / 1048576.0;
+		}
+		qsort(results, loops, sizeof(*results), _compare);
+		printf("%-8s %.1f MB/s\n", g_uploads[j].name, results[loops / 2]);
+	}
+	unlink(path);
+	free(results);
+	free(chunk);
+	return 0;
+}